@@ -0,0 +1,245 @@
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures how dlopen()/dlclose() scale across threads, before and after the
+// library (and with it, the dlopen/dlclose hooks) is loaded into the process.
+// Each thread loops over the given DSOs, loading and unloading them.
+//
+// usage: bench-dlfcn [-t THREADS,...] [-n CYCLES] <gtkclipblock library> <dso>...
+
+typedef struct {
+  char** dsos;
+  size_t n_dsos;
+  size_t offset;
+  size_t cycles;
+  pthread_barrier_t* barrier;
+  uint64_t* latencies;
+  bool failed;
+} worker_t;
+
+typedef struct {
+  double throughput;
+  uint64_t p50;
+  uint64_t p99;
+  double mean;
+} result_t;
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void* worker_main(void* arg) {
+  auto worker = (worker_t*)arg;
+  pthread_barrier_wait(worker->barrier);
+
+  for (size_t i = 0; i < worker->cycles; i++) {
+    auto dso = worker->dsos[(worker->offset + i) % worker->n_dsos];
+
+    auto start = now_ns();
+    auto handle = dlopen(dso, RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr || dlclose(handle) != 0) {
+      worker->failed = true;
+      break;
+    }
+    worker->latencies[i] = now_ns() - start;
+  }
+
+  return nullptr;
+}
+
+static int compare_u64(void const* a, void const* b) {
+  auto lhs = *(uint64_t const*)a;
+  auto rhs = *(uint64_t const*)b;
+  return lhs < rhs ? -1 : lhs > rhs;
+}
+
+static bool run(
+  size_t n_threads,
+  size_t cycles,
+  char** dsos,
+  size_t n_dsos,
+  result_t* result
+) {
+  auto threads = (pthread_t*)calloc(n_threads, sizeof(pthread_t));
+  auto workers = (worker_t*)calloc(n_threads, sizeof(worker_t));
+  auto latencies = (uint64_t*)calloc(n_threads * cycles, sizeof(uint64_t));
+  if (threads == nullptr || workers == nullptr || latencies == nullptr) {
+    perror("bench-dlfcn");
+    exit(1);
+  }
+
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, nullptr, n_threads + 1);
+
+  for (size_t i = 0; i < n_threads; i++) {
+    workers[i] = (worker_t){
+      .dsos = dsos,
+      .n_dsos = n_dsos,
+      .offset = i,
+      .cycles = cycles,
+      .barrier = &barrier,
+      .latencies = latencies + i * cycles,
+    };
+    if (pthread_create(&threads[i], nullptr, worker_main, &workers[i]) != 0) {
+      perror("bench-dlfcn");
+      exit(1);
+    }
+  }
+
+  pthread_barrier_wait(&barrier);
+  auto start = now_ns();
+
+  bool ok = true;
+  for (size_t i = 0; i < n_threads; i++) {
+    pthread_join(threads[i], nullptr);
+    ok &= !workers[i].failed;
+  }
+
+  auto elapsed = now_ns() - start;
+  pthread_barrier_destroy(&barrier);
+
+  if (ok) {
+    auto n = n_threads * cycles;
+    qsort(latencies, n, sizeof(*latencies), compare_u64);
+
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      sum += latencies[i];
+    }
+
+    *result = (result_t){
+      .throughput = n * 1e9 / elapsed,
+      .p50 = latencies[n / 2],
+      .p99 = latencies[n * 99 / 100],
+      .mean = sum / n,
+    };
+  }
+
+  free(latencies);
+  free(workers);
+  free(threads);
+  return ok;
+}
+
+static bool run_all(
+  char const* label,
+  size_t const* thread_counts,
+  size_t n_thread_counts,
+  size_t cycles,
+  char** dsos,
+  size_t n_dsos
+) {
+  // Warm up the loader's caches (and the page cache) first.
+  result_t result;
+  if (!run(1, n_dsos, dsos, n_dsos, &result)) {
+    return false;
+  }
+
+  // Whatever a cycle takes beyond the single-threaded mean is time spent
+  // waiting on locks: the loader's own, plus the hooks' if they're installed.
+  double single_mean = 0;
+
+  for (size_t i = 0; i < n_thread_counts; i++) {
+    if (!run(thread_counts[i], cycles, dsos, n_dsos, &result)) {
+      return false;
+    }
+
+    if (i == 0) {
+      single_mean = result.mean;
+    }
+
+    auto wait = result.mean > single_mean ? result.mean - single_mean : 0;
+    printf(
+      "%-9s %7zu %12.0f %10.1f %10.1f %10.1f\n",
+      label,
+      thread_counts[i],
+      result.throughput,
+      result.p50 / 1e3,
+      result.p99 / 1e3,
+      wait / 1e3
+    );
+  }
+
+  return true;
+}
+
+static void usage(FILE* stream, char const* progname) {
+  fprintf(
+    stream,
+    "usage: %s [-t THREADS,...] [-n CYCLES] <gtkclipblock library> <dso>...\n",
+    progname
+  );
+}
+
+int main(int argc, char** argv) {
+  size_t thread_counts[16] = { 1, 2, 4, 8 };
+  size_t n_thread_counts = 4;
+  size_t cycles = 2000;
+
+  int argi = 1;
+  for (; argi < argc && argv[argi][0] == '-'; argi++) {
+    if (strcmp(argv[argi], "-t") == 0 && argi + 1 < argc) {
+      n_thread_counts = 0;
+      char* rest = nullptr;
+      for (
+        auto tok = strtok_r(argv[++argi], ",", &rest);
+        tok != nullptr && n_thread_counts < sizeof(thread_counts) / sizeof(*thread_counts);
+        tok = strtok_r(nullptr, ",", &rest)
+      ) {
+        thread_counts[n_thread_counts++] = strtoul(tok, nullptr, 10);
+      }
+    } else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc) {
+      cycles = strtoul(argv[++argi], nullptr, 10);
+    } else {
+      usage(stderr, argv[0]);
+      return 2;
+    }
+  }
+
+  if (argc - argi < 2 || n_thread_counts == 0 || cycles == 0) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+
+  for (size_t i = 0; i < n_thread_counts; i++) {
+    if (thread_counts[i] == 0) {
+      usage(stderr, argv[0]);
+      return 2;
+    }
+  }
+
+  auto library = argv[argi];
+  auto dsos = argv + argi + 1;
+  size_t n_dsos = argc - argi - 1;
+
+  printf(
+    "%-9s %7s %12s %10s %10s %10s\n",
+    "mode", "threads", "cycles/s", "p50 (us)", "p99 (us)", "wait (us)"
+  );
+
+  if (!run_all("baseline", thread_counts, n_thread_counts, cycles, dsos, n_dsos)) {
+    fprintf(stderr, "bench-dlfcn: %s\n", dlerror());
+    return 1;
+  }
+
+  setenv("GTKCLIPBLOCK_HOOK", "1", true);
+  setenv("GTKCLIPBLOCK_HOOK_DLFCN", "1", true);
+  if (dlopen(library, RTLD_NOW) == nullptr) {
+    fprintf(stderr, "bench-dlfcn: %s\n", dlerror());
+    return 1;
+  }
+
+  if (!run_all("hooked", thread_counts, n_thread_counts, cycles, dsos, n_dsos)) {
+    fprintf(stderr, "bench-dlfcn: %s\n", dlerror());
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,239 @@
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Measures the per-call cost of the clipboard hooks against one of the stub
+// GTK libraries: every function is timed once before the library is loaded
+// (baseline) and once after (hooked), in the same process.
+//
+// usage: bench-hooks <gtk2|gtk3|gtk4> <stub library> <gtkclipblock library>
+
+#define ITERATIONS 1000000
+#define REPETITIONS 5
+
+typedef void (*call_func_t)(void* func, void* clipboard);
+
+typedef struct {
+  char const* name;
+  call_func_t call;
+  void* func;
+  double baseline_ns[2];
+  double hooked_ns[2];
+} bench_func_t;
+
+static char const target_name[] = "UTF8_STRING";
+
+static struct {
+  char* target;
+  unsigned int flags;
+  unsigned int info;
+} const targets[] = {
+  { .target = (char*)target_name },
+};
+
+static void dummy_callback() {}
+
+static void call_gtk_clipboard_set_with_data(void* func, void* clipboard) {
+  ((int (*)(void*, void const*, unsigned int, void*, void*, void*))func)(
+    clipboard, targets, 1, dummy_callback, dummy_callback, nullptr
+  );
+}
+
+static void call_gtk_clipboard_set_with_owner(void* func, void* clipboard) {
+  ((int (*)(void*, void const*, unsigned int, void*, void*, void*))func)(
+    clipboard, targets, 1, dummy_callback, dummy_callback, clipboard
+  );
+}
+
+static void call_gtk_clipboard_set_text(void* func, void* clipboard) {
+  ((void (*)(void*, char const*, int))func)(clipboard, "x", 1);
+}
+
+static void call_gtk_clipboard_set_image(void* func, void* clipboard) {
+  ((void (*)(void*, void*))func)(clipboard, clipboard);
+}
+
+static void call_gtk_clipboard_set_can_store(void* func, void* clipboard) {
+  ((void (*)(void*, void const*, int))func)(clipboard, targets, 1);
+}
+
+static void call_gtk_clipboard_store(void* func, void* clipboard) {
+  ((void (*)(void*))func)(clipboard);
+}
+
+static void call_gtk_clipboard_request_contents(void* func, void* clipboard) {
+  ((void (*)(void*, void*, void*, void*))func)(
+    clipboard, (void*)1, dummy_callback, nullptr
+  );
+}
+
+static void call_gtk_clipboard_wait_for_contents(void* func, void* clipboard) {
+  ((void* (*)(void*, void*))func)(clipboard, (void*)1);
+}
+
+static void call_gtk_clipboard_wait_for_object(void* func, void* clipboard) {
+  // wait_for_text/wait_for_image return the text or the pixbuf
+  ((void* (*)(void*))func)(clipboard);
+}
+
+static void call_gtk_clipboard_wait_for_targets(void* func, void* clipboard) {
+  void* targets;
+  int n_targets;
+  ((int (*)(void*, void**, int*))func)(clipboard, &targets, &n_targets);
+}
+
+static void call_gtk_clipboard_wait_is_text_available(void* func, void* clipboard) {
+  ((int (*)(void*))func)(clipboard);
+}
+
+static void call_gdk_clipboard_set_text(void* func, void* clipboard) {
+  ((void (*)(void*, char const*))func)(clipboard, "x");
+}
+
+static void call_gdk_clipboard_set_object(void* func, void* clipboard) {
+  // set_texture/set_value/set_content only look at their argument in the stub
+  ((void (*)(void*, void*))func)(clipboard, clipboard);
+}
+
+static bench_func_t gtk3_funcs[] = {
+  { .name = "gtk_clipboard_set_with_data", .call = call_gtk_clipboard_set_with_data },
+  { .name = "gtk_clipboard_set_with_owner", .call = call_gtk_clipboard_set_with_owner },
+  { .name = "gtk_clipboard_set_text", .call = call_gtk_clipboard_set_text },
+  { .name = "gtk_clipboard_set_image", .call = call_gtk_clipboard_set_image },
+  { .name = "gtk_clipboard_set_can_store", .call = call_gtk_clipboard_set_can_store },
+  { .name = "gtk_clipboard_store", .call = call_gtk_clipboard_store },
+  { .name = "gtk_clipboard_request_contents", .call = call_gtk_clipboard_request_contents },
+  { .name = "gtk_clipboard_wait_for_contents", .call = call_gtk_clipboard_wait_for_contents },
+  { .name = "gtk_clipboard_wait_for_text", .call = call_gtk_clipboard_wait_for_object },
+  { .name = "gtk_clipboard_wait_for_image", .call = call_gtk_clipboard_wait_for_object },
+  { .name = "gtk_clipboard_wait_for_targets", .call = call_gtk_clipboard_wait_for_targets },
+  { .name = "gtk_clipboard_wait_is_text_available", .call = call_gtk_clipboard_wait_is_text_available },
+  {},
+};
+
+static bench_func_t gtk4_funcs[] = {
+  { .name = "gdk_clipboard_set_text", .call = call_gdk_clipboard_set_text },
+  { .name = "gdk_clipboard_set_texture", .call = call_gdk_clipboard_set_object },
+  { .name = "gdk_clipboard_set_value", .call = call_gdk_clipboard_set_object },
+  { .name = "gdk_clipboard_set_content", .call = call_gdk_clipboard_set_object },
+  {},
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static double measure(bench_func_t const* bench, void* clipboard) {
+  // The fastest repetition is the one least disturbed by everything else
+  // running on the machine.
+  double best = 0;
+  for (int rep = 0; rep < REPETITIONS; rep++) {
+    auto start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+      bench->call(bench->func, clipboard);
+    }
+    double ns = (double)(now_ns() - start) / ITERATIONS;
+    if (rep == 0 || ns < best) {
+      best = ns;
+    }
+  }
+  return best;
+}
+
+static void* resolve(void* handle, char const* name) {
+  auto sym = dlsym(handle, name);
+  if (sym == nullptr) {
+    fprintf(stderr, "bench-hooks: %s\n", dlerror());
+    exit(1);
+  }
+  return sym;
+}
+
+int main(int argc, char** argv) {
+  if (argc != 4) {
+    fprintf(stderr, "usage: %s <gtk2|gtk3|gtk4> <stub library> <gtkclipblock library>\n", argv[0]);
+    return 2;
+  }
+
+  auto toolkit = argv[1];
+  bool gtk4 = strcmp(toolkit, "gtk4") == 0;
+
+  // RTLD_GLOBAL, so that the hooks get installed the same way as for a
+  // program linked against GTK.
+  auto stub = dlopen(argv[2], RTLD_NOW | RTLD_GLOBAL);
+  if (stub == nullptr) {
+    fprintf(stderr, "bench-hooks: %s\n", dlerror());
+    return 1;
+  }
+
+  auto stub_calls = (uint64_t volatile*)resolve(stub, "stub_calls");
+  auto display = ((void* (*)())resolve(stub, "gdk_display_get_default"))();
+  void* clipboards[2];
+  if (gtk4) {
+    clipboards[0] = ((void* (*)(void*))resolve(stub, "gdk_display_get_primary_clipboard"))(display);
+    clipboards[1] = ((void* (*)(void*))resolve(stub, "gdk_display_get_clipboard"))(display);
+  } else {
+    auto get_for_display = (void* (*)(void*, void*))resolve(stub, "gtk_clipboard_get_for_display");
+    clipboards[0] = get_for_display(display, (void*)1);
+    clipboards[1] = get_for_display(display, (void*)69);
+  }
+
+  auto funcs = gtk4 ? gtk4_funcs : gtk3_funcs;
+  for (auto bench = funcs; bench->name != nullptr; bench++) {
+    bench->func = resolve(stub, bench->name);
+    for (int i = 0; i < 2; i++) {
+      bench->baseline_ns[i] = measure(bench, clipboards[i]);
+    }
+  }
+
+  setenv("GTKCLIPBLOCK_HOOK", toolkit, true);
+  setenv("GTKCLIPBLOCK_HOOK_DLFCN", "0", true);
+  auto gtkclipblock = dlopen(argv[3], RTLD_NOW);
+  if (gtkclipblock == nullptr) {
+    fprintf(stderr, "bench-hooks: %s\n", dlerror());
+    return 1;
+  }
+
+  // Make sure the hooks are actually in place; a blocked call never reaches
+  // the stub.
+  auto calls = *stub_calls;
+  funcs[0].call(funcs[0].func, clipboards[0]);
+  if (*stub_calls != calls) {
+    fprintf(stderr, "bench-hooks: the %s hooks didn't get installed\n", toolkit);
+    return 1;
+  }
+
+  for (auto bench = funcs; bench->name != nullptr; bench++) {
+    for (int i = 0; i < 2; i++) {
+      bench->hooked_ns[i] = measure(bench, clipboards[i]);
+    }
+  }
+
+  printf(
+    "%-38s %-9s %12s %12s %12s\n",
+    toolkit, "clipboard", "baseline", "hooked", "overhead"
+  );
+  for (auto bench = funcs; bench->name != nullptr; bench++) {
+    for (int i = 0; i < 2; i++) {
+      printf(
+        "%-38s %-9s %9.2f ns %9.2f ns %+9.2f ns\n",
+        bench->name,
+        i == 0 ? "primary" : "regular",
+        bench->baseline_ns[i],
+        bench->hooked_ns[i],
+        bench->hooked_ns[i] - bench->baseline_ns[i]
+      );
+    }
+  }
+
+  auto dirtied_text_pages = (size_t (*)())resolve(gtkclipblock, "gtkclipblock_dirtied_text_pages");
+  printf("%s text pages dirtied: %zu\n", toolkit, dirtied_text_pages());
+
+  return 0;
+}
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <limits.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Measures what preloading the library costs every process, as with
+// /etc/ld.so.preload: each program is spawned over and over, without the
+// library and then preloaded under different settings, reporting the
+// spawn-to-exit latency, the minor page faults and the private dirty memory
+// of each process.
+//
+// Private dirty memory is read from /proc/<pid>/smaps_rollup while the
+// process is stopped on its way out, which takes ptrace; setuid programs
+// would lose their privileges under it, so they only get timed. The setuid
+// helper (-s) has to be made setuid root by hand, e.g.
+//   sudo chown root: build/bench/bench-spawn-setuid
+//   sudo chmod u+s build/bench/bench-spawn-setuid
+// and gets skipped otherwise. The loader ignores LD_PRELOAD paths in setuid
+// programs, so this measures the library as loaded from ld.so.preload only
+// if it's installed there.
+//
+// usage: bench-spawn [-n RUNS] [-s SETUID PROGRAM] <gtkclipblock library> <program>...
+
+#define WARMUP_RUNS 20
+#define MEMORY_RUNS 5
+#define MAX_PROGRAMS 16
+#define MAX_ENV 4096
+
+extern char** environ;
+
+typedef struct {
+  char const* label;
+  bool preload;
+  char const* hook;
+  char const* hook_dlfcn;
+} setup_t;
+
+static setup_t const setups[] = {
+  { .label = "baseline" },
+  // What every process pays under ld.so.preload when nothing is enabled.
+  { .label = "hook=0", .preload = true },
+  { .label = "hook=1", .preload = true, .hook = "1" },
+  { .label = "hook=auto", .preload = true, .hook = "1", .hook_dlfcn = "auto" },
+};
+
+#define N_SETUPS (sizeof(setups) / sizeof(*setups))
+
+typedef struct {
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  double minflt;
+  // Negative if it couldn't be measured.
+  long private_dirty_kb;
+} result_t;
+
+static char* envp[MAX_ENV];
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int compare_u64(void const* a, void const* b) {
+  auto lhs = *(uint64_t const*)a;
+  auto rhs = *(uint64_t const*)b;
+  return lhs < rhs ? -1 : lhs > rhs;
+}
+
+static int compare_long(void const* a, void const* b) {
+  auto lhs = *(long const*)a;
+  auto rhs = *(long const*)b;
+  return lhs < rhs ? -1 : lhs > rhs;
+}
+
+static void set_environment(setup_t const* setup, char const* library) {
+  static char preload[PATH_MAX + 16];
+  static char hook[64];
+  static char hook_dlfcn[64];
+
+  size_t n = 0;
+  for (auto var = environ; *var != nullptr && n < MAX_ENV - 4; var++) {
+    if (strncmp(*var, "LD_PRELOAD=", 11) != 0 && strncmp(*var, "GTKCLIPBLOCK_", 13) != 0) {
+      envp[n++] = *var;
+    }
+  }
+
+  if (setup->preload) {
+    snprintf(preload, sizeof(preload), "LD_PRELOAD=%s", library);
+    envp[n++] = preload;
+  }
+  if (setup->hook != nullptr) {
+    snprintf(hook, sizeof(hook), "GTKCLIPBLOCK_HOOK=%s", setup->hook);
+    envp[n++] = hook;
+  }
+  if (setup->hook_dlfcn != nullptr) {
+    snprintf(hook_dlfcn, sizeof(hook_dlfcn), "GTKCLIPBLOCK_HOOK_DLFCN=%s", setup->hook_dlfcn);
+    envp[n++] = hook_dlfcn;
+  }
+  envp[n] = nullptr;
+}
+
+static bool spawn(char* program, uint64_t* latency, long* minflt) {
+  char* argv[] = { program, nullptr };
+
+  auto start = now_ns();
+  pid_t pid;
+  if (posix_spawn(&pid, program, nullptr, nullptr, argv, envp) != 0) {
+    return false;
+  }
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid) {
+    return false;
+  }
+  *latency = now_ns() - start;
+  *minflt = usage.ru_minflt;
+
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static long read_private_dirty(pid_t pid) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", (int)pid);
+
+  auto file = fopen(path, "r");
+  if (file == nullptr) {
+    return -1;
+  }
+
+  long total = -1;
+  char line[256];
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    long kb;
+    if (sscanf(line, "Private_Dirty: %ld kB", &kb) == 1) {
+      total = kb;
+      break;
+    }
+  }
+
+  fclose(file);
+  return total;
+}
+
+// Runs the program under ptrace, to look at its memory once it's done.
+static long measure_private_dirty(char* program) {
+  char* argv[] = { program, nullptr };
+
+  auto pid = fork();
+  if (pid < 0) {
+    return -1;
+  }
+  if (pid == 0) {
+    ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+    raise(SIGSTOP);
+    execve(program, argv, envp);
+    _exit(127);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) != pid || !WIFSTOPPED(status)) {
+    return -1;
+  }
+  ptrace(PTRACE_SETOPTIONS, pid, nullptr, (void*)(PTRACE_O_TRACEEXIT | PTRACE_O_EXITKILL));
+  ptrace(PTRACE_CONT, pid, nullptr, nullptr);
+
+  long private_dirty = -1;
+  while (waitpid(pid, &status, 0) == pid && WIFSTOPPED(status)) {
+    auto signal = WSTOPSIG(status);
+    if (status >> 8 == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))) {
+      private_dirty = read_private_dirty(pid);
+      signal = 0;
+    } else if (signal == SIGTRAP || signal == SIGSTOP) {
+      // From exec, and our own stop.
+      signal = 0;
+    }
+    ptrace(PTRACE_CONT, pid, nullptr, (void*)(intptr_t)signal);
+  }
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    return -1;
+  }
+  return private_dirty;
+}
+
+static bool run(char* program, size_t runs, bool setuid, result_t* result) {
+  uint64_t latency;
+  long minflt;
+  for (size_t i = 0; i < WARMUP_RUNS; i++) {
+    if (!spawn(program, &latency, &minflt)) {
+      return false;
+    }
+  }
+
+  auto latencies = (uint64_t*)calloc(runs, sizeof(uint64_t));
+  if (latencies == nullptr) {
+    perror("bench-spawn");
+    exit(1);
+  }
+
+  double minflt_sum = 0;
+  for (size_t i = 0; i < runs; i++) {
+    if (!spawn(program, &latencies[i], &minflt)) {
+      free(latencies);
+      return false;
+    }
+    minflt_sum += minflt;
+  }
+
+  qsort(latencies, runs, sizeof(*latencies), compare_u64);
+  *result = (result_t){
+    .p50 = latencies[runs / 2],
+    .p90 = latencies[runs * 90 / 100],
+    .p99 = latencies[runs * 99 / 100],
+    .minflt = minflt_sum / runs,
+    .private_dirty_kb = -1,
+  };
+  free(latencies);
+
+  if (!setuid) {
+    long private_dirty[MEMORY_RUNS];
+    for (size_t i = 0; i < MEMORY_RUNS; i++) {
+      private_dirty[i] = measure_private_dirty(program);
+      if (private_dirty[i] < 0) {
+        return true;
+      }
+    }
+    qsort(private_dirty, MEMORY_RUNS, sizeof(*private_dirty), compare_long);
+    result->private_dirty_kb = private_dirty[MEMORY_RUNS / 2];
+  }
+
+  return true;
+}
+
+static bool is_setuid_root(char const* program) {
+  struct stat st;
+  return stat(program, &st) == 0 && (st.st_mode & S_ISUID) != 0 && st.st_uid == 0;
+}
+
+static void usage(FILE* stream, char const* progname) {
+  fprintf(
+    stream,
+    "usage: %s [-n RUNS] [-s SETUID PROGRAM] <gtkclipblock library> <program>...\n",
+    progname
+  );
+}
+
+int main(int argc, char** argv) {
+  size_t runs = 500;
+  char* programs[MAX_PROGRAMS];
+  bool setuid[MAX_PROGRAMS] = {};
+  size_t n_programs = 0;
+
+  int argi = 1;
+  for (; argi < argc && argv[argi][0] == '-'; argi++) {
+    if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc) {
+      runs = strtoul(argv[++argi], nullptr, 10);
+    } else if (strcmp(argv[argi], "-s") == 0 && argi + 1 < argc) {
+      auto program = argv[++argi];
+      if (!is_setuid_root(program)) {
+        fprintf(stderr, "bench-spawn: %s isn't setuid root, skipping it\n", program);
+      } else if (n_programs < MAX_PROGRAMS) {
+        setuid[n_programs] = true;
+        programs[n_programs++] = program;
+      }
+    } else {
+      usage(stderr, argv[0]);
+      return 2;
+    }
+  }
+
+  if (argc - argi < 2 || runs == 0) {
+    usage(stderr, argv[0]);
+    return 2;
+  }
+
+  auto library = argv[argi++];
+  for (; argi < argc && n_programs < MAX_PROGRAMS; argi++) {
+    programs[n_programs++] = argv[argi];
+  }
+
+  printf(
+    "%-24s %-10s %10s %10s %10s %8s %11s\n",
+    "program", "settings", "p50 (us)", "p90 (us)", "p99 (us)", "minflt", "dirty (kB)"
+  );
+
+  for (size_t i = 0; i < n_programs; i++) {
+    auto name = strrchr(programs[i], '/');
+    name = name != nullptr ? name + 1 : programs[i];
+
+    for (size_t j = 0; j < N_SETUPS; j++) {
+      set_environment(&setups[j], library);
+
+      result_t result;
+      if (!run(programs[i], runs, setuid[i], &result)) {
+        fprintf(stderr, "bench-spawn: %s failed (%s)\n", programs[i], setups[j].label);
+        return 1;
+      }
+
+      char dirty[16] = "-";
+      if (result.private_dirty_kb >= 0) {
+        snprintf(dirty, sizeof(dirty), "%ld", result.private_dirty_kb);
+      }
+
+      printf(
+        "%-24s %-10s %10.1f %10.1f %10.1f %8.1f %11s\n",
+        name,
+        setups[j].label,
+        result.p50 / 1e3,
+        result.p90 / 1e3,
+        result.p99 / 1e3,
+        result.minflt,
+        dirty
+      );
+      fflush(stdout);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,4 @@
+// Empty DSO for bench-dlfcn; DUMMY_ID keeps the builds distinct.
+int bench_dummy_id() {
+  return DUMMY_ID;
+}
@@ -0,0 +1,7 @@
+// A program linked against the GTK 3 stand-in, for bench-spawn: the library's
+// constructor finds GTK in the initial link map and hooks it.
+void* gdk_display_get_default();
+
+int main() {
+  return gdk_display_get_default() == nullptr;
+}
@@ -0,0 +1,5 @@
+// The smallest possible C program, for bench-spawn. Also built as the
+// setuid helper, which has to be made setuid root by hand.
+int main() {
+  return 0;
+}
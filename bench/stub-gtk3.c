@@ -0,0 +1,179 @@
+#include <glib-object.h>
+
+// Stand-in for libgtk-x11-2.0.so.0/libgtk-3.so.0: just enough of the
+// GtkClipboard API for the hooks to install and run, without a display
+// server. Clipboards are plain GObjects.
+
+#define STUB_SELECTION_PRIMARY ((gpointer)GINT_TO_POINTER(1))
+#define STUB_SELECTION_CLIPBOARD ((gpointer)GINT_TO_POINTER(69))
+
+// Incremented by every clipboard function, so that the benchmark can tell
+// whether a call made it through the hooks. Also keeps the functions large
+// enough to be patched.
+volatile guint64 stub_calls = 0;
+
+static GObject* stub_display = nullptr;
+static GObject* stub_primary_clipboard = nullptr;
+static GObject* stub_clipboard = nullptr;
+
+__attribute__((constructor))
+static void stub_init() {
+  stub_display = g_object_new(G_TYPE_OBJECT, nullptr);
+  stub_primary_clipboard = g_object_new(G_TYPE_OBJECT, nullptr);
+  stub_clipboard = g_object_new(G_TYPE_OBJECT, nullptr);
+}
+
+GObject* gdk_display_get_default() {
+  return stub_display;
+}
+
+GObject* gtk_clipboard_get_display(GObject* clipboard) {
+  return stub_display;
+}
+
+GObject* gtk_clipboard_get_for_display(GObject* display, gpointer selection) {
+  return selection == STUB_SELECTION_PRIMARY
+    ? stub_primary_clipboard
+    : stub_clipboard;
+}
+
+gpointer gtk_clipboard_get_selection(GObject* clipboard) {
+  return clipboard == stub_primary_clipboard
+    ? STUB_SELECTION_PRIMARY
+    : STUB_SELECTION_CLIPBOARD;
+}
+
+gboolean gtk_clipboard_set_with_data(
+  GObject* clipboard,
+  gconstpointer targets,
+  guint n_targets,
+  gpointer get_func,
+  gpointer clear_func,
+  gpointer user_data
+) {
+  stub_calls += n_targets;
+  return true;
+}
+
+gboolean gtk_clipboard_set_with_owner(
+  GObject* clipboard,
+  gconstpointer targets,
+  guint n_targets,
+  gpointer get_func,
+  gpointer clear_func,
+  GObject* owner
+) {
+  stub_calls += n_targets;
+  return true;
+}
+
+void gtk_clipboard_set_text(GObject* clipboard, char const* text, gint len) {
+  stub_calls += len;
+}
+
+void gtk_clipboard_set_image(GObject* clipboard, GObject* pixbuf) {
+  stub_calls += pixbuf != nullptr;
+}
+
+void gtk_clipboard_set_can_store(GObject* clipboard, gconstpointer targets, gint n_targets) {
+  stub_calls += n_targets;
+}
+
+void gtk_clipboard_store(GObject* clipboard) {
+  stub_calls += clipboard != nullptr;
+}
+
+void gtk_clipboard_request_contents(
+  GObject* clipboard,
+  gpointer target,
+  void (*callback)(GObject*, gpointer, gpointer),
+  gpointer user_data
+) {
+  stub_calls += target != nullptr;
+  callback(clipboard, nullptr, user_data);
+}
+
+gpointer gdk_atom_intern(char const* name, gboolean only_if_exists) {
+  return GUINT_TO_POINTER(g_quark_from_string(name));
+}
+
+// Like GTK's wait functions: make the request, then run a main loop until the
+// callback quits it, unless it already did.
+static void stub_wait_received(GObject* clipboard, gpointer selection_data, gpointer user_data) {
+  g_main_loop_quit(user_data);
+}
+
+static void stub_wait(GObject* clipboard, gpointer target) {
+  auto loop = g_main_loop_new(nullptr, true);
+  gtk_clipboard_request_contents(clipboard, target, stub_wait_received, loop);
+  if (g_main_loop_is_running(loop)) {
+    g_main_loop_run(loop);
+  }
+  g_main_loop_unref(loop);
+}
+
+gpointer gtk_clipboard_wait_for_contents(GObject* clipboard, gpointer target) {
+  stub_calls += target != nullptr;
+  stub_wait(clipboard, target);
+  return nullptr;
+}
+
+char* gtk_clipboard_wait_for_text(GObject* clipboard) {
+  stub_calls += clipboard != nullptr;
+  stub_wait(clipboard, gdk_atom_intern("UTF8_STRING", false));
+  return nullptr;
+}
+
+GObject* gtk_clipboard_wait_for_image(GObject* clipboard) {
+  stub_calls += clipboard != nullptr;
+  stub_wait(clipboard, gdk_atom_intern("image/png", false));
+  return nullptr;
+}
+
+gboolean gtk_clipboard_wait_for_targets(GObject* clipboard, gpointer** targets, gint* n_targets) {
+  stub_calls += clipboard != nullptr;
+  stub_wait(clipboard, gdk_atom_intern("TARGETS", false));
+  *targets = nullptr;
+  *n_targets = 0;
+  return false;
+}
+
+gboolean gtk_clipboard_wait_is_text_available(GObject* clipboard) {
+  stub_calls += clipboard != nullptr;
+  stub_wait(clipboard, gdk_atom_intern("TARGETS", false));
+  return false;
+}
+
+// Helpers the hooks resolve. The benchmark never sets anything up for them to
+// do.
+gint gtk_selection_data_get_length(gconstpointer selection_data) {
+  return -1;
+}
+
+gpointer gtk_selection_data_get_data_type(gconstpointer selection_data) {
+  return nullptr;
+}
+
+void gtk_selection_data_set(
+  gpointer selection_data,
+  gpointer type,
+  gint format,
+  guchar const* data,
+  gint length
+) {}
+
+gboolean gtk_selection_data_set_text(gpointer selection_data, char const* text, gint len) {
+  return false;
+}
+
+gboolean gtk_selection_data_set_pixbuf(gpointer selection_data, GObject* pixbuf) {
+  return false;
+}
+
+int gdk_pixbuf_get_rowstride(GObject const* pixbuf) {
+  return 0;
+}
+
+int gdk_pixbuf_get_height(GObject const* pixbuf) {
+  return 0;
+}
@@ -0,0 +1,146 @@
+#include <gio/gio.h>
+
+// Stand-in for libgtk-4.so.1: just enough of the GdkClipboard API for the
+// hooks to install and run, without a display server. Displays and
+// clipboards are plain GObjects.
+
+// Incremented by every clipboard function, so that the benchmark can tell
+// whether a call made it through the hooks. Also keeps the functions large
+// enough to be patched.
+volatile guint64 stub_calls = 0;
+
+static GObject* stub_display = nullptr;
+static GObject* stub_primary_clipboard = nullptr;
+static GObject* stub_clipboard = nullptr;
+
+__attribute__((constructor))
+static void stub_init() {
+  stub_display = g_object_new(G_TYPE_OBJECT, nullptr);
+  stub_primary_clipboard = g_object_new(G_TYPE_OBJECT, nullptr);
+  stub_clipboard = g_object_new(G_TYPE_OBJECT, nullptr);
+}
+
+GObject* gdk_display_get_default() {
+  return stub_display;
+}
+
+GObject* gdk_display_get_clipboard(GObject* display) {
+  return stub_clipboard;
+}
+
+GObject* gdk_display_get_primary_clipboard(GObject* display) {
+  return stub_primary_clipboard;
+}
+
+GObject* gdk_clipboard_get_display(GObject* clipboard) {
+  return stub_display;
+}
+
+void gdk_clipboard_set_text(GObject* clipboard, char const* text) {
+  stub_calls += text != nullptr;
+}
+
+void gdk_clipboard_set_texture(GObject* clipboard, GObject* texture) {
+  stub_calls += texture != nullptr;
+}
+
+void gdk_clipboard_set_value(GObject* clipboard, GValue const* value) {
+  stub_calls += value != nullptr;
+}
+
+gboolean gdk_clipboard_set_content(GObject* clipboard, GObject* provider) {
+  stub_calls += provider != nullptr;
+  return true;
+}
+
+// Helpers the hooks resolve. The benchmark never sets anything up for them to
+// do, but the types have to be real: limited providers derive from
+// GdkContentProvider at runtime.
+typedef struct {
+  GObject parent_instance;
+} GdkContentProvider;
+
+typedef struct {
+  GObjectClass parent_class;
+  // content_changed() up to get_value(), then padding, as in GTK.
+  gpointer vfuncs[16];
+} GdkContentProviderClass;
+
+G_DEFINE_TYPE(GdkContentProvider, gdk_content_provider, G_TYPE_OBJECT)
+
+static void gdk_content_provider_class_init(GdkContentProviderClass* class) {
+  g_signal_new(
+    "content-changed",
+    G_TYPE_FROM_CLASS(class),
+    G_SIGNAL_RUN_LAST,
+    G_STRUCT_OFFSET(GdkContentProviderClass, vfuncs),
+    nullptr,
+    nullptr,
+    nullptr,
+    G_TYPE_NONE,
+    0
+  );
+}
+
+static void gdk_content_provider_init(GdkContentProvider* provider) {}
+
+gpointer gdk_content_provider_ref_formats(GdkContentProvider* provider) {
+  return nullptr;
+}
+
+gpointer gdk_content_provider_ref_storable_formats(GdkContentProvider* provider) {
+  return nullptr;
+}
+
+void gdk_content_provider_content_changed(GdkContentProvider* provider) {
+  g_signal_emit_by_name(provider, "content-changed");
+}
+
+void gdk_content_provider_write_mime_type_async(
+  GdkContentProvider* provider,
+  char const* mime_type,
+  GOutputStream* stream,
+  int io_priority,
+  GCancellable* cancellable,
+  GAsyncReadyCallback callback,
+  gpointer user_data
+) {
+  auto task = g_task_new(provider, cancellable, callback, user_data);
+  g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not supported by the stub");
+  g_object_unref(task);
+}
+
+gboolean gdk_content_provider_write_mime_type_finish(
+  GdkContentProvider* provider,
+  GAsyncResult* result,
+  GError** error
+) {
+  return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+gboolean gdk_content_provider_get_value(GdkContentProvider* provider, GValue* value, GError** error) {
+  g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "Not supported by the stub");
+  return false;
+}
+
+typedef struct {
+  GObject parent_instance;
+} GdkTexture;
+
+typedef struct {
+  GObjectClass parent_class;
+} GdkTextureClass;
+
+G_DEFINE_TYPE(GdkTexture, gdk_texture, G_TYPE_OBJECT)
+
+static void gdk_texture_class_init(GdkTextureClass* class) {}
+
+static void gdk_texture_init(GdkTexture* texture) {}
+
+int gdk_texture_get_width(GdkTexture* texture) {
+  return 0;
+}
+
+int gdk_texture_get_height(GdkTexture* texture) {
+  return 0;
+}
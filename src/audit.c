@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <link.h>
+#include "settings.h"
+#include "policy.h"
+#include "config.h"
+#include "stats.h"
+#include "primary.h"
+#include "elfsym.h"
+
+#if defined(HOOK_GTK2)
+#include "gtk2.h"
+#endif
+
+#if defined(HOOK_GTK3)
+#include "gtk3.h"
+#endif
+
+#if defined(HOOK_GTK4)
+#include "gtk4.h"
+#endif
+
+// rtld-audit(7) flavor of the library, meant to be loaded with LD_AUDIT.
+//
+// Instead of inline-patching libc's dlopen/dlclose, we let the dynamic linker
+// tell us about every object it maps. Only objects matching one of the GTK
+// sonames get hooked; everything else costs a string comparison.
+//
+// NOTE: the auditor lives in its own link-map namespace. glibc handles are
+// link_map pointers, so dlsym() on the map we get from la_objopen resolves
+// symbols in the application's namespace.
+
+// The loader serializes its audit callbacks, so none of this needs to be
+// atomic.
+typedef enum {
+  LIBRARY_UNLOADED,
+  // Mapped, waiting for the link map to be consistent.
+  LIBRARY_PENDING,
+  LIBRARY_HOOKED,
+  // Installing the hooks failed; there's nothing to uninstall.
+  LIBRARY_FAILED,
+} library_state_t;
+
+typedef struct {
+  char const* const name;
+  struct link_map* map;
+  library_state_t state;
+  bool disabled;
+} library_t;
+
+static library_t library_gtk2 = {
+  .name = "libgtk-x11-2.0.so.0",
+};
+
+static library_t library_gtk3 = {
+  .name = "libgtk-3.so.0",
+};
+
+static library_t library_gtk4 = {
+  .name = "libgtk-4.so.1",
+};
+
+static settings_t settings = {};
+
+// Whether the process is past its initial load (TLS is unusable before that).
+static bool started = false;
+
+// Objects from the initial load don't have their own search list; symbols
+// from GTK's dependencies get resolved through the main program's scope
+// instead (like RTLD_DEFAULT). GTK's own are looked up in its symbol table.
+static struct link_map* main_map = nullptr;
+
+static bool library_matches(library_t const* library, struct link_map const* map) {
+  if (library->disabled || map->l_name == nullptr) {
+    return false;
+  }
+
+  char const* filename = strrchr(map->l_name, '/');
+  filename = filename != nullptr ? filename + 1 : map->l_name;
+  if (strcmp(filename, library->name) == 0) {
+    return true;
+  }
+
+  // The path may not be the soname, e.g. when the application loads GTK by
+  // its unversioned name or from a symlink.
+  auto soname = elfsym_soname(map);
+  return soname != nullptr && strcmp(soname, library->name) == 0;
+}
+
+unsigned int la_version(unsigned int version) {
+  config_cache_t config;
+  config_load(&config);
+  settings = config.settings;
+  library_gtk2.disabled = settings.gtk2_disabled;
+  library_gtk3.disabled = settings.gtk3_disabled;
+  library_gtk4.disabled = settings.gtk4_disabled;
+
+  // argv isn't available to auditors; argv0 rules never match here.
+  bool any_enabled =
+    !library_gtk2.disabled || !library_gtk3.disabled || !library_gtk4.disabled;
+  if (
+    any_enabled
+    && policy_evaluate_self(&config.policy, nullptr) == POLICY_ACTION_DENY
+  ) {
+    library_gtk2.disabled = true;
+    library_gtk3.disabled = true;
+    library_gtk4.disabled = true;
+  }
+  config_cache_close(&config);
+
+  if (!library_gtk2.disabled || !library_gtk3.disabled || !library_gtk4.disabled) {
+    stats_set_enabled(settings.stats);
+    primary_set_mode(settings.primary, settings.primary_param);
+  }
+
+  return version < LAV_CURRENT ? version : LAV_CURRENT;
+}
+
+unsigned int la_objopen(struct link_map* map, Lmid_t lmid, uintptr_t*) {
+  if (lmid != LM_ID_BASE) {
+    return 0;
+  }
+
+  if (main_map == nullptr) {
+    main_map = map;
+  }
+
+  // The object isn't fully set up yet (its dependencies might still be
+  // missing), so the hooks get installed once the link map is consistent.
+
+  if (library_gtk2.map == nullptr && library_matches(&library_gtk2, map)) {
+    library_gtk2.map = map;
+    library_gtk2.state = LIBRARY_PENDING;
+  }
+
+  if (library_gtk3.map == nullptr && library_matches(&library_gtk3, map)) {
+    library_gtk3.map = map;
+    library_gtk3.state = LIBRARY_PENDING;
+  }
+
+  if (library_gtk4.map == nullptr && library_matches(&library_gtk4, map)) {
+    library_gtk4.map = map;
+    library_gtk4.state = LIBRARY_PENDING;
+  }
+
+  // We don't want la_symbind/la_pltenter callbacks.
+  return 0;
+}
+
+static void install_pending_hooks(bool initial) {
+  if (library_gtk2.state == LIBRARY_PENDING) {
+    bool installed = false;
+#if defined(HOOK_GTK2)
+    installed = hook_gtk2_install_hooks(initial ? main_map : library_gtk2.map, library_gtk2.map);
+#endif
+    library_gtk2.state = installed ? LIBRARY_HOOKED : LIBRARY_FAILED;
+  }
+
+  if (library_gtk3.state == LIBRARY_PENDING) {
+    bool installed = false;
+#if defined(HOOK_GTK3)
+    installed = hook_gtk3_install_hooks(initial ? main_map : library_gtk3.map, library_gtk3.map);
+#endif
+    library_gtk3.state = installed ? LIBRARY_HOOKED : LIBRARY_FAILED;
+  }
+
+  if (library_gtk4.state == LIBRARY_PENDING) {
+    bool installed = false;
+#if defined(HOOK_GTK4)
+    installed = hook_gtk4_install_hooks(initial ? main_map : library_gtk4.map, library_gtk4.map);
+#endif
+    library_gtk4.state = installed ? LIBRARY_HOOKED : LIBRARY_FAILED;
+  }
+}
+
+void la_activity(uintptr_t*, unsigned int flag) {
+  // During the initial load, the link map becomes consistent before TLS is
+  // set up; the hooks get installed from la_preinit instead.
+  if (flag != LA_ACT_CONSISTENT || !started) {
+    return;
+  }
+
+  install_pending_hooks(false);
+}
+
+void la_preinit(uintptr_t*) {
+  started = true;
+  install_pending_hooks(true);
+}
+
+unsigned int la_objclose(uintptr_t* cookie) {
+  // la_objopen leaves the cookie pointing to the link map
+  auto map = (struct link_map*)*cookie;
+
+  if (map == library_gtk2.map) {
+#if defined(HOOK_GTK2)
+    if (library_gtk2.state == LIBRARY_HOOKED) {
+      hook_gtk2_uninstall_hooks();
+    }
+#endif
+    library_gtk2.map = nullptr;
+    library_gtk2.state = LIBRARY_UNLOADED;
+  }
+
+  if (map == library_gtk3.map) {
+#if defined(HOOK_GTK3)
+    if (library_gtk3.state == LIBRARY_HOOKED) {
+      hook_gtk3_uninstall_hooks();
+    }
+#endif
+    library_gtk3.map = nullptr;
+    library_gtk3.state = LIBRARY_UNLOADED;
+  }
+
+  if (map == library_gtk4.map) {
+#if defined(HOOK_GTK4)
+    if (library_gtk4.state == LIBRARY_HOOKED) {
+      hook_gtk4_uninstall_hooks();
+    }
+#endif
+    library_gtk4.map = nullptr;
+    library_gtk4.state = LIBRARY_UNLOADED;
+  }
+
+  return 0;
+}
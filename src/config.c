@@ -0,0 +1,232 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+
+uint64_t config_checksum(void const* data, size_t size) {
+  auto bytes = (unsigned char const*)data;
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static bool source_is_current(config_source_t const* source) {
+  if (!source->used) {
+    return true;
+  }
+
+  if (memchr(source->path, '\0', sizeof(source->path)) == nullptr) {
+    return false;
+  }
+
+  struct stat st;
+  if (stat(source->path, &st) != 0) {
+    return !source->present;
+  }
+
+  return source->present
+    && st.st_dev == source->dev
+    && st.st_ino == source->ino
+    && (uint64_t)st.st_size == source->size
+    && st.st_mtim.tv_sec == source->mtime_sec
+    && st.st_mtim.tv_nsec == source->mtime_nsec;
+}
+
+static bool rules_are_valid(
+  config_header_t const* header,
+  uint32_t offset,
+  uint32_t count
+) {
+  if (
+    offset % _Alignof(policy_rule_t) != 0
+    || offset > header->size
+    || count > (header->size - offset) / sizeof(policy_rule_t)
+  ) {
+    return false;
+  }
+
+  auto rules = (policy_rule_t const*)((char const*)header + offset);
+  for (uint32_t i = 0; i < count; i++) {
+    if (
+      rules[i].pattern >= header->strings_size
+      || rules[i].field > POLICY_FIELD_COMM
+      || rules[i].action > POLICY_ACTION_DENY
+    ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool cache_is_valid(void const* data, size_t size) {
+  auto header = (config_header_t const*)data;
+
+  if (
+    size < sizeof(config_header_t)
+    || header->magic != CONFIG_MAGIC
+    || header->version != CONFIG_VERSION
+    || header->size != size
+  ) {
+    return false;
+  }
+
+  size_t checksummed = offsetof(config_header_t, checksum) + sizeof(header->checksum);
+  if (config_checksum((char const*)data + checksummed, size - checksummed) != header->checksum) {
+    return false;
+  }
+
+  if (
+    header->strings_size == 0
+    || header->strings_offset > size
+    || header->strings_size > size - header->strings_offset
+    || ((char const*)data)[header->strings_offset + header->strings_size - 1] != '\0'
+  ) {
+    return false;
+  }
+
+  // Enums are cast as-is, so anything out of range means a cache from some
+  // other build.
+  if (header->primary > PRIMARY_LOCAL || header->policy_default_action > POLICY_ACTION_DENY) {
+    return false;
+  }
+
+  if (
+    !rules_are_valid(header, header->literals_offset, header->n_literals)
+    || !rules_are_valid(header, header->globs_offset, header->n_globs)
+  ) {
+    return false;
+  }
+
+  for (size_t i = 0; i < CONFIG_MAX_SOURCES; i++) {
+    if (!source_is_current(&header->sources[i])) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool open_cache(char const* path, bool system, config_cache_t* cache) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // Don't trust a cache that someone else could have tampered with.
+  struct stat st;
+  bool trusted = fstat(fd, &st) == 0
+    && S_ISREG(st.st_mode)
+    && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0
+    && st.st_uid == (system ? 0 : geteuid())
+    && st.st_size >= (off_t)sizeof(config_header_t);
+
+  void* mapping = MAP_FAILED;
+  if (trusted) {
+    mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  if (!cache_is_valid(mapping, st.st_size)) {
+    munmap(mapping, st.st_size);
+    return false;
+  }
+
+  auto header = (config_header_t const*)mapping;
+  auto base = (char const*)mapping;
+
+  cache->mapping = mapping;
+  cache->size = st.st_size;
+  cache->settings = (settings_t){
+    .gtk2_disabled = header->gtk2_disabled != 0,
+    .gtk3_disabled = header->gtk3_disabled != 0,
+    .gtk4_disabled = header->gtk4_disabled != 0,
+    .hook_dlfcn_disabled = header->hook_dlfcn_disabled != 0,
+    .hook_dlfcn_auto = header->hook_dlfcn_auto != 0,
+    .pin = header->pin != 0,
+    .interpose = header->interpose != 0,
+    .stats = header->stats != 0,
+    .primary = (primary_mode_t)header->primary,
+    .primary_param = header->primary_param,
+  };
+  cache->policy = (policy_table_t){
+    .literals = (policy_rule_t const*)(base + header->literals_offset),
+    .n_literals = header->n_literals,
+    .globs = (policy_rule_t const*)(base + header->globs_offset),
+    .n_globs = header->n_globs,
+    .strings = base + header->strings_offset,
+    .fields = header->policy_fields,
+    .default_action = header->policy_default_action,
+  };
+  return true;
+}
+
+static bool append(char* buf, size_t* len, size_t size, char const* str) {
+  auto n = strlen(str);
+  if (*len + n >= size) {
+    return false;
+  }
+  memcpy(buf + *len, str, n + 1);
+  *len += n;
+  return true;
+}
+
+static bool user_cache_path(char* buf, size_t size) {
+  size_t len = 0;
+  auto cache_home = getenv("XDG_CACHE_HOME");
+  if (cache_home != nullptr && cache_home[0] == '/') {
+    return append(buf, &len, size, cache_home)
+      && append(buf, &len, size, "/" GTKCLIPBLOCK_CACHE_NAME);
+  }
+
+  auto home = getenv("HOME");
+  if (home == nullptr || home[0] != '/') {
+    return false;
+  }
+
+  return append(buf, &len, size, home)
+    && append(buf, &len, size, "/.cache/" GTKCLIPBLOCK_CACHE_NAME);
+}
+
+bool config_cache_open(config_cache_t* cache) {
+  *cache = (config_cache_t){};
+
+  // The user's cache is ignored in setuid/setgid processes.
+  if (getauxval(AT_SECURE) == 0) {
+    char path[PATH_MAX];
+    if (user_cache_path(path, sizeof(path)) && open_cache(path, false, cache)) {
+      return true;
+    }
+  }
+
+  return open_cache(GTKCLIPBLOCK_SYSTEM_CACHE_PATH, true, cache);
+}
+
+void config_load(config_cache_t* cache) {
+  if (config_cache_open(cache)) {
+    return;
+  }
+
+  load_settings(&cache->settings);
+  cache->policy = policy_builtin_table;
+}
+
+void config_cache_close(config_cache_t* cache) {
+  if (cache->mapping != nullptr) {
+    munmap(cache->mapping, cache->size);
+  }
+  *cache = (config_cache_t){};
+}
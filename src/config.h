@@ -0,0 +1,75 @@
+#ifndef GTKCLIPBLOCK_CONFIG_H
+#define GTKCLIPBLOCK_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "settings.h"
+#include "policy.h"
+
+// Binary configuration cache, produced by gtkclipblock-compile from
+// gtkclipblock.conf and mapped read-only by the library.
+//
+// Layout: config_header_t, followed by the literal and glob policy rules
+// (policy_rule_t, 8-byte aligned) and the policy string pool. The checksum
+// covers everything past the checksum field. The cache is only valid for the
+// machine (and build) it was compiled on.
+
+#define CONFIG_MAGIC 0x4b424347u
+#define CONFIG_VERSION 4
+#define CONFIG_MAX_SOURCES 2
+#define CONFIG_SOURCE_PATH_MAX 256
+
+typedef struct {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_sec;
+  int64_t mtime_nsec;
+  uint8_t used;
+  uint8_t present;
+  uint8_t reserved[6];
+  char path[CONFIG_SOURCE_PATH_MAX];
+} config_source_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;
+  uint64_t checksum;
+  config_source_t sources[CONFIG_MAX_SOURCES];
+  uint8_t gtk2_disabled;
+  uint8_t gtk3_disabled;
+  uint8_t gtk4_disabled;
+  uint8_t hook_dlfcn_disabled;
+  uint8_t hook_dlfcn_auto;
+  uint8_t policy_fields;
+  uint8_t policy_default_action;
+  uint8_t pin;
+  uint8_t interpose;
+  uint8_t stats;
+  uint8_t primary;
+  uint8_t reserved[1];
+  uint32_t primary_param;
+  uint32_t n_literals;
+  uint32_t literals_offset;
+  uint32_t n_globs;
+  uint32_t globs_offset;
+  uint32_t strings_offset;
+  uint32_t strings_size;
+} config_header_t;
+
+typedef struct {
+  void* mapping;
+  size_t size;
+  settings_t settings;
+  policy_table_t policy;
+} config_cache_t;
+
+uint64_t config_checksum(void const* data, size_t size);
+bool config_cache_open(config_cache_t* cache);
+// Falls back to the environment and the built-in policy if there's no
+// usable cache.
+void config_load(config_cache_t* cache);
+void config_cache_close(config_cache_t* cache);
+
+#endif
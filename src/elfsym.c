@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <string.h>
+#include "elfsym.h"
+
+#define BLOOM_WORD_BITS (sizeof(ElfW(Addr)) * 8)
+
+// Not in every libc's <elf.h>.
+#define VERSYM_HIDDEN 0x8000
+#define VERSYM_VERSION 0x7fff
+
+static uint32_t gnu_hash(char const* name) {
+  uint32_t h = 5381;
+  for (auto c = (unsigned char const*)name; *c != '\0'; c++) {
+    h = h * 33 + *c;
+  }
+  return h;
+}
+
+static ElfW(Addr) dynamic_ptr(struct link_map const* map, ElfW(Addr) ptr) {
+  // glibc relocates the dynamic section in place on most architectures, but
+  // not all of them do.
+  return ptr < map->l_addr ? ptr + map->l_addr : ptr;
+}
+
+bool elfsym_table_init(elfsym_table_t* table, struct link_map const* map) {
+  *table = (elfsym_table_t){
+    .base = map->l_addr,
+  };
+
+  if (map->l_ld == nullptr) {
+    return false;
+  }
+
+  for (auto dyn = (ElfW(Dyn) const*)map->l_ld; dyn->d_tag != DT_NULL; dyn++) {
+    switch (dyn->d_tag) {
+    case DT_SYMTAB:
+      table->symtab = (ElfW(Sym) const*)dynamic_ptr(map, dyn->d_un.d_ptr);
+      break;
+    case DT_STRTAB:
+      table->strtab = (char const*)dynamic_ptr(map, dyn->d_un.d_ptr);
+      break;
+    case DT_GNU_HASH:
+      table->gnu_hash = (uint32_t const*)dynamic_ptr(map, dyn->d_un.d_ptr);
+      break;
+    case DT_VERSYM:
+      table->versym = (ElfW(Half) const*)dynamic_ptr(map, dyn->d_un.d_ptr);
+      break;
+    case DT_VERDEF:
+      table->verdef = (ElfW(Verdef) const*)dynamic_ptr(map, dyn->d_un.d_ptr);
+      break;
+    }
+  }
+
+  return table->symtab != nullptr && table->strtab != nullptr && table->gnu_hash != nullptr;
+}
+
+char const* elfsym_soname(struct link_map const* map) {
+  if (map->l_ld == nullptr) {
+    return nullptr;
+  }
+
+  char const* strtab = nullptr;
+  ElfW(Dyn) const* soname = nullptr;
+  for (auto dyn = (ElfW(Dyn) const*)map->l_ld; dyn->d_tag != DT_NULL; dyn++) {
+    if (dyn->d_tag == DT_STRTAB) {
+      strtab = (char const*)dynamic_ptr(map, dyn->d_un.d_ptr);
+    } else if (dyn->d_tag == DT_SONAME) {
+      soname = dyn;
+    }
+  }
+
+  return strtab != nullptr && soname != nullptr ? strtab + soname->d_un.d_val : nullptr;
+}
+
+static bool is_default_version(elfsym_table_t const* table, uint32_t index) {
+  // Unversioned objects only have default versions.
+  if (table->versym == nullptr) {
+    return true;
+  }
+
+  auto versym = table->versym[index];
+
+  // foo@VERSION (as opposed to foo@@VERSION) is only there for binaries
+  // linked against an older release; dlsym() wouldn't return it either.
+  if (versym & VERSYM_HIDDEN) {
+    return false;
+  }
+
+  auto ndx = versym & VERSYM_VERSION;
+  if (ndx == VER_NDX_LOCAL) {
+    return false;
+  }
+
+  if (ndx == VER_NDX_GLOBAL) {
+    return true;
+  }
+
+  // The version has to be one this object defines.
+  for (auto verdef = table->verdef; verdef != nullptr; ) {
+    if (verdef->vd_ndx == ndx) {
+      return true;
+    }
+
+    if (verdef->vd_next == 0) {
+      break;
+    }
+    verdef = (ElfW(Verdef) const*)((char const*)verdef + verdef->vd_next);
+  }
+
+  return false;
+}
+
+static bool is_exported(ElfW(Sym) const* sym) {
+  if (sym->st_shndx == SHN_UNDEF || sym->st_value == 0) {
+    return false;
+  }
+
+  // The ELF64 accessors are the same as the ELF32 ones.
+  auto bind = ELF64_ST_BIND(sym->st_info);
+  if (bind != STB_GLOBAL && bind != STB_WEAK) {
+    return false;
+  }
+
+  // IFUNCs would have to be resolved first, and GTK doesn't have any.
+  auto type = ELF64_ST_TYPE(sym->st_info);
+  if (type != STT_FUNC && type != STT_OBJECT) {
+    return false;
+  }
+
+  auto visibility = ELF64_ST_VISIBILITY(sym->st_other);
+  return visibility == STV_DEFAULT || visibility == STV_PROTECTED;
+}
+
+ElfW(Sym) const* elfsym_table_find(elfsym_table_t const* table, char const* name) {
+  auto n_buckets = table->gnu_hash[0];
+  auto symoffset = table->gnu_hash[1];
+  auto bloom_size = table->gnu_hash[2];
+  auto bloom_shift = table->gnu_hash[3];
+  auto bloom = (ElfW(Addr) const*)&table->gnu_hash[4];
+  auto buckets = (uint32_t const*)&bloom[bloom_size];
+  auto chain = &buckets[n_buckets];
+
+  if (n_buckets == 0 || bloom_size == 0) {
+    return nullptr;
+  }
+
+  auto hash = gnu_hash(name);
+
+  // Most misses stop at the bloom filter.
+  auto word = bloom[(hash / BLOOM_WORD_BITS) % bloom_size];
+  ElfW(Addr) mask =
+    ((ElfW(Addr))1 << (hash % BLOOM_WORD_BITS))
+    | ((ElfW(Addr))1 << ((hash >> bloom_shift) % BLOOM_WORD_BITS));
+  if ((word & mask) != mask) {
+    return nullptr;
+  }
+
+  auto index = buckets[hash % n_buckets];
+  if (index < symoffset) {
+    return nullptr;
+  }
+
+  for (;; index++) {
+    auto chain_hash = chain[index - symoffset];
+    auto sym = &table->symtab[index];
+
+    if (
+      (chain_hash | 1) == (hash | 1)
+      && strcmp(name, table->strtab + sym->st_name) == 0
+      && is_exported(sym)
+      && is_default_version(table, index)
+    ) {
+      return sym;
+    }
+
+    // The low bit marks the end of the bucket's chain.
+    if (chain_hash & 1) {
+      return nullptr;
+    }
+  }
+}
+
+void* elfsym_table_lookup(elfsym_table_t const* table, char const* name) {
+  auto sym = elfsym_table_find(table, name);
+  return sym != nullptr ? (void*)(table->base + sym->st_value) : nullptr;
+}
+
+void elfsym_resolver_init(
+  elfsym_resolver_t* resolver,
+  void* dl_handle,
+  struct link_map const* map
+) {
+  *resolver = (elfsym_resolver_t){
+    .dl_handle = dl_handle,
+    .map = map,
+  };
+  resolver->has_table = map != nullptr && elfsym_table_init(&resolver->table, map);
+}
+
+static struct link_map const* object_of(void const* address) {
+  Dl_info info;
+  struct link_map const* map = nullptr;
+  if (dladdr1(address, &info, (void**)&map, RTLD_DL_LINKMAP) == 0) {
+    return nullptr;
+  }
+  return map;
+}
+
+void* elfsym_resolve_own(elfsym_resolver_t const* resolver, char const* name) {
+  if (resolver->has_table) {
+    return elfsym_table_lookup(&resolver->table, name);
+  }
+
+  // Objects without a GNU hash table are rare enough nowadays that they
+  // aren't worth a DT_HASH lookup of their own. dlsym() might find another
+  // object's definition though (with RTLD_DEFAULT, our own interposers), so
+  // it only counts if it's in the object we're after, or at least not in
+  // this library.
+  auto sym = dlsym(resolver->dl_handle, name);
+  if (sym == nullptr) {
+    return nullptr;
+  }
+
+  auto object = object_of(sym);
+  if (resolver->map != nullptr ? object != resolver->map : object == object_of(elfsym_resolve_own)) {
+    return nullptr;
+  }
+  return sym;
+}
+
+void* elfsym_resolve_dep(elfsym_resolver_t const* resolver, char const* name) {
+  return dlsym(resolver->dl_handle, name);
+}
@@ -0,0 +1,48 @@
+#ifndef GTKCLIPBLOCK_ELFSYM_H
+#define GTKCLIPBLOCK_ELFSYM_H
+
+#include <stdint.h>
+#include <link.h>
+
+// Looks symbols up directly in a loaded object's GNU hash table, rather than
+// through dlsym(), which searches the handle's whole dependency scope and can
+// return a same-named symbol from another library (or interposed by the
+// program).
+typedef struct {
+  ElfW(Addr) base;
+  ElfW(Sym) const* symtab;
+  char const* strtab;
+  uint32_t const* gnu_hash;
+  ElfW(Half) const* versym;
+  ElfW(Verdef) const* verdef;
+} elfsym_table_t;
+
+// Where a toolkit's symbols come from: the ones it defines itself are looked
+// up in its own table (if it has one), everything else (i.e. GLib) goes
+// through dlsym().
+typedef struct {
+  void* dl_handle;
+  struct link_map const* map;
+  elfsym_table_t table;
+  bool has_table;
+} elfsym_resolver_t;
+
+// Fails if the object has no DT_GNU_HASH (or no dynamic symbols at all).
+bool elfsym_table_init(elfsym_table_t* table, struct link_map const* map);
+
+// Only finds symbols the object itself defines, at their default version.
+ElfW(Sym) const* elfsym_table_find(elfsym_table_t const* table, char const* name);
+void* elfsym_table_lookup(elfsym_table_t const* table, char const* name);
+
+// The object's DT_SONAME, or null if it has none.
+char const* elfsym_soname(struct link_map const* map);
+
+void elfsym_resolver_init(
+  elfsym_resolver_t* resolver,
+  void* dl_handle,
+  struct link_map const* map
+);
+void* elfsym_resolve_own(elfsym_resolver_t const* resolver, char const* name);
+void* elfsym_resolve_dep(elfsym_resolver_t const* resolver, char const* name);
+
+#endif
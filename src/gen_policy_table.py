@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+# Compiles the policy-* build options into the built-in policy table (see
+# policy.h for the layout).
+
+import argparse
+import sys
+
+FIELDS = {
+    'exe': 'POLICY_FIELD_EXE',
+    'argv0': 'POLICY_FIELD_ARGV0',
+    'comm': 'POLICY_FIELD_COMM',
+}
+FIELD_BITS = {'exe': 0, 'argv0': 1, 'comm': 2}
+ACTIONS = {
+    'allow': 'POLICY_ACTION_ALLOW',
+    'deny': 'POLICY_ACTION_DENY',
+}
+GLOB_CHARS = '*?\\'
+
+
+def fnv1a(value):
+    h = 0xcbf29ce484222325
+    for b in value.encode():
+        h ^= b
+        h = (h * 0x100000001b3) & 0xffffffffffffffff
+    return h
+
+
+def parse_rule(rule, action):
+    field, sep, pattern = rule.partition(':')
+    if not sep or field not in FIELDS or pattern == '':
+        sys.exit(f'invalid policy rule {rule!r}: expected <exe|argv0|comm>:<pattern>')
+    return field, pattern, action
+
+
+def c_string(value):
+    out = '"'
+    for b in value.encode():
+        c = chr(b)
+        if c in '"\\':
+            out += '\\' + c
+        elif 0x20 <= b < 0x7f:
+            out += c
+        else:
+            out += f'\\{b:03o}'
+    return out + '\\0"'
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--default', choices=ACTIONS.keys(), default='allow')
+    parser.add_argument('--allow', action='append', default=[])
+    parser.add_argument('--deny', action='append', default=[])
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    rules = [parse_rule(r, 'allow') for r in args.allow]
+    rules += [parse_rule(r, 'deny') for r in args.deny]
+
+    strings = []
+    offsets = {}
+    offset = 0
+    literals = []
+    globs = []
+    fields = 0
+
+    for field, pattern, action in rules:
+        if pattern not in offsets:
+            offsets[pattern] = offset
+            strings.append(pattern)
+            offset += len(pattern.encode()) + 1
+        fields |= 1 << FIELD_BITS[field]
+        entry = (fnv1a(pattern), offsets[pattern], field, action)
+        if any(c in pattern for c in GLOB_CHARS):
+            globs.append(entry)
+        else:
+            literals.append(entry)
+
+    literals.sort()
+
+    def emit_rules(name, entries):
+        if not entries:
+            return [f'#define {name} nullptr\n']
+        lines = [f'static policy_rule_t const {name}[] = {{\n']
+        for h, off, field, action in entries:
+            lines.append(
+                f'  {{ .hash = 0x{h:016x}ull, .pattern = {off}, '
+                f'.field = {FIELDS[field]}, .action = {ACTIONS[action]} }},\n'
+            )
+        lines.append('};\n')
+        return lines
+
+    out = ['// generated by gen_policy_table.py, do not edit\n\n']
+    out.append('#include "policy.h"\n\n')
+    out += emit_rules('policy_builtin_literals', literals)
+    out.append('\n')
+    out += emit_rules('policy_builtin_globs', globs)
+    out.append('\n')
+    out.append('static char const policy_builtin_strings[] =\n')
+    if strings:
+        out += [f'  {c_string(s)}\n' for s in strings]
+    else:
+        out.append('  ""\n')
+    out.append(';\n\n')
+    out.append('policy_table_t const policy_builtin_table = {\n')
+    out.append('  .literals = policy_builtin_literals,\n')
+    out.append(f'  .n_literals = {len(literals)},\n')
+    out.append('  .globs = policy_builtin_globs,\n')
+    out.append(f'  .n_globs = {len(globs)},\n')
+    out.append('  .strings = policy_builtin_strings,\n')
+    out.append(f'  .fields = 0x{fields:02x},\n')
+    out.append(f'  .default_action = {ACTIONS[args.default]},\n')
+    out.append('};\n')
+
+    with open(args.output, 'w') as f:
+        f.writelines(out)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,15 +1,79 @@
 #include <assert.h>
-#include <dlfcn.h>
+#include <stdlib.h>
+#include <string.h>
 #include <gtk/gtk.h>
-#include <funchook-helper.h>
+#include "hookbatch.h"
+#include "stats.h"
+#include "probes.h"
+#include "primary.h"
+#include "startuptrace.h"
 #include "gtk3.h"
 
 static typeof(&gtk_clipboard_get_selection) gtk_clipboard_get_selection_func = nullptr;
+static typeof(&g_object_ref) g_object_ref_func = nullptr;
+static typeof(&g_object_unref) g_object_unref_func = nullptr;
+static typeof(&g_object_get_qdata) g_object_get_qdata_func = nullptr;
+static typeof(&g_object_set_qdata) g_object_set_qdata_func = nullptr;
+static typeof(&gtk_selection_data_get_length) gtk_selection_data_get_length_func = nullptr;
+static typeof(&gtk_selection_data_get_data_type) gtk_selection_data_get_data_type_func = nullptr;
+static typeof(&gtk_selection_data_set) gtk_selection_data_set_func = nullptr;
+static typeof(&gdk_pixbuf_get_rowstride) gdk_pixbuf_get_rowstride_func = nullptr;
+static typeof(&gdk_pixbuf_get_height) gdk_pixbuf_get_height_func = nullptr;
+static typeof(&gtk_clipboard_get_display) gtk_clipboard_get_display_func = nullptr;
+static typeof(&gtk_selection_data_set_text) gtk_selection_data_set_text_func = nullptr;
+static typeof(&gtk_selection_data_set_pixbuf) gtk_selection_data_set_pixbuf_func = nullptr;
+static typeof(&gdk_atom_intern) gdk_atom_intern_func = nullptr;
+static typeof(&g_free) g_free_func = nullptr;
 
-static void initialize_helper_symbols(void* handle) {
+static GQuark limited_get_func_quark = 0;
+
+static void initialize_helper_symbols(elfsym_resolver_t const* resolver) {
   gtk_clipboard_get_selection_func =
-    (typeof(&gtk_clipboard_get_selection))dlsym(handle, "gtk_clipboard_get_selection");
+    (typeof(&gtk_clipboard_get_selection))elfsym_resolve_own(resolver, "gtk_clipboard_get_selection");
   assert(gtk_clipboard_get_selection_func != nullptr);
+  g_object_ref_func = (typeof(&g_object_ref))elfsym_resolve_dep(resolver, "g_object_ref");
+  assert(g_object_ref_func != nullptr);
+  g_object_unref_func = (typeof(&g_object_unref))elfsym_resolve_dep(resolver, "g_object_unref");
+  assert(g_object_unref_func != nullptr);
+  g_object_get_qdata_func =
+    (typeof(&g_object_get_qdata))elfsym_resolve_dep(resolver, "g_object_get_qdata");
+  assert(g_object_get_qdata_func != nullptr);
+  g_object_set_qdata_func =
+    (typeof(&g_object_set_qdata))elfsym_resolve_dep(resolver, "g_object_set_qdata");
+  assert(g_object_set_qdata_func != nullptr);
+  gtk_selection_data_get_length_func =
+    (typeof(&gtk_selection_data_get_length))elfsym_resolve_own(resolver, "gtk_selection_data_get_length");
+  assert(gtk_selection_data_get_length_func != nullptr);
+  gtk_selection_data_get_data_type_func =
+    (typeof(&gtk_selection_data_get_data_type))elfsym_resolve_own(resolver, "gtk_selection_data_get_data_type");
+  assert(gtk_selection_data_get_data_type_func != nullptr);
+  gtk_selection_data_set_func =
+    (typeof(&gtk_selection_data_set))elfsym_resolve_own(resolver, "gtk_selection_data_set");
+  assert(gtk_selection_data_set_func != nullptr);
+  gdk_pixbuf_get_rowstride_func =
+    (typeof(&gdk_pixbuf_get_rowstride))elfsym_resolve_dep(resolver, "gdk_pixbuf_get_rowstride");
+  assert(gdk_pixbuf_get_rowstride_func != nullptr);
+  gdk_pixbuf_get_height_func =
+    (typeof(&gdk_pixbuf_get_height))elfsym_resolve_dep(resolver, "gdk_pixbuf_get_height");
+  assert(gdk_pixbuf_get_height_func != nullptr);
+  gtk_clipboard_get_display_func =
+    (typeof(&gtk_clipboard_get_display))elfsym_resolve_own(resolver, "gtk_clipboard_get_display");
+  assert(gtk_clipboard_get_display_func != nullptr);
+  gtk_selection_data_set_text_func =
+    (typeof(&gtk_selection_data_set_text))elfsym_resolve_own(resolver, "gtk_selection_data_set_text");
+  assert(gtk_selection_data_set_text_func != nullptr);
+  gtk_selection_data_set_pixbuf_func =
+    (typeof(&gtk_selection_data_set_pixbuf))elfsym_resolve_own(resolver, "gtk_selection_data_set_pixbuf");
+  assert(gtk_selection_data_set_pixbuf_func != nullptr);
+  gdk_atom_intern_func = (typeof(&gdk_atom_intern))elfsym_resolve_dep(resolver, "gdk_atom_intern");
+  assert(gdk_atom_intern_func != nullptr);
+  g_free_func = (typeof(&g_free))elfsym_resolve_dep(resolver, "g_free");
+  assert(g_free_func != nullptr);
+
+  auto g_quark_from_static_string_func =
+    (typeof(&g_quark_from_static_string))elfsym_resolve_dep(resolver, "g_quark_from_static_string");
+  assert(g_quark_from_static_string_func != nullptr);
+  limited_get_func_quark = g_quark_from_static_string_func("gtkclipblock-limited-get-func");
 }
 
 static GdkAtom original_gtk_clipboard_get_selection(GtkClipboard* clipboard) {
@@ -17,7 +81,403 @@ static GdkAtom original_gtk_clipboard_get_selection(GtkClipboard* clipboard) {
   return gtk_clipboard_get_selection_func(clipboard);
 }
 
-static fhh_hook_state_t gtk_clipboard_set_with_data_hook_state = {};
+static GdkDisplay* original_gtk_clipboard_get_display(GtkClipboard* clipboard) {
+  assert(gtk_clipboard_get_display_func != nullptr);
+  return gtk_clipboard_get_display_func(clipboard);
+}
+
+static bool is_primary_clipboard(GtkClipboard* clipboard) {
+  return clipboard != nullptr
+    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY;
+}
+
+// What blocked requests get, as if the owner had refused them.
+typedef struct {
+  GdkAtom selection;
+  GdkAtom target;
+  GdkAtom type;
+  gint format;
+  guchar* data;
+  gint length;
+  GdkDisplay* display;
+} private_GtkSelectionData_t;
+
+static private_GtkSelectionData_t empty_selection_data = {
+  .length = -1,
+};
+
+// With PRIMARY_LIMIT, the primary clipboard's contents get served through
+// this get function, the application's own being kept on the clipboard.
+static void limited_get_func(
+  GtkClipboard* clipboard,
+  GtkSelectionData* selection_data,
+  guint info,
+  gpointer user_data_or_owner
+) {
+  auto get_func = (GtkClipboardGetFunc)g_object_get_qdata_func((GObject*)clipboard, limited_get_func_quark);
+  if (get_func == nullptr) {
+    return;
+  }
+
+  get_func(clipboard, selection_data, info, user_data_or_owner);
+
+  // Refusing the request here is what keeps GTK from starting the transfer.
+  auto length = gtk_selection_data_get_length_func(selection_data);
+  if (length > 0 && !primary_fits(length)) {
+    gtk_selection_data_set_func(
+      selection_data,
+      gtk_selection_data_get_data_type_func(selection_data),
+      8,
+      nullptr,
+      -1
+    );
+  }
+}
+
+static GtkClipboardGetFunc swap_limited_get_func(
+  GtkClipboard* clipboard,
+  GtkClipboardGetFunc get_func
+) {
+  auto previous = (GtkClipboardGetFunc)g_object_get_qdata_func((GObject*)clipboard, limited_get_func_quark);
+  g_object_set_qdata_func((GObject*)clipboard, limited_get_func_quark, (gpointer)get_func);
+  return previous;
+}
+
+typedef struct {
+  GtkClipboardReceivedFunc callback;
+  gpointer user_data;
+} limited_request_t;
+
+static void limited_received_func(
+  GtkClipboard* clipboard,
+  GtkSelectionData* selection_data,
+  gpointer data
+) {
+  auto request = *(limited_request_t*)data;
+  free(data);
+
+  auto length = gtk_selection_data_get_length_func(selection_data);
+  if (length > 0 && !primary_fits(length)) {
+    selection_data = (GtkSelectionData*)&empty_selection_data;
+  }
+  request.callback(clipboard, selection_data, request.user_data);
+}
+
+static size_t pixbuf_size(GdkPixbuf* pixbuf) {
+  if (pixbuf == nullptr) {
+    return 0;
+  }
+  return (size_t)gdk_pixbuf_get_rowstride_func(pixbuf) * gdk_pixbuf_get_height_func(pixbuf);
+}
+
+// Claims held back by the debounced and local primary modes (see primary.h).
+// Each hook that claims the selection has its own kind, holding copies of (or
+// references to) everything GTK would have kept.
+
+static gboolean gtk_clipboard_set_with_data_hook(
+  GtkClipboard* clipboard,
+  GtkTargetEntry const* targets,
+  guint n_targets,
+  GtkClipboardGetFunc get_func,
+  GtkClipboardClearFunc clear_func,
+  gpointer user_data
+);
+static gboolean gtk_clipboard_set_with_owner_hook(
+  GtkClipboard* clipboard,
+  GtkTargetEntry const* targets,
+  guint n_targets,
+  GtkClipboardGetFunc get_func,
+  GtkClipboardClearFunc clear_func,
+  GObject* owner
+);
+static void gtk_clipboard_set_text_hook(GtkClipboard* clipboard, gchar const* text, gint len);
+static void gtk_clipboard_set_image_hook(GtkClipboard* clipboard, GdkPixbuf* pixbuf);
+
+typedef struct {
+  primary_claim_t base;
+  // Allocated along with the claim, target names included.
+  GtkTargetEntry* targets;
+  guint n_targets;
+  GtkClipboardGetFunc get_func;
+  GtkClipboardClearFunc clear_func;
+  // The owner, holding a reference, for gtk_clipboard_set_with_owner().
+  gpointer user_data;
+  bool have_owner;
+} contents_claim_t;
+
+static void commit_contents_claim(primary_claim_t* base) {
+  auto claim = (contents_claim_t*)base;
+  if (claim->have_owner) {
+    gtk_clipboard_set_with_owner_hook(
+      claim->base.clipboard,
+      claim->targets,
+      claim->n_targets,
+      claim->get_func,
+      claim->clear_func,
+      claim->user_data
+    );
+    g_object_unref_func(claim->user_data);
+  } else {
+    gtk_clipboard_set_with_data_hook(
+      claim->base.clipboard,
+      claim->targets,
+      claim->n_targets,
+      claim->get_func,
+      claim->clear_func,
+      claim->user_data
+    );
+  }
+  free(claim);
+}
+
+static void drop_contents_claim(primary_claim_t* base, primary_claim_t const* next) {
+  auto claim = (contents_claim_t*)base;
+
+  // Like GTK, the clear function isn't called when an owner replaces its own
+  // contents.
+  auto next_contents = next != nullptr && next->commit == commit_contents_claim
+    ? (contents_claim_t const*)next
+    : nullptr;
+  auto same_owner = claim->have_owner
+    && next_contents != nullptr
+    && next_contents->have_owner
+    && next_contents->user_data == claim->user_data;
+  if (!same_owner && claim->clear_func != nullptr) {
+    claim->clear_func(claim->base.clipboard, claim->user_data);
+  }
+
+  if (claim->have_owner) {
+    g_object_unref_func(claim->user_data);
+  }
+  free(claim);
+}
+
+static bool defer_contents(
+  GtkClipboard* clipboard,
+  stats_function_t function,
+  GtkTargetEntry const* targets,
+  guint n_targets,
+  GtkClipboardGetFunc get_func,
+  GtkClipboardClearFunc clear_func,
+  gpointer user_data,
+  bool have_owner
+) {
+  auto size = sizeof(contents_claim_t) + n_targets * sizeof(GtkTargetEntry);
+  for (guint i = 0; i < n_targets; i++) {
+    size += strlen(targets[i].target) + 1;
+  }
+
+  auto claim = (contents_claim_t*)malloc(size);
+  if (claim == nullptr) {
+    return false;
+  }
+
+  *claim = (contents_claim_t){
+    .base = {
+      .commit = commit_contents_claim,
+      .drop = drop_contents_claim,
+      .function = function,
+      .clipboard = clipboard,
+    },
+    .targets = (GtkTargetEntry*)(claim + 1),
+    .n_targets = n_targets,
+    .get_func = get_func,
+    .clear_func = clear_func,
+    .user_data = have_owner ? g_object_ref_func(user_data) : user_data,
+    .have_owner = have_owner,
+  };
+
+  auto names = (char*)(claim->targets + n_targets);
+  for (guint i = 0; i < n_targets; i++) {
+    auto len = strlen(targets[i].target) + 1;
+    memcpy(names, targets[i].target, len);
+    claim->targets[i] = targets[i];
+    claim->targets[i].target = names;
+    names += len;
+  }
+
+  primary_defer(&claim->base);
+  return true;
+}
+
+typedef struct {
+  primary_claim_t base;
+  gint len;
+  gchar text[];
+} text_claim_t;
+
+static void commit_text_claim(primary_claim_t* base) {
+  auto claim = (text_claim_t*)base;
+  gtk_clipboard_set_text_hook(claim->base.clipboard, claim->text, claim->len);
+  free(claim);
+}
+
+static void drop_text_claim(primary_claim_t* base, primary_claim_t const*) {
+  free(base);
+}
+
+static bool defer_text(GtkClipboard* clipboard, gchar const* text, gint len) {
+  auto size = primary_text_size(text, len);
+  auto claim = (text_claim_t*)malloc(sizeof(text_claim_t) + size + 1);
+  if (claim == nullptr) {
+    return false;
+  }
+
+  *claim = (text_claim_t){
+    .base = {
+      .commit = commit_text_claim,
+      .drop = drop_text_claim,
+      .function = STATS_FUNCTION(GTK3, gtk_clipboard_set_text),
+      .clipboard = clipboard,
+    },
+    .len = (gint)size,
+  };
+  if (size != 0) {
+    memcpy(claim->text, text, size);
+  }
+  claim->text[size] = '\0';
+
+  primary_defer(&claim->base);
+  return true;
+}
+
+typedef struct {
+  primary_claim_t base;
+  GdkPixbuf* pixbuf;
+} image_claim_t;
+
+static void commit_image_claim(primary_claim_t* base) {
+  auto claim = (image_claim_t*)base;
+  gtk_clipboard_set_image_hook(claim->base.clipboard, claim->pixbuf);
+  g_object_unref_func(claim->pixbuf);
+  free(claim);
+}
+
+static void drop_image_claim(primary_claim_t* base, primary_claim_t const*) {
+  auto claim = (image_claim_t*)base;
+  g_object_unref_func(claim->pixbuf);
+  free(claim);
+}
+
+static bool defer_image(GtkClipboard* clipboard, GdkPixbuf* pixbuf) {
+  auto claim = (image_claim_t*)malloc(sizeof(image_claim_t));
+  if (claim == nullptr) {
+    return false;
+  }
+
+  *claim = (image_claim_t){
+    .base = {
+      .commit = commit_image_claim,
+      .drop = drop_image_claim,
+      .function = STATS_FUNCTION(GTK3, gtk_clipboard_set_image),
+      .clipboard = clipboard,
+    },
+    .pixbuf = g_object_ref_func(pixbuf),
+  };
+
+  primary_defer(&claim->base);
+  return true;
+}
+
+// With PRIMARY_LOCAL, reads of the primary selection get served from the
+// claim kept for it, the way GTK would have served them to another
+// application.
+static GtkTargetEntry const text_targets[] = {
+  { .target = (gchar*)"UTF8_STRING" },
+  { .target = (gchar*)"STRING" },
+  { .target = (gchar*)"text/plain;charset=utf-8" },
+};
+
+static GtkTargetEntry const image_targets[] = {
+  { .target = (gchar*)"image/png" },
+};
+
+static void set_kept_targets(primary_claim_t* claim, GtkSelectionData* selection_data) {
+  GtkTargetEntry const* targets = image_targets;
+  guint n_targets = sizeof(image_targets) / sizeof(*image_targets);
+  if (claim->commit == commit_contents_claim) {
+    targets = ((contents_claim_t*)claim)->targets;
+    n_targets = ((contents_claim_t*)claim)->n_targets;
+  } else if (claim->commit == commit_text_claim) {
+    targets = text_targets;
+    n_targets = sizeof(text_targets) / sizeof(*text_targets);
+  }
+
+  auto atoms = (GdkAtom*)malloc(n_targets * sizeof(GdkAtom));
+  if (atoms == nullptr) {
+    return;
+  }
+  for (guint i = 0; i < n_targets; i++) {
+    atoms[i] = gdk_atom_intern_func(targets[i].target, false);
+  }
+
+  gtk_selection_data_set_func(
+    selection_data,
+    GDK_SELECTION_TYPE_ATOM,
+    32,
+    (guchar const*)atoms,
+    n_targets * sizeof(GdkAtom)
+  );
+  free(atoms);
+}
+
+static void set_kept_contents(
+  GtkClipboard* clipboard,
+  primary_claim_t* claim,
+  GtkSelectionData* selection_data,
+  GdkAtom target
+) {
+  if (target == gdk_atom_intern_func("TARGETS", false)) {
+    set_kept_targets(claim, selection_data);
+  } else if (claim->commit == commit_contents_claim) {
+    auto contents = (contents_claim_t*)claim;
+    for (guint i = 0; i < contents->n_targets; i++) {
+      if (gdk_atom_intern_func(contents->targets[i].target, false) == target) {
+        contents->get_func(clipboard, selection_data, contents->targets[i].info, contents->user_data);
+        break;
+      }
+    }
+  } else if (claim->commit == commit_text_claim) {
+    auto text = (text_claim_t*)claim;
+    gtk_selection_data_set_text_func(selection_data, text->text, text->len);
+  } else if (claim->commit == commit_image_claim) {
+    gtk_selection_data_set_pixbuf_func(selection_data, ((image_claim_t*)claim)->pixbuf);
+  }
+}
+
+static void serve_kept_contents(
+  GtkClipboard* clipboard,
+  GdkAtom target,
+  GtkClipboardReceivedFunc callback,
+  gpointer user_data
+) {
+  private_GtkSelectionData_t selection_data = {
+    .selection = GDK_SELECTION_PRIMARY,
+    .target = target,
+    .length = -1,
+    .display = original_gtk_clipboard_get_display(clipboard),
+  };
+
+  auto claim = primary_held(clipboard);
+  if (claim != nullptr) {
+    set_kept_contents(clipboard, claim, (GtkSelectionData*)&selection_data, target);
+  }
+
+  callback(clipboard, (GtkSelectionData*)&selection_data, user_data);
+  g_free_func(selection_data.data);
+}
+
+// What gtk_clipboard_get_owner() would return with the claim made.
+static GObject* held_owner(primary_claim_t* claim) {
+  if (claim == nullptr || claim->commit != commit_contents_claim) {
+    return nullptr;
+  }
+
+  auto contents = (contents_claim_t*)claim;
+  return contents->have_owner ? contents->user_data : nullptr;
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_set_with_data);
 static gboolean gtk_clipboard_set_with_data_hook(
   GtkClipboard* clipboard,
   GtkTargetEntry const* targets,
@@ -26,16 +486,51 @@ static gboolean gtk_clipboard_set_with_data_hook(
   GtkClipboardClearFunc clear_func,
   gpointer user_data
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_with_data);
-  auto func = FHH_GET_ORIGINAL_FUNC(gtk_clipboard_set_with_data);
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_with_data);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_set_with_data);
+  auto probe_start = PROBE_START(hook);
+
+  if (!primary_is_committing() && is_primary_clipboard(clipboard)) {
+    if (primary_defers() && defer_contents(
+      clipboard,
+      STATS_FUNCTION(GTK3, gtk_clipboard_set_with_data),
+      targets,
+      n_targets,
+      get_func,
+      clear_func,
+      user_data,
+      false
+    )) {
+      return true;
+    }
+
+    if (primary_mode() == PRIMARY_LIMIT) {
+      STATS_COUNT(GTK3, gtk_clipboard_set_with_data, STATS_PASSED);
+      PROBE_HOOK(gtk_clipboard_set_with_data, STATS_PASSED, clipboard, n_targets, probe_start);
+
+      auto previous = swap_limited_get_func(clipboard, get_func);
+      auto set = func(
+        clipboard,
+        targets,
+        n_targets,
+        limited_get_func,
+        clear_func,
+        user_data
+      );
+      if (!set) {
+        swap_limited_get_func(clipboard, previous);
+      }
+      return set;
+    }
 
-  if (
-    clipboard != nullptr
-    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY
-  ) {
+    STATS_COUNT(GTK3, gtk_clipboard_set_with_data, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_set_with_data, STATS_BLOCKED, clipboard, n_targets, probe_start);
     return true;
   }
 
+  STATS_COUNT(GTK3, gtk_clipboard_set_with_data, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_set_with_data, STATS_PASSED, clipboard, n_targets, probe_start);
+
   return func(
     clipboard,
     targets,
@@ -46,7 +541,7 @@ static gboolean gtk_clipboard_set_with_data_hook(
   );
 }
 
-static fhh_hook_state_t gtk_clipboard_set_with_owner_hook_state = {};
+HB_DECLARE_ORIGINAL(gtk_clipboard_set_with_owner);
 static gboolean gtk_clipboard_set_with_owner_hook(
   GtkClipboard* clipboard,
   GtkTargetEntry const* targets,
@@ -55,16 +550,51 @@ static gboolean gtk_clipboard_set_with_owner_hook(
   GtkClipboardClearFunc clear_func,
   GObject* owner
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_with_owner);
-  auto func = FHH_GET_ORIGINAL_FUNC(gtk_clipboard_set_with_owner);
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_with_owner);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_set_with_owner);
+  auto probe_start = PROBE_START(hook);
+
+  if (!primary_is_committing() && is_primary_clipboard(clipboard)) {
+    if (primary_defers() && defer_contents(
+      clipboard,
+      STATS_FUNCTION(GTK3, gtk_clipboard_set_with_owner),
+      targets,
+      n_targets,
+      get_func,
+      clear_func,
+      owner,
+      true
+    )) {
+      return true;
+    }
+
+    if (primary_mode() == PRIMARY_LIMIT) {
+      STATS_COUNT(GTK3, gtk_clipboard_set_with_owner, STATS_PASSED);
+      PROBE_HOOK(gtk_clipboard_set_with_owner, STATS_PASSED, clipboard, n_targets, probe_start);
+
+      auto previous = swap_limited_get_func(clipboard, get_func);
+      auto set = func(
+        clipboard,
+        targets,
+        n_targets,
+        limited_get_func,
+        clear_func,
+        owner
+      );
+      if (!set) {
+        swap_limited_get_func(clipboard, previous);
+      }
+      return set;
+    }
 
-  if (
-    clipboard != nullptr
-    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY
-  ) {
+    STATS_COUNT(GTK3, gtk_clipboard_set_with_owner, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_set_with_owner, STATS_BLOCKED, clipboard, n_targets, probe_start);
     return true;
   }
 
+  STATS_COUNT(GTK3, gtk_clipboard_set_with_owner, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_set_with_owner, STATS_PASSED, clipboard, n_targets, probe_start);
+
   return func(
     clipboard,
     targets,
@@ -75,22 +605,31 @@ static gboolean gtk_clipboard_set_with_owner_hook(
   );
 }
 
-static fhh_hook_state_t gtk_clipboard_set_text_hook_state = {};
+HB_DECLARE_ORIGINAL(gtk_clipboard_set_text);
 static void gtk_clipboard_set_text_hook(
   GtkClipboard* clipboard,
   gchar const* text,
   gint len
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_text);
-  auto func = FHH_GET_ORIGINAL_FUNC(gtk_clipboard_set_text);
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_text);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_set_text);
+  auto probe_start = PROBE_START(hook);
 
-  if (
-    clipboard != nullptr
-    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY
-  ) {
-    return;
+  if (!primary_is_committing() && is_primary_clipboard(clipboard)) {
+    if (primary_defers() && defer_text(clipboard, text, len)) {
+      return;
+    }
+
+    if (primary_mode() != PRIMARY_LIMIT || !primary_fits(primary_text_size(text, len))) {
+      STATS_COUNT(GTK3, gtk_clipboard_set_text, STATS_BLOCKED);
+      PROBE_HOOK(gtk_clipboard_set_text, STATS_BLOCKED, clipboard, primary_text_size(text, len), probe_start);
+      return;
+    }
   }
 
+  STATS_COUNT(GTK3, gtk_clipboard_set_text, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_set_text, STATS_PASSED, clipboard, primary_text_size(text, len), probe_start);
+
   return func(
     clipboard,
     text,
@@ -98,43 +637,55 @@ static void gtk_clipboard_set_text_hook(
   );
 }
 
-static fhh_hook_state_t gtk_clipboard_set_image_hook_state = {};
+HB_DECLARE_ORIGINAL(gtk_clipboard_set_image);
 static void gtk_clipboard_set_image_hook(
   GtkClipboard* clipboard,
   GdkPixbuf* pixbuf
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_image);
-  auto func = FHH_GET_ORIGINAL_FUNC(gtk_clipboard_set_image);
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_image);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_set_image);
+  auto probe_start = PROBE_START(hook);
 
-  if (
-    clipboard != nullptr
-    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY
-  ) {
-    return;
+  if (!primary_is_committing() && is_primary_clipboard(clipboard)) {
+    if (primary_defers() && defer_image(clipboard, pixbuf)) {
+      return;
+    }
+
+    if (primary_mode() != PRIMARY_LIMIT || !primary_fits(pixbuf_size(pixbuf))) {
+      STATS_COUNT(GTK3, gtk_clipboard_set_image, STATS_BLOCKED);
+      PROBE_HOOK(gtk_clipboard_set_image, STATS_BLOCKED, clipboard, 0, probe_start);
+      return;
+    }
   }
 
+  STATS_COUNT(GTK3, gtk_clipboard_set_image, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_set_image, STATS_PASSED, clipboard, 0, probe_start);
+
   return func(
     clipboard,
     pixbuf
   );
 }
 
-static fhh_hook_state_t gtk_clipboard_set_can_store_hook_state = {};
+HB_DECLARE_ORIGINAL(gtk_clipboard_set_can_store);
 static void gtk_clipboard_set_can_store_hook(
   GtkClipboard* clipboard,
   GtkTargetEntry const* targets,
   gint n_targets
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_can_store);
-  auto func = FHH_GET_ORIGINAL_FUNC(gtk_clipboard_set_can_store);
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_set_can_store);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_set_can_store);
+  auto probe_start = PROBE_START(hook);
 
-  if (
-    clipboard != nullptr
-    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY
-  ) {
+  if (is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_set_can_store, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_set_can_store, STATS_BLOCKED, clipboard, n_targets, probe_start);
     return;
   }
 
+  STATS_COUNT(GTK3, gtk_clipboard_set_can_store, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_set_can_store, STATS_PASSED, clipboard, n_targets, probe_start);
+
   return func(
     clipboard,
     targets,
@@ -142,76 +693,406 @@ static void gtk_clipboard_set_can_store_hook(
   );
 }
 
-static fhh_hook_state_t gtk_clipboard_store_hook_state = {};
+HB_DECLARE_ORIGINAL(gtk_clipboard_store);
 static void gtk_clipboard_store_hook(GtkClipboard* clipboard) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_store);
-  auto func = FHH_GET_ORIGINAL_FUNC(gtk_clipboard_store);
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_store);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_store);
+  auto probe_start = PROBE_START(hook);
 
-  if (
-    clipboard != nullptr
-    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY
-  ) {
+  auto primary = is_primary_clipboard(clipboard);
+  if (primary && (primary_mode() == PRIMARY_BLOCK || primary_mode() == PRIMARY_LOCAL)) {
+    STATS_COUNT(GTK3, gtk_clipboard_store, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_store, STATS_BLOCKED, clipboard, 0, probe_start);
     return;
   }
 
+  // Whatever the process itself claimed last has to be there first.
+  if (primary) {
+    primary_flush();
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_store, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_store, STATS_PASSED, clipboard, 0, probe_start);
+
   return func(clipboard);
 }
 
-static fhh_hook_state_t gtk_clipboard_request_contents_hook_state = {};
+HB_DECLARE_ORIGINAL(gtk_clipboard_request_contents);
 static void gtk_clipboard_request_contents_hook(
   GtkClipboard* clipboard,
   GdkAtom target,
   GtkClipboardReceivedFunc callback,
   gpointer user_data
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_request_contents);
-  auto func = FHH_GET_ORIGINAL_FUNC(gtk_clipboard_request_contents);
-
-  if (
-    clipboard != nullptr
-    && original_gtk_clipboard_get_selection(clipboard) == GDK_SELECTION_PRIMARY
-  ) {
-    typedef struct {
-      GdkAtom selection;
-      GdkAtom target;
-      GdkAtom type;
-      gint format;
-      guchar* data;
-      gint length;
-      GdkDisplay* display;
-    } private_GtkSelectionData_t;
-    static private_GtkSelectionData_t selection_data = {
-      .length = -1,
-    };
-    callback(clipboard, (GtkSelectionData*)&selection_data, user_data);
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_request_contents);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_request_contents);
+  auto probe_start = PROBE_START(hook);
+
+  auto primary = is_primary_clipboard(clipboard);
+  if (primary && primary_mode() == PRIMARY_LOCAL) {
+    STATS_COUNT(GTK3, gtk_clipboard_request_contents, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_request_contents, STATS_BLOCKED, clipboard, 0, probe_start);
+    serve_kept_contents(clipboard, target, callback, user_data);
     return;
   }
 
+  if (primary && primary_mode() == PRIMARY_BLOCK) {
+    STATS_COUNT(GTK3, gtk_clipboard_request_contents, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_request_contents, STATS_BLOCKED, clipboard, 0, probe_start);
+    callback(clipboard, (GtkSelectionData*)&empty_selection_data, user_data);
+    return;
+  }
+
+  // Whatever the process itself claimed last has to be there first.
+  if (primary) {
+    primary_flush();
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_request_contents, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_request_contents, STATS_PASSED, clipboard, 0, probe_start);
+
+  if (primary && primary_mode() == PRIMARY_LIMIT) {
+    auto request = (limited_request_t*)malloc(sizeof(limited_request_t));
+    if (request == nullptr) {
+      callback(clipboard, (GtkSelectionData*)&empty_selection_data, user_data);
+      return;
+    }
+    *request = (limited_request_t){
+      .callback = callback,
+      .user_data = user_data,
+    };
+    callback = limited_received_func;
+    user_data = request;
+  }
+
   func(clipboard, target, callback, user_data);
 }
 
-void hook_gtk3_install_hooks(void* dl_handle) {
-  bool installed = false;
-  installed |= FHH_INSTALL(dl_handle, gtk_clipboard_set_with_data);
-  installed |= FHH_INSTALL(dl_handle, gtk_clipboard_set_with_owner);
-  installed |= FHH_INSTALL(dl_handle, gtk_clipboard_set_text);
-  installed |= FHH_INSTALL(dl_handle, gtk_clipboard_set_image);
-  installed |= FHH_INSTALL(dl_handle, gtk_clipboard_set_can_store);
-  installed |= FHH_INSTALL(dl_handle, gtk_clipboard_store);
-  installed |= FHH_INSTALL(dl_handle, gtk_clipboard_request_contents);
+HB_DECLARE_ORIGINAL(gtk_clipboard_get_owner);
+static GObject* gtk_clipboard_get_owner_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_get_owner);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_get_owner);
+  auto probe_start = PROBE_START(hook);
+
+  // Applications check whether they still own the selection before clearing
+  // it, e.g. when a widget gets unrealized.
+  if (primary_defers() && is_primary_clipboard(clipboard)) {
+    auto claim = primary_held(clipboard);
+    if (claim != nullptr || primary_mode() == PRIMARY_LOCAL) {
+      STATS_COUNT(GTK3, gtk_clipboard_get_owner, STATS_BLOCKED);
+      PROBE_HOOK(gtk_clipboard_get_owner, STATS_BLOCKED, clipboard, 0, probe_start);
+      return held_owner(claim);
+    }
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_get_owner, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_get_owner, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(clipboard);
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_clear);
+static void gtk_clipboard_clear_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_clear);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_clear);
+  auto probe_start = PROBE_START(hook);
+
+  // What GTK itself might own gets cleared as well.
+  if (primary_defers() && is_primary_clipboard(clipboard)) {
+    primary_release(clipboard);
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_clear, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_clear, STATS_PASSED, clipboard, 0, probe_start);
+
+  func(clipboard);
+}
+
+// The wait_for_*()/wait_is_*() functions make the request through
+// gtk_clipboard_request_contents() with a main loop of their own to wait on,
+// once for each target they try. With the primary selection blocked, they
+// get their answer right away.
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_for_contents);
+static GtkSelectionData* gtk_clipboard_wait_for_contents_hook(
+  GtkClipboard* clipboard,
+  GdkAtom target
+) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_for_contents);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_for_contents);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_for_contents, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_for_contents, STATS_BLOCKED, clipboard, 0, probe_start);
+    return nullptr;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_for_contents, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_for_contents, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(
+    clipboard,
+    target
+  );
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_for_text);
+static gchar* gtk_clipboard_wait_for_text_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_for_text);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_for_text);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_for_text, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_for_text, STATS_BLOCKED, clipboard, 0, probe_start);
+    return nullptr;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_for_text, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_for_text, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(clipboard);
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_for_rich_text);
+static guint8* gtk_clipboard_wait_for_rich_text_hook(
+  GtkClipboard* clipboard,
+  GtkTextBuffer* buffer,
+  GdkAtom* format,
+  gsize* length
+) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_for_rich_text);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_for_rich_text);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_for_rich_text, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_for_rich_text, STATS_BLOCKED, clipboard, 0, probe_start);
+    *format = GDK_NONE;
+    *length = 0;
+    return nullptr;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_for_rich_text, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_for_rich_text, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(
+    clipboard,
+    buffer,
+    format,
+    length
+  );
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_for_image);
+static GdkPixbuf* gtk_clipboard_wait_for_image_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_for_image);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_for_image);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_for_image, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_for_image, STATS_BLOCKED, clipboard, 0, probe_start);
+    return nullptr;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_for_image, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_for_image, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(clipboard);
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_for_uris);
+static gchar** gtk_clipboard_wait_for_uris_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_for_uris);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_for_uris);
+  auto probe_start = PROBE_START(hook);
 
-  if (installed) {
-    initialize_helper_symbols(dl_handle);
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_for_uris, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_for_uris, STATS_BLOCKED, clipboard, 0, probe_start);
+    return nullptr;
   }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_for_uris, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_for_uris, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(clipboard);
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_for_targets);
+static gboolean gtk_clipboard_wait_for_targets_hook(
+  GtkClipboard* clipboard,
+  GdkAtom** targets,
+  gint* n_targets
+) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_for_targets);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_for_targets);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_for_targets, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_for_targets, STATS_BLOCKED, clipboard, 0, probe_start);
+    if (targets != nullptr) {
+      *targets = nullptr;
+    }
+    if (n_targets != nullptr) {
+      *n_targets = 0;
+    }
+    return false;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_for_targets, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_for_targets, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(
+    clipboard,
+    targets,
+    n_targets
+  );
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_is_text_available);
+static gboolean gtk_clipboard_wait_is_text_available_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_is_text_available);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_is_text_available);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_is_text_available, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_is_text_available, STATS_BLOCKED, clipboard, 0, probe_start);
+    return false;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_is_text_available, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_is_text_available, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(clipboard);
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_is_rich_text_available);
+static gboolean gtk_clipboard_wait_is_rich_text_available_hook(
+  GtkClipboard* clipboard,
+  GtkTextBuffer* buffer
+) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_is_rich_text_available);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_is_rich_text_available);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_is_rich_text_available, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_is_rich_text_available, STATS_BLOCKED, clipboard, 0, probe_start);
+    return false;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_is_rich_text_available, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_is_rich_text_available, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(
+    clipboard,
+    buffer
+  );
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_is_image_available);
+static gboolean gtk_clipboard_wait_is_image_available_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_is_image_available);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_is_image_available);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_is_image_available, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_is_image_available, STATS_BLOCKED, clipboard, 0, probe_start);
+    return false;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_is_image_available, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_is_image_available, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(clipboard);
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_is_uris_available);
+static gboolean gtk_clipboard_wait_is_uris_available_hook(GtkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_is_uris_available);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_is_uris_available);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_is_uris_available, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_is_uris_available, STATS_BLOCKED, clipboard, 0, probe_start);
+    return false;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_is_uris_available, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_is_uris_available, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(clipboard);
+}
+
+HB_DECLARE_ORIGINAL(gtk_clipboard_wait_is_target_available);
+static gboolean gtk_clipboard_wait_is_target_available_hook(
+  GtkClipboard* clipboard,
+  GdkAtom target
+) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gtk_clipboard_wait_is_target_available);
+  auto func = HB_GET_ORIGINAL_FUNC(gtk_clipboard_wait_is_target_available);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK3, gtk_clipboard_wait_is_target_available, STATS_BLOCKED);
+    PROBE_HOOK(gtk_clipboard_wait_is_target_available, STATS_BLOCKED, clipboard, 0, probe_start);
+    return false;
+  }
+
+  STATS_COUNT(GTK3, gtk_clipboard_wait_is_target_available, STATS_PASSED);
+  PROBE_HOOK(gtk_clipboard_wait_is_target_available, STATS_PASSED, clipboard, 0, probe_start);
+
+  return func(
+    clipboard,
+    target
+  );
+}
+
+static hookbatch_t hooks = {};
+
+static hookbatch_entry_t const hook_entries[] = {
+  HOOK_GTK3_FUNCTIONS(HB_HOOK_LIST_ENTRY)
+};
+
+bool hook_gtk3_install_hooks(void* dl_handle, struct link_map const* map) {
+  elfsym_resolver_t resolver;
+  elfsym_resolver_init(&resolver, dl_handle, map);
+
+  // The hooks can get called as soon as they're in place.
+  initialize_helper_symbols(&resolver);
+  primary_attach(&resolver);
+  startup_trace_mark(STARTUP_TRACE_RESOLVE);
+
+  return hookbatch_install(
+    &hooks,
+    &resolver,
+    hook_entries,
+    sizeof(hook_entries) / sizeof(*hook_entries)
+  );
 }
 
 void hook_gtk3_uninstall_hooks() {
-  FHH_UNINSTALL(gtk_clipboard_set_with_data);
-  FHH_UNINSTALL(gtk_clipboard_set_with_owner);
-  FHH_UNINSTALL(gtk_clipboard_set_text);
-  FHH_UNINSTALL(gtk_clipboard_set_image);
-  FHH_UNINSTALL(gtk_clipboard_set_can_store);
-  FHH_UNINSTALL(gtk_clipboard_store);
-  FHH_UNINSTALL(gtk_clipboard_request_contents);
+  hookbatch_uninstall(&hooks);
+  primary_detach();
   gtk_clipboard_get_selection_func = nullptr;
+  g_object_ref_func = nullptr;
+  g_object_unref_func = nullptr;
+  g_object_get_qdata_func = nullptr;
+  g_object_set_qdata_func = nullptr;
+  gtk_selection_data_get_length_func = nullptr;
+  gtk_selection_data_get_data_type_func = nullptr;
+  gtk_selection_data_set_func = nullptr;
+  gdk_pixbuf_get_rowstride_func = nullptr;
+  gdk_pixbuf_get_height_func = nullptr;
+  gtk_clipboard_get_display_func = nullptr;
+  gtk_selection_data_set_text_func = nullptr;
+  gtk_selection_data_set_pixbuf_func = nullptr;
+  gdk_atom_intern_func = nullptr;
+  g_free_func = nullptr;
 }
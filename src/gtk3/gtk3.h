@@ -1,7 +1,33 @@
 #ifndef GTKCLIPBLOCK_GTK3_H
 #define GTKCLIPBLOCK_GTK3_H
 
-void hook_gtk3_install_hooks(void* dl_handle);
+// The functions that get hooked, as an X macro.
+#define HOOK_GTK3_FUNCTIONS(X) \
+  X(gtk_clipboard_set_with_data) \
+  X(gtk_clipboard_set_with_owner) \
+  X(gtk_clipboard_set_text) \
+  X(gtk_clipboard_set_image) \
+  X(gtk_clipboard_set_can_store) \
+  X(gtk_clipboard_store) \
+  X(gtk_clipboard_request_contents) \
+  X(gtk_clipboard_get_owner) \
+  X(gtk_clipboard_clear) \
+  X(gtk_clipboard_wait_for_contents) \
+  X(gtk_clipboard_wait_for_text) \
+  X(gtk_clipboard_wait_for_rich_text) \
+  X(gtk_clipboard_wait_for_image) \
+  X(gtk_clipboard_wait_for_uris) \
+  X(gtk_clipboard_wait_for_targets) \
+  X(gtk_clipboard_wait_is_text_available) \
+  X(gtk_clipboard_wait_is_rich_text_available) \
+  X(gtk_clipboard_wait_is_image_available) \
+  X(gtk_clipboard_wait_is_uris_available) \
+  X(gtk_clipboard_wait_is_target_available)
+
+struct link_map;
+
+// Returns whether any hook got installed.
+bool hook_gtk3_install_hooks(void* dl_handle, struct link_map const* map);
 void hook_gtk3_uninstall_hooks();
 
 #endif
@@ -1,73 +1,752 @@
 #include <assert.h>
-#include <dlfcn.h>
 #include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <gtk/gtk.h>
-#include <funchook-helper.h>
+#include "hookbatch.h"
+#include "stats.h"
+#include "probes.h"
+#include "primary.h"
+#include "startuptrace.h"
 #include "gtk4.h"
 
+#define HELPER_SYMBOL(name) static typeof(&name) name##_func = nullptr
+
+#define RESOLVE_HELPER_SYMBOL(resolve, resolver, name) \
+  do { \
+    name##_func = (typeof(&name))resolve(resolver, #name); \
+    assert(name##_func != nullptr); \
+  } while (0)
+
+// GDK is part of GTK itself; GLib is one of its dependencies.
+#define RESOLVE_GDK_SYMBOL(resolver, name) \
+  RESOLVE_HELPER_SYMBOL(elfsym_resolve_own, resolver, name)
+#define RESOLVE_GLIB_SYMBOL(resolver, name) \
+  RESOLVE_HELPER_SYMBOL(elfsym_resolve_dep, resolver, name)
+
+HELPER_SYMBOL(gdk_clipboard_get_display);
+HELPER_SYMBOL(gdk_display_get_primary_clipboard);
+HELPER_SYMBOL(gdk_display_get_clipboard);
+HELPER_SYMBOL(gdk_content_provider_get_type);
+HELPER_SYMBOL(gdk_content_provider_ref_formats);
+HELPER_SYMBOL(gdk_content_provider_ref_storable_formats);
+HELPER_SYMBOL(gdk_content_provider_content_changed);
+HELPER_SYMBOL(gdk_content_provider_write_mime_type_async);
+HELPER_SYMBOL(gdk_content_provider_write_mime_type_finish);
+HELPER_SYMBOL(gdk_content_provider_get_value);
+HELPER_SYMBOL(gdk_texture_get_type);
+HELPER_SYMBOL(gdk_texture_get_width);
+HELPER_SYMBOL(gdk_texture_get_height);
+HELPER_SYMBOL(g_object_weak_ref);
+HELPER_SYMBOL(g_object_ref);
+HELPER_SYMBOL(g_object_unref);
+HELPER_SYMBOL(g_io_error_quark);
+HELPER_SYMBOL(g_task_new);
+HELPER_SYMBOL(g_task_set_source_tag);
+HELPER_SYMBOL(g_task_get_source_tag);
+HELPER_SYMBOL(g_task_get_context);
+HELPER_SYMBOL(g_task_is_valid);
+HELPER_SYMBOL(g_task_return_new_error);
+HELPER_SYMBOL(g_task_return_boolean);
+HELPER_SYMBOL(g_task_propagate_pointer);
+HELPER_SYMBOL(g_task_propagate_boolean);
+HELPER_SYMBOL(g_idle_source_new);
+HELPER_SYMBOL(g_source_set_callback);
+HELPER_SYMBOL(g_source_attach);
+HELPER_SYMBOL(g_source_unref);
+HELPER_SYMBOL(g_type_register_static_simple);
+HELPER_SYMBOL(g_type_class_peek_parent);
+HELPER_SYMBOL(g_object_new);
+HELPER_SYMBOL(g_signal_connect_data);
+HELPER_SYMBOL(g_signal_handler_disconnect);
+HELPER_SYMBOL(g_task_set_task_data);
+HELPER_SYMBOL(g_task_get_task_data);
+HELPER_SYMBOL(g_task_get_cancellable);
+HELPER_SYMBOL(g_task_return_error);
+HELPER_SYMBOL(g_memory_output_stream_new);
+HELPER_SYMBOL(g_memory_output_stream_get_data);
+HELPER_SYMBOL(g_memory_output_stream_get_data_size);
+HELPER_SYMBOL(g_output_stream_write_all_async);
+HELPER_SYMBOL(g_output_stream_write_all_finish);
+HELPER_SYMBOL(g_set_error_literal);
+HELPER_SYMBOL(g_task_return_pointer);
+HELPER_SYMBOL(g_value_init);
+HELPER_SYMBOL(g_value_unset);
+HELPER_SYMBOL(g_value_dup_string);
+HELPER_SYMBOL(g_value_dup_object);
+HELPER_SYMBOL(g_error_free);
+HELPER_SYMBOL(g_free);
+
+static void initialize_helper_symbols(elfsym_resolver_t const* resolver) {
+  RESOLVE_GDK_SYMBOL(resolver, gdk_clipboard_get_display);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_display_get_primary_clipboard);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_display_get_clipboard);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_content_provider_get_type);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_content_provider_ref_formats);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_content_provider_ref_storable_formats);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_content_provider_content_changed);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_content_provider_write_mime_type_async);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_content_provider_write_mime_type_finish);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_content_provider_get_value);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_texture_get_type);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_texture_get_width);
+  RESOLVE_GDK_SYMBOL(resolver, gdk_texture_get_height);
+  RESOLVE_GLIB_SYMBOL(resolver, g_object_weak_ref);
+  RESOLVE_GLIB_SYMBOL(resolver, g_object_ref);
+  RESOLVE_GLIB_SYMBOL(resolver, g_object_unref);
+  RESOLVE_GLIB_SYMBOL(resolver, g_io_error_quark);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_new);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_set_source_tag);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_get_source_tag);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_get_context);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_is_valid);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_return_new_error);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_return_boolean);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_propagate_pointer);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_propagate_boolean);
+  RESOLVE_GLIB_SYMBOL(resolver, g_idle_source_new);
+  RESOLVE_GLIB_SYMBOL(resolver, g_source_set_callback);
+  RESOLVE_GLIB_SYMBOL(resolver, g_source_attach);
+  RESOLVE_GLIB_SYMBOL(resolver, g_source_unref);
+  RESOLVE_GLIB_SYMBOL(resolver, g_type_register_static_simple);
+  RESOLVE_GLIB_SYMBOL(resolver, g_type_class_peek_parent);
+  RESOLVE_GLIB_SYMBOL(resolver, g_object_new);
+  RESOLVE_GLIB_SYMBOL(resolver, g_signal_connect_data);
+  RESOLVE_GLIB_SYMBOL(resolver, g_signal_handler_disconnect);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_set_task_data);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_get_task_data);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_get_cancellable);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_return_error);
+  RESOLVE_GLIB_SYMBOL(resolver, g_memory_output_stream_new);
+  RESOLVE_GLIB_SYMBOL(resolver, g_memory_output_stream_get_data);
+  RESOLVE_GLIB_SYMBOL(resolver, g_memory_output_stream_get_data_size);
+  RESOLVE_GLIB_SYMBOL(resolver, g_output_stream_write_all_async);
+  RESOLVE_GLIB_SYMBOL(resolver, g_output_stream_write_all_finish);
+  RESOLVE_GLIB_SYMBOL(resolver, g_set_error_literal);
+  RESOLVE_GLIB_SYMBOL(resolver, g_task_return_pointer);
+  RESOLVE_GLIB_SYMBOL(resolver, g_value_init);
+  RESOLVE_GLIB_SYMBOL(resolver, g_value_unset);
+  RESOLVE_GLIB_SYMBOL(resolver, g_value_dup_string);
+  RESOLVE_GLIB_SYMBOL(resolver, g_value_dup_object);
+  RESOLVE_GLIB_SYMBOL(resolver, g_error_free);
+  RESOLVE_GLIB_SYMBOL(resolver, g_free);
+}
+
+static GdkDisplay* original_gdk_clipboard_get_display(GdkClipboard* clipboard) {
+  assert(gdk_clipboard_get_display_func != nullptr);
+  return gdk_clipboard_get_display_func(clipboard);
+}
+
+static GdkClipboard* original_gdk_display_get_primary_clipboard(GdkDisplay* display) {
+  assert(gdk_display_get_primary_clipboard_func != nullptr);
+  return gdk_display_get_primary_clipboard_func(display);
+}
+
+static GdkClipboard* original_gdk_display_get_clipboard(GdkDisplay* display) {
+  assert(gdk_display_get_clipboard_func != nullptr);
+  return gdk_display_get_clipboard_func(display);
+}
+
+static void original_g_object_weak_ref(GObject* object, GWeakNotify notify, gpointer data) {
+  assert(g_object_weak_ref_func != nullptr);
+  g_object_weak_ref_func(object, notify, data);
+}
+
+// Both clipboards of a display live as long as the display itself, so they're
+// cached until it gets finalized. GDK objects can only be used from the main
+// thread, hence no locking.
+#define DISPLAY_CACHE_SIZE 4
+
 typedef struct {
+  GdkDisplay* display;
+  GdkClipboard* primary_clipboard;
   GdkClipboard* clipboard;
-} tls_data_t;
+} display_cache_entry_t;
 
-static pthread_key_t tls_key;
-static pthread_once_t tls_key_once = PTHREAD_ONCE_INIT;
+static display_cache_entry_t display_cache[DISPLAY_CACHE_SIZE] = {};
 
-static void create_tls_key() {
-  assert(pthread_key_create(&tls_key, free) == 0);
+static void display_cache_weak_notify(gpointer, GObject* object) {
+  for (size_t i = 0; i < DISPLAY_CACHE_SIZE; i++) {
+    if (display_cache[i].display == (GdkDisplay*)object) {
+      display_cache[i] = (display_cache_entry_t){};
+    }
+  }
 }
 
-static tls_data_t* get_tls_data() {
-  pthread_once(&tls_key_once, create_tls_key);
-  auto ptr = (tls_data_t*)pthread_getspecific(tls_key);
+static bool is_primary_clipboard(GdkClipboard* clipboard) {
+  if (clipboard == nullptr) {
+    return false;
+  }
+
+  for (size_t i = 0; i < DISPLAY_CACHE_SIZE; i++) {
+    if (display_cache[i].display == nullptr) {
+      continue;
+    }
+
+    if (display_cache[i].primary_clipboard == clipboard) {
+      return true;
+    }
+
+    if (display_cache[i].clipboard == clipboard) {
+      return false;
+    }
+  }
+
+  auto display = original_gdk_clipboard_get_display(clipboard);
+  if (display == nullptr) {
+    return false;
+  }
 
-  if (ptr == nullptr) {
-    ptr = (tls_data_t*)malloc(sizeof(tls_data_t));
-    assert(ptr != nullptr);
-    ptr->clipboard = nullptr;
+  auto primary_clipboard = original_gdk_display_get_primary_clipboard(display);
 
-    assert(pthread_setspecific(tls_key, ptr) == 0);
+  // If the cache is full, this display just doesn't get cached.
+  for (size_t i = 0; i < DISPLAY_CACHE_SIZE; i++) {
+    if (display_cache[i].display == nullptr) {
+      display_cache[i] = (display_cache_entry_t){
+        .display = display,
+        .primary_clipboard = primary_clipboard,
+        .clipboard = original_gdk_display_get_clipboard(display),
+      };
+      original_g_object_weak_ref((GObject*)display, display_cache_weak_notify, nullptr);
+      break;
+    }
   }
 
-  return ptr;
+  return primary_clipboard == clipboard;
 }
 
-static void tls_data_set_clipboard(GdkClipboard* clipboard) {
-  auto tls_data = get_tls_data();
-  tls_data->clipboard = clipboard;
+// Blocked async operations are completed through a GTask, from an idle source
+// rather than from within the *_async call: callbacks that start another read
+// would otherwise recurse indefinitely. Operations blocked during the same
+// main context iteration share a single idle source.
+//
+// With PRIMARY_LOCAL, reads get completed the same way, with what the kept
+// claim's provider has for them.
+typedef struct blocked_op {
+  struct blocked_op* next;
+  GTask* task;
+  GMainContext* context;
+  bool succeed;
+  // Holds a reference, unless nullptr.
+  GdkContentProvider* content;
+  GType type;
+} blocked_op_t;
+
+static pthread_mutex_t blocked_ops_mutex = PTHREAD_MUTEX_INITIALIZER;
+static blocked_op_t* blocked_ops = nullptr;
+
+static void gdk_clipboard_read_text_async_hook(
+  GdkClipboard* clipboard,
+  GCancellable* cancellable,
+  GAsyncReadyCallback callback,
+  gpointer user_data
+);
+static void gdk_clipboard_read_texture_async_hook(
+  GdkClipboard* clipboard,
+  GCancellable* cancellable,
+  GAsyncReadyCallback callback,
+  gpointer user_data
+);
+
+static void free_kept_value(gpointer data) {
+  auto value = (GValue*)data;
+  g_value_unset_func(value);
+  free(value);
 }
 
-static bool tls_data_clipboard_matches(GdkClipboard* clipboard) {
-  auto tls_data = get_tls_data();
-  if (clipboard == nullptr) {
+static void return_kept_value(blocked_op_t* op) {
+  GValue value = {};
+  g_value_init_func(&value, op->type);
+
+  GError* error = nullptr;
+  if (!gdk_content_provider_get_value_func(op->content, &value, &error)) {
+    g_value_unset_func(&value);
+    g_task_return_error_func(op->task, error);
+    return;
+  }
+
+  auto source_tag = g_task_get_source_tag_func(op->task);
+  if (source_tag == gdk_clipboard_read_text_async_hook) {
+    g_task_return_pointer_func(op->task, g_value_dup_string_func(&value), g_free_func);
+  } else if (source_tag == gdk_clipboard_read_texture_async_hook) {
+    g_task_return_pointer_func(op->task, g_value_dup_object_func(&value), g_object_unref_func);
+  } else {
+    // Like GDK's, the value lives as long as the task.
+    auto copy = (GValue*)malloc(sizeof(GValue));
+    assert(copy != nullptr);
+    *copy = value;
+    g_task_set_task_data_func(op->task, copy, free_kept_value);
+    g_task_return_pointer_func(op->task, copy, nullptr);
+    return;
+  }
+  g_value_unset_func(&value);
+}
+
+static gboolean dispatch_blocked_ops(gpointer data) {
+  auto context = (GMainContext*)data;
+
+  // Take the operations for this context out of the queue first; anything
+  // that gets blocked by their callbacks goes into the next batch.
+  blocked_op_t* batch = nullptr;
+  auto batch_tail = &batch;
+
+  assert(pthread_mutex_lock(&blocked_ops_mutex) == 0);
+  for (auto op_ptr = &blocked_ops; *op_ptr != nullptr;) {
+    auto op = *op_ptr;
+    if (op->context != context) {
+      op_ptr = &op->next;
+      continue;
+    }
+
+    *op_ptr = op->next;
+    op->next = nullptr;
+    *batch_tail = op;
+    batch_tail = &op->next;
+  }
+  assert(pthread_mutex_unlock(&blocked_ops_mutex) == 0);
+
+  while (batch != nullptr) {
+    auto op = batch;
+    batch = op->next;
+
+    if (op->content != nullptr) {
+      return_kept_value(op);
+      g_object_unref_func(op->content);
+    } else if (op->succeed) {
+      g_task_return_boolean_func(op->task, true);
+    } else {
+      g_task_return_new_error_func(
+        op->task,
+        g_io_error_quark_func(),
+        G_IO_ERROR_NOT_SUPPORTED,
+        "Access to the primary clipboard is blocked"
+      );
+    }
+
+    g_object_unref_func(op->task);
+    free(op);
+  }
+
+  return false;
+}
+
+static void queue_blocked_op(
+  GdkClipboard* clipboard,
+  gpointer source_tag,
+  bool succeed,
+  GdkContentProvider* content,
+  GType type,
+  GCancellable* cancellable,
+  GAsyncReadyCallback callback,
+  gpointer user_data
+) {
+  auto task = g_task_new_func(clipboard, cancellable, callback, user_data);
+  g_task_set_source_tag_func(task, source_tag);
+
+  auto op = (blocked_op_t*)malloc(sizeof(blocked_op_t));
+  assert(op != nullptr);
+  *op = (blocked_op_t){
+    .task = task,
+    .context = g_task_get_context_func(task),
+    .succeed = succeed,
+    .content = content != nullptr ? g_object_ref_func(content) : nullptr,
+    .type = type,
+  };
+
+  assert(pthread_mutex_lock(&blocked_ops_mutex) == 0);
+
+  // If there's already something queued for this context, its idle source
+  // will pick this one up as well.
+  bool scheduled = false;
+  auto op_ptr = &blocked_ops;
+  for (; *op_ptr != nullptr; op_ptr = &(*op_ptr)->next) {
+    scheduled |= (*op_ptr)->context == op->context;
+  }
+  *op_ptr = op;
+
+  if (!scheduled) {
+    auto source = g_idle_source_new_func();
+    g_source_set_callback_func(source, dispatch_blocked_ops, op->context, nullptr);
+    g_source_attach_func(source, op->context);
+    g_source_unref_func(source);
+  }
+
+  assert(pthread_mutex_unlock(&blocked_ops_mutex) == 0);
+}
+
+static void complete_blocked_op(
+  GdkClipboard* clipboard,
+  gpointer source_tag,
+  bool succeed,
+  GCancellable* cancellable,
+  GAsyncReadyCallback callback,
+  gpointer user_data
+) {
+  queue_blocked_op(clipboard, source_tag, succeed, nullptr, 0, cancellable, callback, user_data);
+}
+
+static bool is_blocked_op_result(
+  GdkClipboard* clipboard,
+  GAsyncResult* result,
+  gpointer source_tag
+) {
+  return result != nullptr
+    && g_task_is_valid_func(result, clipboard)
+    && g_task_get_source_tag_func((GTask*)result) == source_tag;
+}
+
+// With PRIMARY_LIMIT, providers set on a primary clipboard get wrapped in one
+// of these, which refuses to hand out more than the limit. GDK either asks it
+// for a value, which gets sized up before anything serializes it, or has it
+// write to the display server's stream, which it does through a buffer that
+// stops growing past the limit: the contents only reach the stream once
+// they're known to fit. gdk_clipboard_get_content() unwraps it again, since
+// applications compare it with their own providers.
+typedef struct {
+  GdkContentProvider parent;
+  GdkContentProvider* content;
+  gulong content_changed_handler;
+} limited_provider_t;
+
+typedef struct {
+  GdkContentProviderClass parent_class;
+} limited_provider_class_t;
+
+// Registered on first use. GObject can't unregister types, so it stays.
+static GType limited_provider_type = 0;
+static GObjectClass* limited_provider_parent_class = nullptr;
+
+static bool is_limited_provider(GdkContentProvider* provider) {
+  return limited_provider_type != 0
+    && provider != nullptr
+    && ((GTypeInstance*)provider)->g_class->g_type == limited_provider_type;
+}
+
+static GdkContentProviderClass* content_provider_class(GdkContentProvider* provider) {
+  return (GdkContentProviderClass*)((GTypeInstance*)provider)->g_class;
+}
+
+static size_t texture_size(GdkTexture* texture) {
+  if (texture == nullptr) {
+    return 0;
+  }
+  return (size_t)gdk_texture_get_width_func(texture) * gdk_texture_get_height_func(texture) * 4;
+}
+
+// How large a value is as far as can be told without serializing it; 0 for
+// the types it can't tell.
+static size_t value_size(GValue const* value) {
+  if (G_VALUE_TYPE(value) == G_TYPE_STRING) {
+    auto text = (char const*)value->data[0].v_pointer;
+    return text != nullptr ? strlen(text) : 0;
+  }
+  if (G_VALUE_TYPE(value) == gdk_texture_get_type_func()) {
+    return texture_size(value->data[0].v_pointer);
+  }
+  return 0;
+}
+
+static void set_too_large_error(GError** error) {
+  g_set_error_literal_func(
+    error,
+    g_io_error_quark_func(),
+    G_IO_ERROR_NO_SPACE,
+    "The primary selection's contents are larger than allowed"
+  );
+}
+
+static void limited_provider_finalize(GObject* object) {
+  auto self = (limited_provider_t*)object;
+  g_signal_handler_disconnect_func(self->content, self->content_changed_handler);
+  g_object_unref_func(self->content);
+  limited_provider_parent_class->finalize(object);
+}
+
+static void limited_provider_attach_clipboard(GdkContentProvider* provider, GdkClipboard* clipboard) {
+  auto content = ((limited_provider_t*)provider)->content;
+  if (content_provider_class(content)->attach_clipboard != nullptr) {
+    content_provider_class(content)->attach_clipboard(content, clipboard);
+  }
+}
+
+static void limited_provider_detach_clipboard(GdkContentProvider* provider, GdkClipboard* clipboard) {
+  auto content = ((limited_provider_t*)provider)->content;
+  if (content_provider_class(content)->detach_clipboard != nullptr) {
+    content_provider_class(content)->detach_clipboard(content, clipboard);
+  }
+}
+
+static GdkContentFormats* limited_provider_ref_formats(GdkContentProvider* provider) {
+  return gdk_content_provider_ref_formats_func(((limited_provider_t*)provider)->content);
+}
+
+static GdkContentFormats* limited_provider_ref_storable_formats(GdkContentProvider* provider) {
+  return gdk_content_provider_ref_storable_formats_func(((limited_provider_t*)provider)->content);
+}
+
+static gboolean limited_provider_get_value(
+  GdkContentProvider* provider,
+  GValue* value,
+  GError** error
+) {
+  if (!gdk_content_provider_get_value_func(((limited_provider_t*)provider)->content, value, error)) {
     return false;
   }
 
-  return tls_data->clipboard == clipboard;
+  if (!primary_fits(value_size(value))) {
+    set_too_large_error(error);
+    return false;
+  }
+  return true;
 }
 
-static typeof(&gdk_clipboard_get_display) gdk_clipboard_get_display_func = nullptr;
-static typeof(&gdk_display_get_primary_clipboard) gdk_display_get_primary_clipboard_func = nullptr;
+typedef struct {
+  GOutputStream* stream;
+  GOutputStream* buffer;
+  int io_priority;
+} limited_write_t;
 
-static void initialize_helper_symbols(void* handle) {
-  gdk_clipboard_get_display_func =
-    (typeof(&gdk_clipboard_get_display))dlsym(handle, "gdk_clipboard_get_display");
-  assert(gdk_clipboard_get_display_func != nullptr);
-  gdk_display_get_primary_clipboard_func =
-    (typeof(&gdk_display_get_primary_clipboard))dlsym(handle, "gdk_display_get_primary_clipboard");
-  assert(gdk_display_get_primary_clipboard_func != nullptr);
+static void free_limited_write(gpointer data) {
+  auto write = (limited_write_t*)data;
+  g_object_unref_func(write->stream);
+  g_object_unref_func(write->buffer);
+  free(write);
 }
 
-static GdkDisplay* original_gdk_clipboard_get_display(GdkClipboard* clipboard) {
-  assert(gdk_clipboard_get_display_func != nullptr);
-  return gdk_clipboard_get_display_func(clipboard);
+static void limited_write_done(GObject* source, GAsyncResult* result, gpointer data) {
+  auto task = (GTask*)data;
+
+  GError* error = nullptr;
+  if (g_output_stream_write_all_finish_func((GOutputStream*)source, result, nullptr, &error)) {
+    g_task_return_boolean_func(task, true);
+  } else {
+    g_task_return_error_func(task, error);
+  }
+  g_object_unref_func(task);
 }
 
-static GdkClipboard* original_gdk_display_get_primary_clipboard(GdkDisplay* display) {
-  assert(gdk_display_get_primary_clipboard_func != nullptr);
-  return gdk_display_get_primary_clipboard_func(display);
+// GIO grows the buffer to powers of two (of at least 16 bytes), so contents
+// within the limit can still ask for up to twice as much; what actually got
+// written is checked once it's all there. Failing to grow it, here or in
+// realloc(), fails the write with G_IO_ERROR_NO_SPACE.
+static gpointer limited_write_realloc(gpointer data, gsize size) {
+  size_t capacity = 16;
+  while (capacity < primary_limit() && capacity <= SIZE_MAX / 2) {
+    capacity <<= 1;
+  }
+
+  if (size > capacity) {
+    return nullptr;
+  }
+  return realloc(data, size);
+}
+
+static void limited_write_buffered(GObject* source, GAsyncResult* result, gpointer data) {
+  auto task = (GTask*)data;
+  auto write = (limited_write_t*)g_task_get_task_data_func(task);
+
+  GError* error = nullptr;
+  if (!gdk_content_provider_write_mime_type_finish_func((GdkContentProvider*)source, result, &error)) {
+    if (error != nullptr && error->domain == g_io_error_quark_func() && error->code == G_IO_ERROR_NO_SPACE) {
+      g_error_free_func(error);
+      error = nullptr;
+      set_too_large_error(&error);
+    }
+    g_task_return_error_func(task, error);
+    g_object_unref_func(task);
+    return;
+  }
+
+  auto buffer = (GMemoryOutputStream*)write->buffer;
+  if (!primary_fits(g_memory_output_stream_get_data_size_func(buffer))) {
+    set_too_large_error(&error);
+    g_task_return_error_func(task, error);
+    g_object_unref_func(task);
+    return;
+  }
+
+  g_output_stream_write_all_async_func(
+    write->stream,
+    g_memory_output_stream_get_data_func(buffer),
+    g_memory_output_stream_get_data_size_func(buffer),
+    write->io_priority,
+    g_task_get_cancellable_func(task),
+    limited_write_done,
+    task
+  );
 }
 
-static fhh_hook_state_t gdk_clipboard_read_async_hook_state = {};
+static void limited_provider_write_mime_type_async(
+  GdkContentProvider* provider,
+  char const* mime_type,
+  GOutputStream* stream,
+  int io_priority,
+  GCancellable* cancellable,
+  GAsyncReadyCallback callback,
+  gpointer user_data
+) {
+  auto task = g_task_new_func(provider, cancellable, callback, user_data);
+  g_task_set_source_tag_func(task, limited_provider_write_mime_type_async);
+
+  auto write = (limited_write_t*)malloc(sizeof(limited_write_t));
+  if (write == nullptr) {
+    g_task_return_new_error_func(task, g_io_error_quark_func(), G_IO_ERROR_FAILED, "Out of memory");
+    g_object_unref_func(task);
+    return;
+  }
+
+  *write = (limited_write_t){
+    .stream = g_object_ref_func(stream),
+    .buffer = g_memory_output_stream_new_func(nullptr, 0, limited_write_realloc, free),
+    .io_priority = io_priority,
+  };
+  g_task_set_task_data_func(task, write, free_limited_write);
+
+  gdk_content_provider_write_mime_type_async_func(
+    ((limited_provider_t*)provider)->content,
+    mime_type,
+    write->buffer,
+    io_priority,
+    cancellable,
+    limited_write_buffered,
+    task
+  );
+}
+
+static gboolean limited_provider_write_mime_type_finish(
+  GdkContentProvider*,
+  GAsyncResult* result,
+  GError** error
+) {
+  return g_task_propagate_boolean_func((GTask*)result, error);
+}
+
+static void limited_provider_class_init(gpointer g_class, gpointer) {
+  limited_provider_parent_class = g_type_class_peek_parent_func(g_class);
+
+  auto object_class = (GObjectClass*)g_class;
+  object_class->finalize = limited_provider_finalize;
+
+  auto provider_class = (GdkContentProviderClass*)g_class;
+  provider_class->attach_clipboard = limited_provider_attach_clipboard;
+  provider_class->detach_clipboard = limited_provider_detach_clipboard;
+  provider_class->ref_formats = limited_provider_ref_formats;
+  provider_class->ref_storable_formats = limited_provider_ref_storable_formats;
+  provider_class->write_mime_type_async = limited_provider_write_mime_type_async;
+  provider_class->write_mime_type_finish = limited_provider_write_mime_type_finish;
+  provider_class->get_value = limited_provider_get_value;
+}
+
+static void forward_content_changed(GdkContentProvider*, gpointer data) {
+  gdk_content_provider_content_changed_func(data);
+}
+
+static GdkContentProvider* new_limited_provider(GdkContentProvider* content) {
+  if (limited_provider_type == 0) {
+    limited_provider_type = g_type_register_static_simple_func(
+      gdk_content_provider_get_type_func(),
+      "GtkclipblockLimitedContentProvider",
+      sizeof(limited_provider_class_t),
+      limited_provider_class_init,
+      sizeof(limited_provider_t),
+      nullptr,
+      (GTypeFlags)0
+    );
+  }
+
+  auto self = (limited_provider_t*)g_object_new_func(limited_provider_type, nullptr);
+  self->content = g_object_ref_func(content);
+  self->content_changed_handler = g_signal_connect_data_func(
+    content,
+    "content-changed",
+    G_CALLBACK(forward_content_changed),
+    self,
+    nullptr,
+    (GConnectFlags)0
+  );
+  return &self->parent;
+}
+
+// Claims held back by the debounced and local primary modes (see primary.h).
+// The other setters all go through gdk_clipboard_set_content(), so that's the
+// only one whose claims get held back; the others pass.
+static gboolean gdk_clipboard_set_content_hook(
+  GdkClipboard* clipboard,
+  GdkContentProvider* provider
+);
+
+typedef struct {
+  primary_claim_t base;
+  // Holds a reference, unless nullptr.
+  GdkContentProvider* provider;
+} content_claim_t;
+
+static void commit_content_claim(primary_claim_t* base) {
+  auto claim = (content_claim_t*)base;
+  gdk_clipboard_set_content_hook(claim->base.clipboard, claim->provider);
+  if (claim->provider != nullptr) {
+    g_object_unref_func(claim->provider);
+  }
+  free(claim);
+}
+
+static void drop_content_claim(primary_claim_t* base, primary_claim_t const*) {
+  auto claim = (content_claim_t*)base;
+  if (claim->provider != nullptr) {
+    g_object_unref_func(claim->provider);
+  }
+  free(claim);
+}
+
+static bool defer_content(GdkClipboard* clipboard, GdkContentProvider* provider) {
+  auto claim = (content_claim_t*)malloc(sizeof(content_claim_t));
+  if (claim == nullptr) {
+    return false;
+  }
+
+  *claim = (content_claim_t){
+    .base = {
+      .commit = commit_content_claim,
+      .drop = drop_content_claim,
+      .function = STATS_FUNCTION(GTK4, gdk_clipboard_set_content),
+      .clipboard = clipboard,
+    },
+    .provider = provider != nullptr ? g_object_ref_func(provider) : nullptr,
+  };
+
+  primary_defer(&claim->base);
+  return true;
+}
+
+// The provider of the claim pending or kept for the clipboard, if any.
+static GdkContentProvider* held_content(GdkClipboard* clipboard) {
+  auto claim = (content_claim_t*)primary_held(clipboard);
+  return claim != nullptr ? claim->provider : nullptr;
+}
+
+// Completes a read of the primary clipboard with PRIMARY_LOCAL; with nothing
+// kept, it fails like a blocked one.
+static void serve_kept_read(
+  GdkClipboard* clipboard,
+  gpointer source_tag,
+  GType type,
+  GCancellable* cancellable,
+  GAsyncReadyCallback callback,
+  gpointer user_data
+) {
+  queue_blocked_op(
+    clipboard,
+    source_tag,
+    false,
+    held_content(clipboard),
+    type,
+    cancellable,
+    callback,
+    user_data
+  );
+}
+
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_async);
 static void gdk_clipboard_read_async_hook(
   GdkClipboard* clipboard,
   char const** mime_types,
@@ -76,22 +755,33 @@ static void gdk_clipboard_read_async_hook(
   GAsyncReadyCallback callback,
   gpointer user_data
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_async);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_async);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
-      tls_data_set_clipboard(clipboard);
-      callback((GObject*)clipboard, nullptr, user_data);
-      tls_data_set_clipboard(nullptr);
-      return;
-    }
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_async);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_async);
+  auto probe_start = PROBE_START(hook);
+
+  auto primary = is_primary_clipboard(clipboard);
+  if (primary && (primary_mode() == PRIMARY_BLOCK || primary_mode() == PRIMARY_LOCAL)) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    complete_blocked_op(
+      clipboard,
+      gdk_clipboard_read_async_hook,
+      false,
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
+  }
+
+  // Whatever the process itself claimed last has to be there first.
+  if (primary) {
+    primary_flush();
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_read_async, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_async, STATS_PASSED, clipboard, 0, probe_start);
+
   func(
     clipboard,
     mime_types,
@@ -102,26 +792,29 @@ static void gdk_clipboard_read_async_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_read_finish_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_finish);
 static GInputStream* gdk_clipboard_read_finish_hook(
   GdkClipboard* clipboard,
   GAsyncResult* result,
   char const** out_mime_type,
   GError** error
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_finish);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_finish);
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_finish);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_finish);
+  auto probe_start = PROBE_START(hook);
 
-  if (tls_data_clipboard_matches(clipboard)) {
+  if (is_blocked_op_result(clipboard, result, gdk_clipboard_read_async_hook)) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_finish, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_finish, STATS_BLOCKED, clipboard, 0, probe_start);
     if (out_mime_type != nullptr) {
-      *out_mime_type = '\0';
-    }
-    if (error != nullptr) {
-      *error = nullptr;
+      *out_mime_type = nullptr;
     }
-    return nullptr;
+    return (GInputStream*)g_task_propagate_pointer_func((GTask*)result, error);
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_read_finish, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_finish, STATS_PASSED, clipboard, 0, probe_start);
+
   return func(
     clipboard,
     result,
@@ -130,7 +823,7 @@ static GInputStream* gdk_clipboard_read_finish_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_read_value_async_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_value_async);
 static void gdk_clipboard_read_value_async_hook(
   GdkClipboard* clipboard,
   GType type,
@@ -139,22 +832,47 @@ static void gdk_clipboard_read_value_async_hook(
   GAsyncReadyCallback callback,
   gpointer user_data
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_value_async);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_value_async);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
-      tls_data_set_clipboard(clipboard);
-      callback((GObject*)clipboard, nullptr, user_data);
-      tls_data_set_clipboard(nullptr);
-      return;
-    }
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_value_async);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_value_async);
+  auto probe_start = PROBE_START(hook);
+
+  auto primary = is_primary_clipboard(clipboard);
+  if (primary && primary_mode() == PRIMARY_LOCAL) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_value_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_value_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    serve_kept_read(
+      clipboard,
+      gdk_clipboard_read_value_async_hook,
+      type,
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
+  }
+
+  if (primary && primary_mode() == PRIMARY_BLOCK) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_value_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_value_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    complete_blocked_op(
+      clipboard,
+      gdk_clipboard_read_value_async_hook,
+      false,
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
   }
 
+  // Whatever the process itself claimed last has to be there first.
+  if (primary) {
+    primary_flush();
+  }
+
+  STATS_COUNT(GTK4, gdk_clipboard_read_value_async, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_value_async, STATS_PASSED, clipboard, 0, probe_start);
+
   func(
     clipboard,
     type,
@@ -165,22 +883,25 @@ static void gdk_clipboard_read_value_async_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_read_value_finish_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_value_finish);
 static GValue const* gdk_clipboard_read_value_finish_hook(
   GdkClipboard* clipboard,
   GAsyncResult* result,
   GError** error
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_value_finish);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_value_finish);
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_value_finish);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_value_finish);
+  auto probe_start = PROBE_START(hook);
 
-  if (tls_data_clipboard_matches(clipboard)) {
-    if (error != nullptr) {
-      *error = nullptr;
-    }
-    return nullptr;
+  if (is_blocked_op_result(clipboard, result, gdk_clipboard_read_value_async_hook)) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_value_finish, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_value_finish, STATS_BLOCKED, clipboard, 0, probe_start);
+    return (GValue const*)g_task_propagate_pointer_func((GTask*)result, error);
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_read_value_finish, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_value_finish, STATS_PASSED, clipboard, 0, probe_start);
+
   return func(
     clipboard,
     result,
@@ -188,29 +909,54 @@ static GValue const* gdk_clipboard_read_value_finish_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_read_text_async_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_text_async);
 static void gdk_clipboard_read_text_async_hook(
   GdkClipboard* clipboard,
   GCancellable* cancellable,
   GAsyncReadyCallback callback,
   gpointer user_data
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_text_async);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_text_async);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
-      tls_data_set_clipboard(clipboard);
-      callback((GObject*)clipboard, nullptr, user_data);
-      tls_data_set_clipboard(nullptr);
-      return;
-    }
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_text_async);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_text_async);
+  auto probe_start = PROBE_START(hook);
+
+  auto primary = is_primary_clipboard(clipboard);
+  if (primary && primary_mode() == PRIMARY_LOCAL) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_text_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_text_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    serve_kept_read(
+      clipboard,
+      gdk_clipboard_read_text_async_hook,
+      G_TYPE_STRING,
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
+  }
+
+  if (primary && primary_mode() == PRIMARY_BLOCK) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_text_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_text_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    complete_blocked_op(
+      clipboard,
+      gdk_clipboard_read_text_async_hook,
+      false,
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
+  }
+
+  // Whatever the process itself claimed last has to be there first.
+  if (primary) {
+    primary_flush();
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_read_text_async, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_text_async, STATS_PASSED, clipboard, 0, probe_start);
+
   func(
     clipboard,
     cancellable,
@@ -219,52 +965,91 @@ static void gdk_clipboard_read_text_async_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_read_text_finish_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_text_finish);
 static char* gdk_clipboard_read_text_finish_hook(
   GdkClipboard* clipboard,
   GAsyncResult* result,
   GError** error
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_text_finish);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_text_finish);
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_text_finish);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_text_finish);
+  auto probe_start = PROBE_START(hook);
 
-  if (tls_data_clipboard_matches(clipboard)) {
-    if (error != nullptr) {
-      *error = nullptr;
-    }
-    return nullptr;
+  if (is_blocked_op_result(clipboard, result, gdk_clipboard_read_text_async_hook)) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_text_finish, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_text_finish, STATS_BLOCKED, clipboard, 0, probe_start);
+    return (char*)g_task_propagate_pointer_func((GTask*)result, error);
   }
 
-  return func(
+  STATS_COUNT(GTK4, gdk_clipboard_read_text_finish, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_text_finish, STATS_PASSED, clipboard, 0, probe_start);
+
+  auto text = func(
     clipboard,
     result,
     error
   );
+  if (
+    text != nullptr
+    && primary_mode() == PRIMARY_LIMIT
+    && is_primary_clipboard(clipboard)
+    && !primary_fits(strlen(text))
+  ) {
+    g_free_func(text);
+    set_too_large_error(error);
+    return nullptr;
+  }
+  return text;
 }
 
-static fhh_hook_state_t gdk_clipboard_read_texture_async_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_texture_async);
 static void gdk_clipboard_read_texture_async_hook(
   GdkClipboard* clipboard,
   GCancellable* cancellable,
   GAsyncReadyCallback callback,
   gpointer user_data
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_texture_async);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_texture_async);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
-      tls_data_set_clipboard(clipboard);
-      callback((GObject*)clipboard, nullptr, user_data);
-      tls_data_set_clipboard(nullptr);
-      return;
-    }
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_texture_async);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_texture_async);
+  auto probe_start = PROBE_START(hook);
+
+  auto primary = is_primary_clipboard(clipboard);
+  if (primary && primary_mode() == PRIMARY_LOCAL) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_texture_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_texture_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    serve_kept_read(
+      clipboard,
+      gdk_clipboard_read_texture_async_hook,
+      gdk_texture_get_type_func(),
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
+  }
+
+  if (primary && primary_mode() == PRIMARY_BLOCK) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_texture_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_texture_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    complete_blocked_op(
+      clipboard,
+      gdk_clipboard_read_texture_async_hook,
+      false,
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
   }
 
+  // Whatever the process itself claimed last has to be there first.
+  if (primary) {
+    primary_flush();
+  }
+
+  STATS_COUNT(GTK4, gdk_clipboard_read_texture_async, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_texture_async, STATS_PASSED, clipboard, 0, probe_start);
+
   func(
     clipboard,
     cancellable,
@@ -273,30 +1058,44 @@ static void gdk_clipboard_read_texture_async_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_read_texture_finish_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_read_texture_finish);
 static GdkTexture* gdk_clipboard_read_texture_finish_hook(
   GdkClipboard* clipboard,
   GAsyncResult* result,
   GError** error
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_texture_finish);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_read_texture_finish);
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_read_texture_finish);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_read_texture_finish);
+  auto probe_start = PROBE_START(hook);
 
-  if (tls_data_clipboard_matches(clipboard)) {
-    if (error != nullptr) {
-      *error = nullptr;
-    }
-    return nullptr;
+  if (is_blocked_op_result(clipboard, result, gdk_clipboard_read_texture_async_hook)) {
+    STATS_COUNT(GTK4, gdk_clipboard_read_texture_finish, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_read_texture_finish, STATS_BLOCKED, clipboard, 0, probe_start);
+    return (GdkTexture*)g_task_propagate_pointer_func((GTask*)result, error);
   }
 
-  return func(
+  STATS_COUNT(GTK4, gdk_clipboard_read_texture_finish, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_read_texture_finish, STATS_PASSED, clipboard, 0, probe_start);
+
+  auto texture = func(
     clipboard,
     result,
     error
   );
+  if (
+    texture != nullptr
+    && primary_mode() == PRIMARY_LIMIT
+    && is_primary_clipboard(clipboard)
+    && !primary_fits(texture_size(texture))
+  ) {
+    g_object_unref_func(texture);
+    set_too_large_error(error);
+    return nullptr;
+  }
+  return texture;
 }
 
-static fhh_hook_state_t gdk_clipboard_store_async_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_store_async);
 static void gdk_clipboard_store_async_hook(
   GdkClipboard* clipboard,
   int io_priority,
@@ -304,22 +1103,33 @@ static void gdk_clipboard_store_async_hook(
   GAsyncReadyCallback callback,
   gpointer user_data
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_store_async);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_store_async);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
-      tls_data_set_clipboard(clipboard);
-      callback((GObject*)clipboard, nullptr, user_data);
-      tls_data_set_clipboard(nullptr);
-      return;
-    }
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_store_async);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_store_async);
+  auto probe_start = PROBE_START(hook);
+
+  auto primary = is_primary_clipboard(clipboard);
+  if (primary && (primary_mode() == PRIMARY_BLOCK || primary_mode() == PRIMARY_LOCAL)) {
+    STATS_COUNT(GTK4, gdk_clipboard_store_async, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_store_async, STATS_BLOCKED, clipboard, 0, probe_start);
+    complete_blocked_op(
+      clipboard,
+      gdk_clipboard_store_async_hook,
+      true,
+      cancellable,
+      callback,
+      user_data
+    );
+    return;
+  }
+
+  // Whatever the process itself claimed last has to be there first.
+  if (primary) {
+    primary_flush();
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_store_async, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_store_async, STATS_PASSED, clipboard, 0, probe_start);
+
   func(
     clipboard,
     io_priority,
@@ -329,22 +1139,25 @@ static void gdk_clipboard_store_async_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_store_finish_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_store_finish);
 static gboolean gdk_clipboard_store_finish_hook(
   GdkClipboard* clipboard,
   GAsyncResult* result,
   GError** error
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_store_finish);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_store_finish);
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_store_finish);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_store_finish);
+  auto probe_start = PROBE_START(hook);
 
-  if (tls_data_clipboard_matches(clipboard)) {
-    if (error != nullptr) {
-      *error = nullptr;
-    }
-    return true;
+  if (is_blocked_op_result(clipboard, result, gdk_clipboard_store_async_hook)) {
+    STATS_COUNT(GTK4, gdk_clipboard_store_finish, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_store_finish, STATS_BLOCKED, clipboard, 0, probe_start);
+    return g_task_propagate_boolean_func((GTask*)result, error);
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_store_finish, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_store_finish, STATS_PASSED, clipboard, 0, probe_start);
+
   return func(
     clipboard,
     result,
@@ -352,152 +1165,201 @@ static gboolean gdk_clipboard_store_finish_hook(
   );
 }
 
-static fhh_hook_state_t gdk_clipboard_set_text_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_set_text);
 static void gdk_clipboard_set_text_hook(
   GdkClipboard* clipboard,
   char const* text
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_text);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_set_text);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_text);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_set_text);
+  auto probe_start = PROBE_START(hook);
+
+  if (!primary_defers() && is_primary_clipboard(clipboard)) {
+    if (primary_mode() == PRIMARY_BLOCK || !primary_fits(primary_text_size(text, -1))) {
+      STATS_COUNT(GTK4, gdk_clipboard_set_text, STATS_BLOCKED);
+      PROBE_HOOK(gdk_clipboard_set_text, STATS_BLOCKED, clipboard, primary_text_size(text, -1), probe_start);
       return;
     }
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_set_text, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_set_text, STATS_PASSED, clipboard, primary_text_size(text, -1), probe_start);
+
   func(clipboard, text);
 }
 
-static fhh_hook_state_t gdk_clipboard_set_texture_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_set_texture);
 static void gdk_clipboard_set_texture_hook(
   GdkClipboard* clipboard,
   GdkTexture* texture
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_texture);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_set_texture);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_texture);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_set_texture);
+  auto probe_start = PROBE_START(hook);
+
+  if (!primary_defers() && is_primary_clipboard(clipboard)) {
+    if (primary_mode() == PRIMARY_BLOCK || !primary_fits(texture_size(texture))) {
+      STATS_COUNT(GTK4, gdk_clipboard_set_texture, STATS_BLOCKED);
+      PROBE_HOOK(gdk_clipboard_set_texture, STATS_BLOCKED, clipboard, 0, probe_start);
       return;
     }
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_set_texture, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_set_texture, STATS_PASSED, clipboard, 0, probe_start);
+
   func(clipboard, texture);
 }
 
-static fhh_hook_state_t gdk_clipboard_set_value_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_set_value);
 static void gdk_clipboard_set_value_hook(
   GdkClipboard* clipboard,
   GValue const* value
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_value);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_set_value);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
-      return;
-    }
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_value);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_set_value);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK4, gdk_clipboard_set_value, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_set_value, STATS_BLOCKED, clipboard, 0, probe_start);
+    return;
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_set_value, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_set_value, STATS_PASSED, clipboard, 0, probe_start);
+
   func(clipboard, value);
 }
 
-static fhh_hook_state_t gdk_clipboard_set_content_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_get_content);
+static GdkContentProvider* gdk_clipboard_get_content_hook(GdkClipboard* clipboard) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_get_content);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_get_content);
+  auto probe_start = PROBE_START(hook);
+
+  // What the clipboard would have if the claims held back had been made.
+  if (primary_defers() && is_primary_clipboard(clipboard)) {
+    auto claim = primary_held(clipboard);
+    if (claim != nullptr || primary_mode() == PRIMARY_LOCAL) {
+      STATS_COUNT(GTK4, gdk_clipboard_get_content, STATS_BLOCKED);
+      PROBE_HOOK(gdk_clipboard_get_content, STATS_BLOCKED, clipboard, 0, probe_start);
+      return claim != nullptr ? ((content_claim_t*)claim)->provider : nullptr;
+    }
+  }
+
+  STATS_COUNT(GTK4, gdk_clipboard_get_content, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_get_content, STATS_PASSED, clipboard, 0, probe_start);
+
+  auto content = func(clipboard);
+  if (is_limited_provider(content)) {
+    return ((limited_provider_t*)content)->content;
+  }
+  return content;
+}
+
+HB_DECLARE_ORIGINAL(gdk_clipboard_set_content);
 static gboolean gdk_clipboard_set_content_hook(
   GdkClipboard* clipboard,
   GdkContentProvider* provider
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_content);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_set_content);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_content);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_set_content);
+  auto probe_start = PROBE_START(hook);
+
+  if (!primary_is_committing() && is_primary_clipboard(clipboard)) {
+    if (primary_defers() && defer_content(clipboard, provider)) {
       return true;
     }
+
+    if (primary_mode() == PRIMARY_LIMIT) {
+      STATS_COUNT(GTK4, gdk_clipboard_set_content, STATS_PASSED);
+      PROBE_HOOK(gdk_clipboard_set_content, STATS_PASSED, clipboard, 0, probe_start);
+
+      if (provider == nullptr) {
+        return func(clipboard, nullptr);
+      }
+
+      // Setting the same provider again gets it the same wrapper, which GDK
+      // then sees as the contents not having changed.
+      auto current = HB_GET_ORIGINAL_FUNC(gdk_clipboard_get_content)(clipboard);
+      auto limited = is_limited_provider(current) && ((limited_provider_t*)current)->content == provider
+        ? (GdkContentProvider*)g_object_ref_func(current)
+        : new_limited_provider(provider);
+      auto set = func(clipboard, limited);
+      g_object_unref_func(limited);
+      return set;
+    }
+
+    STATS_COUNT(GTK4, gdk_clipboard_set_content, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_set_content, STATS_BLOCKED, clipboard, 0, probe_start);
+    return true;
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_set_content, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_set_content, STATS_PASSED, clipboard, 0, probe_start);
+
   return func(clipboard, provider);
 }
 
-static fhh_hook_state_t gdk_clipboard_set_valist_hook_state = {};
+HB_DECLARE_ORIGINAL(gdk_clipboard_set_valist);
 static void gdk_clipboard_set_valist_hook(
   GdkClipboard* clipboard,
   GType type,
   va_list args
 ) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_valist);
-  auto func = FHH_GET_ORIGINAL_FUNC(gdk_clipboard_set_valist);
-
-  if (clipboard != nullptr) {
-    auto display = original_gdk_clipboard_get_display(clipboard);
-    if (
-      display != nullptr
-      && original_gdk_display_get_primary_clipboard(display) == clipboard
-    ) {
-      return;
-    }
+  HB_ASSERT_HOOK_SIG_MATCHES(gdk_clipboard_set_valist);
+  auto func = HB_GET_ORIGINAL_FUNC(gdk_clipboard_set_valist);
+  auto probe_start = PROBE_START(hook);
+
+  if (primary_mode() == PRIMARY_BLOCK && is_primary_clipboard(clipboard)) {
+    STATS_COUNT(GTK4, gdk_clipboard_set_valist, STATS_BLOCKED);
+    PROBE_HOOK(gdk_clipboard_set_valist, STATS_BLOCKED, clipboard, 0, probe_start);
+    return;
   }
 
+  STATS_COUNT(GTK4, gdk_clipboard_set_valist, STATS_PASSED);
+  PROBE_HOOK(gdk_clipboard_set_valist, STATS_PASSED, clipboard, 0, probe_start);
+
   func(clipboard, type, args);
 }
 
-void hook_gtk4_install_hooks(void* dl_handle) {
-  bool installed = false;
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_async);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_finish);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_value_async);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_value_finish);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_text_async);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_text_finish);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_texture_async);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_read_texture_finish);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_store_async);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_store_finish);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_set_text);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_set_value);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_set_texture);
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_set_content);
-  // XXX: gdk_clipboard_set calls _valist internally
-  installed |= FHH_INSTALL(dl_handle, gdk_clipboard_set_valist);
+static hookbatch_t hooks = {};
 
-  if (installed) {
-    initialize_helper_symbols(dl_handle);
-  }
+static hookbatch_entry_t const hook_entries[] = {
+  HOOK_GTK4_FUNCTIONS(HB_HOOK_LIST_ENTRY)
+};
+
+bool hook_gtk4_install_hooks(void* dl_handle, struct link_map const* map) {
+  elfsym_resolver_t resolver;
+  elfsym_resolver_init(&resolver, dl_handle, map);
+
+  // The hooks can get called as soon as they're in place.
+  initialize_helper_symbols(&resolver);
+  primary_attach(&resolver);
+  startup_trace_mark(STARTUP_TRACE_RESOLVE);
+
+  return hookbatch_install(
+    &hooks,
+    &resolver,
+    hook_entries,
+    sizeof(hook_entries) / sizeof(*hook_entries)
+  );
 }
 
 void hook_gtk4_uninstall_hooks() {
-  FHH_UNINSTALL(gdk_clipboard_read_async);
-  FHH_UNINSTALL(gdk_clipboard_read_finish);
-  FHH_UNINSTALL(gdk_clipboard_read_value_async);
-  FHH_UNINSTALL(gdk_clipboard_read_value_finish);
-  FHH_UNINSTALL(gdk_clipboard_read_text_async);
-  FHH_UNINSTALL(gdk_clipboard_read_text_finish);
-  FHH_UNINSTALL(gdk_clipboard_read_texture_async);
-  FHH_UNINSTALL(gdk_clipboard_read_texture_finish);
-  FHH_UNINSTALL(gdk_clipboard_store_async);
-  FHH_UNINSTALL(gdk_clipboard_store_finish);
-  FHH_UNINSTALL(gdk_clipboard_set_text);
-  FHH_UNINSTALL(gdk_clipboard_set_value);
-  FHH_UNINSTALL(gdk_clipboard_set_texture);
-  FHH_UNINSTALL(gdk_clipboard_set_content);
-  FHH_UNINSTALL(gdk_clipboard_set_valist);
+  hookbatch_uninstall(&hooks);
+  primary_detach();
   gdk_clipboard_get_display_func = nullptr;
   gdk_display_get_primary_clipboard_func = nullptr;
+  gdk_display_get_clipboard_func = nullptr;
+  g_object_weak_ref_func = nullptr;
+  // The GLib helpers stay resolved: blocked operations might still be queued,
+  // and GLib outlives GTK anyway. So do the ones limited providers use, since
+  // their type can't be unregistered.
+
+  // The hooks only get uninstalled once GTK is unmapped, displays included.
+  for (size_t i = 0; i < DISPLAY_CACHE_SIZE; i++) {
+    display_cache[i] = (display_cache_entry_t){};
+  }
 }
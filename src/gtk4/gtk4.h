@@ -1,7 +1,30 @@
 #ifndef GTKCLIPBLOCK_GTK4_H
 #define GTKCLIPBLOCK_GTK4_H
 
-void hook_gtk4_install_hooks(void* dl_handle);
+// The functions that get hooked, as an X macro.
+// XXX: gdk_clipboard_set calls gdk_clipboard_set_valist internally
+#define HOOK_GTK4_FUNCTIONS(X) \
+  X(gdk_clipboard_read_async) \
+  X(gdk_clipboard_read_finish) \
+  X(gdk_clipboard_read_value_async) \
+  X(gdk_clipboard_read_value_finish) \
+  X(gdk_clipboard_read_text_async) \
+  X(gdk_clipboard_read_text_finish) \
+  X(gdk_clipboard_read_texture_async) \
+  X(gdk_clipboard_read_texture_finish) \
+  X(gdk_clipboard_store_async) \
+  X(gdk_clipboard_store_finish) \
+  X(gdk_clipboard_set_text) \
+  X(gdk_clipboard_set_value) \
+  X(gdk_clipboard_set_texture) \
+  X(gdk_clipboard_set_content) \
+  X(gdk_clipboard_get_content) \
+  X(gdk_clipboard_set_valist)
+
+struct link_map;
+
+// Returns whether any hook got installed.
+bool hook_gtk4_install_hooks(void* dl_handle, struct link_map const* map);
 void hook_gtk4_uninstall_hooks();
 
 #endif
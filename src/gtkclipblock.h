@@ -0,0 +1,22 @@
+#ifndef GTKCLIPBLOCK_H
+#define GTKCLIPBLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Whether the library is currently hooking dlopen()/dlclose() to catch GTK
+// being loaded. The hooks remove themselves once there's nothing left to
+// catch (see GTKCLIPBLOCK_PIN).
+//
+// Since the library is usually preloaded, look this up at runtime:
+//   dlsym(RTLD_DEFAULT, "gtkclipblock_loader_hooks_active")
+bool gtkclipblock_loader_hooks_active(void);
+
+// How many text pages the hooks have written to (GTK's, and libc's for the
+// dlopen()/dlclose() hooks), i.e. how many pages of code this process no
+// longer shares with the others. Patched pages stay that way after the hooks
+// get removed. With GTKCLIPBLOCK_HOOK_MODE=
+// interpose, only the functions GTK calls internally get patched.
+size_t gtkclipblock_dirtied_text_pages(void);
+
+#endif
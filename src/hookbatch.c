@@ -0,0 +1,566 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include "prologuecache.h"
+#include "hookbatch.h"
+#include "startuptrace.h"
+
+#if defined(GTKCLIPBLOCK_BUILTIN_DECODER)
+#include "prologue.h"
+#else
+#include <funchook.h>
+#include <distorm.h>
+#endif
+
+// Where the trampolines work, the prologues get measured here (by the
+// builtin decoder or distorm) and every batch goes through them; funchook
+// only does the patching elsewhere.
+#if defined(GTKCLIPBLOCK_BUILTIN_DECODER) || defined(__x86_64__)
+#define MEASURE_PROLOGUES
+#endif
+
+#if defined(GTKCLIPBLOCK_INTERPOSE)
+#include "interpose.h"
+#endif
+
+#define HOOKBATCH_MAX_ENTRIES TRAMPOLINE_MAX_PATCHES
+
+static_assert(HOOKBATCH_MAX_ENTRIES <= 32, "interposed entries are kept in a 32-bit mask");
+
+static bool interpose = false;
+
+static _Atomic size_t dirtied_text_pages = 0;
+
+void hookbatch_set_interpose(bool enabled) {
+  interpose = enabled;
+}
+
+size_t hookbatch_dirtied_text_pages() {
+  return atomic_load_explicit(&dirtied_text_pages, memory_order_relaxed);
+}
+
+// Every page a patch lands on becomes a private copy for good, even once the
+// original bytes are restored.
+static void count_dirtied_pages(void* const* targets, size_t n_targets) {
+  auto page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
+  uintptr_t pages[2 * HOOKBATCH_MAX_ENTRIES];
+  size_t n_pages = 0;
+
+  for (size_t i = 0; i < n_targets; i++) {
+    if (targets[i] == nullptr) {
+      continue;
+    }
+
+    auto first = (uintptr_t)targets[i] & ~(page_size - 1);
+    auto last = ((uintptr_t)targets[i] + TRAMPOLINE_PATCH_SIZE - 1) & ~(page_size - 1);
+    for (auto page = first; page <= last; page += page_size) {
+      size_t j = 0;
+      while (j < n_pages && pages[j] != page) {
+        j++;
+      }
+      if (j == n_pages) {
+        pages[n_pages++] = page;
+      }
+    }
+  }
+
+  atomic_fetch_add_explicit(&dirtied_text_pages, n_pages, memory_order_relaxed);
+}
+
+#if defined(GTKCLIPBLOCK_INTERPOSE)
+
+// Picks the entries that go through the exported interposers (see
+// interpose.h) instead of being patched, and resolves GTK's definitions for
+// them. That has to bypass dlsym(), which would find the interposers.
+static uint32_t select_interposed(
+  elfsym_resolver_t const* resolver,
+  hookbatch_entry_t const* entries,
+  size_t n_entries,
+  void** originals
+) {
+  if (!interpose || !resolver->has_table) {
+    return 0;
+  }
+
+  uint32_t interposed = 0;
+  for (size_t i = 0; i < n_entries; i++) {
+    if (interpose_supports(entries[i].name)) {
+      originals[i] = elfsym_resolve_own(resolver, entries[i].name);
+      interposed |= (originals[i] != nullptr ? 1u : 0u) << i;
+    }
+  }
+  return interposed;
+}
+
+static void set_interposer_hooks(hookbatch_t const* batch, bool installed) {
+  for (size_t i = 0; i < batch->n_entries; i++) {
+    if ((batch->interposed & (1u << i)) != 0) {
+      interpose_set_hook(batch->entries[i].name, installed ? batch->entries[i].hook : nullptr);
+    }
+  }
+}
+
+#else
+
+static uint32_t select_interposed(
+  elfsym_resolver_t const*,
+  hookbatch_entry_t const*,
+  size_t,
+  void**
+) {
+  return 0;
+}
+
+static void set_interposer_hooks(hookbatch_t const*, bool) {}
+
+#endif
+
+// Every entry has to be in the cache, and every prologue has to still look
+// the same; otherwise the whole batch goes through funchook.
+static trampoline_set_t* prepare_from_cache(
+  elfsym_resolver_t const* resolver,
+  hookbatch_entry_t const* entries,
+  size_t n_entries,
+  uint32_t interposed,
+  void** targets,
+  void** originals
+) {
+  if (resolver->map == nullptr) {
+    return nullptr;
+  }
+
+  prologue_cache_t cache;
+  if (!prologue_cache_open(&cache)) {
+    return nullptr;
+  }
+
+  prologue_cache_object_t object;
+  prologue_cache_library_t const* library = nullptr;
+  if (prologue_cache_object_init(&object, resolver->map)) {
+    library = prologue_cache_find_library(&cache, &object);
+  }
+
+  prologue_cache_entry_t const* cached[HOOKBATCH_MAX_ENTRIES] = {};
+  void* near = nullptr;
+  bool ok = library != nullptr;
+
+  for (size_t i = 0; i < n_entries && ok; i++) {
+    if ((interposed & (1u << i)) != 0) {
+      continue;
+    }
+
+    cached[i] = prologue_cache_find_entry(&cache, library, entries[i].name);
+    if (cached[i] == nullptr) {
+      ok = false;
+    } else if (cached[i]->offset != 0) {
+      targets[i] = prologue_cache_validate(&object, cached[i]);
+      ok = targets[i] != nullptr;
+      near = targets[i];
+    }
+  }
+
+  trampoline_set_t* trampolines = nullptr;
+  if (ok && near != nullptr) {
+    trampolines = trampoline_set_create(near);
+  }
+
+  for (size_t i = 0; i < n_entries && trampolines != nullptr; i++) {
+    if (targets[i] == nullptr) {
+      continue;
+    }
+
+    originals[i] = trampoline_set_prepare(
+      trampolines,
+      targets[i],
+      cached[i]->prologue,
+      cached[i]->prologue_size,
+      nullptr,
+      0,
+      entries[i].hook
+    );
+    if (originals[i] == nullptr) {
+      trampoline_set_destroy(trampolines);
+      trampolines = nullptr;
+    }
+  }
+
+  prologue_cache_close(&cache);
+  return trampolines;
+}
+
+#if defined(MEASURE_PROLOGUES)
+
+#if !defined(GTKCLIPBLOCK_BUILTIN_DECODER)
+
+#define MAX_DECODED_INSTRUCTIONS 64
+
+// distorm doesn't say where an instruction's displacement is; on x86-64 it
+// can only be followed by an immediate, so try each immediate size and give
+// up unless exactly one of them lines up.
+static bool find_displacement(uint8_t const* code, _DInst const* insn, uint8_t* offset) {
+  bool has_immediate = false;
+  for (size_t i = 0; i < OPERANDS_NO && insn->ops[i].type != O_NONE; i++) {
+    has_immediate |= insn->ops[i].type == O_IMM;
+  }
+
+  static size_t const immediate_sizes[] = {1, 2, 4};
+  auto disp = (uint32_t)insn->disp;
+  size_t n_found = 0;
+  for (size_t i = 0; i < (has_immediate ? 3 : 1); i++) {
+    auto size = has_immediate ? immediate_sizes[i] : 0;
+    if (insn->size < 4 + size) {
+      continue;
+    }
+
+    auto candidate = (size_t)insn->addr + insn->size - 4 - size;
+    uint32_t value;
+    memcpy(&value, code + candidate, sizeof(value));
+    if (value == disp) {
+      *offset = (uint8_t)candidate;
+      n_found++;
+    }
+  }
+
+  return n_found == 1;
+}
+
+static bool branches_into(_DInst const* insn, size_t prologue_size) {
+  for (size_t i = 0; i < OPERANDS_NO && insn->ops[i].type != O_NONE; i++) {
+    if (insn->ops[i].type == O_PC) {
+      auto target = INSTRUCTION_GET_TARGET(insn);
+      return target > 0 && target < prologue_size;
+    }
+  }
+  return false;
+}
+
+// Same contract as the builtin decoder's prologue_measure() (see prologue.h).
+static size_t prologue_measure(
+  uint8_t const* code,
+  size_t size,
+  size_t min_size,
+  size_t max_size,
+  trampoline_relocation_t* relocations,
+  size_t* n_relocations
+) {
+  _CodeInfo ci = {
+    .codeOffset = 0,
+    .code = code,
+    .codeLen = (int)size,
+    .dt = Decode64Bits,
+    .features = DF_NONE,
+  };
+
+  size_t prologue_size = 0;
+  size_t offset = 0;
+  *n_relocations = 0;
+  _DInst insns[MAX_DECODED_INSTRUCTIONS];
+
+  while (ci.codeLen > 0) {
+    unsigned int count = 0;
+    auto result = distorm_decompose(&ci, insns, MAX_DECODED_INSTRUCTIONS, &count);
+    if (result == DECRES_INPUTERR || count == 0) {
+      return prologue_size;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+      auto insn = &insns[i];
+      if (insn->flags == FLAG_NOT_DECODABLE) {
+        // Past the prologue, only as much of the function as distorm can
+        // follow gets checked.
+        return prologue_size;
+      }
+
+      auto end = offset + insn->size;
+
+      if (prologue_size == 0) {
+        auto fc = META_GET_FC(insn->meta);
+        if ((fc != FC_NONE && fc != FC_CMOV) || end > max_size) {
+          return 0;
+        }
+
+        if ((insn->flags & FLAG_RIP_RELATIVE) != 0) {
+          uint8_t disp_offset;
+          if (
+            *n_relocations == TRAMPOLINE_MAX_RELOCATIONS
+            || !find_displacement(code, insn, &disp_offset)
+          ) {
+            return 0;
+          }
+          relocations[(*n_relocations)++] = (trampoline_relocation_t){
+            .offset = disp_offset,
+            .end = end,
+          };
+        }
+
+        if (end >= min_size) {
+          prologue_size = end;
+        }
+      } else if (branches_into(insn, prologue_size)) {
+        // Anything jumping back into the prologue would land in the middle
+        // of the patch.
+        return 0;
+      }
+
+      offset = end;
+    }
+
+    if (result == DECRES_SUCCESS) {
+      break;
+    }
+
+    ci.code = code + offset;
+    ci.codeLen = (int)(size - offset);
+    ci.codeOffset = offset;
+  }
+
+  return prologue_size;
+}
+
+#endif
+
+// Functions bigger than this only get their beginning checked for branches
+// back into the prologue.
+#define MAX_SCANNED_SIZE (64 * 1024)
+
+static size_t function_size(
+  elfsym_resolver_t const* resolver,
+  char const* name,
+  void* target
+) {
+  ElfW(Sym) const* sym = nullptr;
+  if (resolver->has_table) {
+    sym = elfsym_table_find(&resolver->table, name);
+  } else {
+    Dl_info info;
+    if (dladdr1(target, &info, (void**)&sym, RTLD_DL_SYMENT) == 0 || info.dli_saddr != target) {
+      sym = nullptr;
+    }
+  }
+
+  if (sym == nullptr) {
+    return 0;
+  }
+  return sym->st_size < MAX_SCANNED_SIZE ? sym->st_size : MAX_SCANNED_SIZE;
+}
+
+// Same as the prologue cache, except that the prologues get measured here.
+static trampoline_set_t* prepare_decoded(
+  elfsym_resolver_t const* resolver,
+  hookbatch_entry_t const* entries,
+  size_t n_entries,
+  void* const* targets,
+  void** originals
+) {
+  void* near = nullptr;
+  size_t prologue_sizes[HOOKBATCH_MAX_ENTRIES] = {};
+  trampoline_relocation_t relocations[HOOKBATCH_MAX_ENTRIES][TRAMPOLINE_MAX_RELOCATIONS];
+  size_t n_relocations[HOOKBATCH_MAX_ENTRIES] = {};
+
+  for (size_t i = 0; i < n_entries; i++) {
+    if (targets[i] == nullptr) {
+      continue;
+    }
+
+    prologue_sizes[i] = prologue_measure(
+      targets[i],
+      function_size(resolver, entries[i].name, targets[i]),
+      TRAMPOLINE_PATCH_SIZE,
+      TRAMPOLINE_MAX_PROLOGUE_SIZE,
+      relocations[i],
+      &n_relocations[i]
+    );
+    if (prologue_sizes[i] == 0) {
+      return nullptr;
+    }
+    near = targets[i];
+  }
+
+  auto trampolines = trampoline_set_create(near);
+  for (size_t i = 0; i < n_entries && trampolines != nullptr; i++) {
+    if (targets[i] == nullptr) {
+      continue;
+    }
+
+    originals[i] = trampoline_set_prepare(
+      trampolines,
+      targets[i],
+      targets[i],
+      prologue_sizes[i],
+      relocations[i],
+      n_relocations[i],
+      entries[i].hook
+    );
+    if (originals[i] == nullptr) {
+      trampoline_set_destroy(trampolines);
+      trampolines = nullptr;
+    }
+  }
+
+  return trampolines;
+}
+
+#else
+
+static funchook_t* prepare_funchook(
+  hookbatch_entry_t const* entries,
+  size_t n_entries,
+  void* const* targets,
+  void** originals
+) {
+  auto funchook = funchook_create();
+  if (funchook == nullptr) {
+    return nullptr;
+  }
+
+  // funchook_prepare() replaces each target with its trampoline; the hooks
+  // only get to see them once everything is in place.
+  for (size_t i = 0; i < n_entries; i++) {
+    auto target = targets[i];
+    if (target == nullptr) {
+      continue;
+    }
+
+    if (funchook_prepare(funchook, &target, entries[i].hook) != FUNCHOOK_ERROR_SUCCESS) {
+      // Nothing has been patched yet.
+      funchook_destroy(funchook);
+      return nullptr;
+    }
+
+    originals[i] = target;
+  }
+
+  return funchook;
+}
+
+#endif
+
+bool hookbatch_install(
+  hookbatch_t* batch,
+  elfsym_resolver_t const* resolver,
+  hookbatch_entry_t const* entries,
+  size_t n_entries
+) {
+  assert(batch->funchook == nullptr && batch->trampolines == nullptr);
+  assert(n_entries <= HOOKBATCH_MAX_ENTRIES);
+
+  void* targets[HOOKBATCH_MAX_ENTRIES] = {};
+  void* originals[HOOKBATCH_MAX_ENTRIES] = {};
+
+  auto interposed = select_interposed(resolver, entries, n_entries, originals);
+
+  struct funchook* funchook = nullptr;
+  auto trampolines = prepare_from_cache(resolver, entries, n_entries, interposed, targets, originals);
+  startup_trace_mark(STARTUP_TRACE_RESOLVE);
+  if (trampolines == nullptr) {
+    // Resolve the whole set up front, so that nothing gets allocated for a
+    // library that doesn't have any of the functions.
+    size_t n_targets = 0;
+
+    for (size_t i = 0; i < n_entries; i++) {
+      if ((interposed & (1u << i)) == 0) {
+        targets[i] = elfsym_resolve_own(resolver, entries[i].name);
+        originals[i] = targets[i];
+        n_targets += targets[i] != nullptr;
+      }
+    }
+
+    startup_trace_mark(STARTUP_TRACE_RESOLVE);
+    if (n_targets == 0 && interposed == 0) {
+      return false;
+    }
+
+    if (n_targets > 0) {
+#if defined(MEASURE_PROLOGUES)
+      trampolines = prepare_decoded(resolver, entries, n_entries, targets, originals);
+#else
+      funchook = prepare_funchook(entries, n_entries, targets, originals);
+#endif
+      startup_trace_mark(STARTUP_TRACE_DECODE);
+      if (trampolines == nullptr && funchook == nullptr) {
+        return false;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < n_entries; i++) {
+    *entries[i].original = originals[i];
+  }
+
+  *batch = (hookbatch_t){
+    .funchook = funchook,
+    .trampolines = trampolines,
+    .entries = entries,
+    .n_entries = n_entries,
+    .interposed = interposed,
+  };
+
+  set_interposer_hooks(batch, true);
+  if (trampolines == nullptr && funchook == nullptr) {
+    return true;
+  }
+
+#if !defined(MEASURE_PROLOGUES)
+  if (funchook != nullptr) {
+    // Some of the functions might have been patched by the time funchook
+    // fails, so its trampolines have to stay around regardless.
+    count_dirtied_pages(targets, n_entries);
+    auto installed = funchook_install(funchook, 0) == FUNCHOOK_ERROR_SUCCESS;
+    startup_trace_mark(STARTUP_TRACE_PATCH);
+    return installed;
+  }
+#endif
+
+  // This only fails if the text pages can't be made writable, in which case
+  // nothing got patched and it can all go.
+  auto installed = trampoline_set_install(trampolines);
+  startup_trace_mark(STARTUP_TRACE_PATCH);
+  if (!installed) {
+    set_interposer_hooks(batch, false);
+    trampoline_set_destroy(trampolines);
+    for (size_t i = 0; i < n_entries; i++) {
+      *entries[i].original = nullptr;
+    }
+    *batch = (hookbatch_t){};
+    return false;
+  }
+
+  count_dirtied_pages(targets, n_entries);
+  return true;
+}
+
+bool hookbatch_uninstall(hookbatch_t* batch) {
+  // The interposers stop calling the hooks first, so that nothing can be on
+  // its way into a trampoline that's about to go away.
+  set_interposer_hooks(batch, false);
+
+  // If the install failed halfway, funchook won't undo it; leak the
+  // trampolines rather than pulling them out from under the patched code.
+  if (batch->trampolines != nullptr) {
+    if (!trampoline_set_uninstall(batch->trampolines)) {
+      *batch = (hookbatch_t){};
+      return false;
+    }
+    trampoline_set_destroy(batch->trampolines);
+  } else if (batch->funchook != nullptr) {
+#if !defined(MEASURE_PROLOGUES)
+    if (funchook_uninstall(batch->funchook, 0) != FUNCHOOK_ERROR_SUCCESS) {
+      *batch = (hookbatch_t){};
+      return false;
+    }
+    funchook_destroy(batch->funchook);
+#endif
+  } else if (batch->interposed == 0) {
+    return true;
+  }
+
+  for (size_t i = 0; i < batch->n_entries; i++) {
+    *batch->entries[i].original = nullptr;
+  }
+
+  *batch = (hookbatch_t){};
+  return true;
+}
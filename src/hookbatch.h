@@ -0,0 +1,94 @@
+#ifndef GTKCLIPBLOCK_HOOKBATCH_H
+#define GTKCLIPBLOCK_HOOKBATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "elfsym.h"
+#include "trampoline.h"
+
+// Installs a set of hooks in one go: every hook is prepared first, and only
+// then are they patched in, each text page being made writable once. If any
+// of them can't be prepared (e.g. its prologue can't be relocated), or any
+// page can't be made writable, none of them get installed.
+//
+// The prologues come from the prologue cache if it has the library (see
+// prologuecache.h), and are measured otherwise, by distorm or, in builds with
+// -Ddecoder=builtin, by our own decoder (see prologue.h). Either way the
+// patching goes through our trampolines (see trampoline.h). Those are x86-64
+// only; elsewhere funchook does the patching, and it can fail with some of
+// the functions already patched.
+//
+// With hookbatch_set_interpose(true), the public functions the library
+// exports interposers for (see interpose.h) aren't patched at all; the
+// interposers get pointed at their hooks instead.
+//
+// Usage, for each hooked function `name`:
+//   HB_DECLARE_ORIGINAL(name);
+//   static ret_t name_hook(...) {
+//     HB_ASSERT_HOOK_SIG_MATCHES(name);
+//     auto func = HB_GET_ORIGINAL_FUNC(name);
+//     ...
+//   }
+// and HB_HOOK(name) in the batch's entry list (or HB_HOOK_LIST_ENTRY as the
+// argument of an X macro listing the functions).
+
+typedef struct {
+  char const* name;
+  void* hook;
+  void** original;
+} hookbatch_entry_t;
+
+struct funchook;
+
+typedef struct {
+  // Only where the trampolines don't work.
+  struct funchook* funchook;
+  trampoline_set_t* trampolines;
+  hookbatch_entry_t const* entries;
+  size_t n_entries;
+  // Bit i is set if entries[i] goes through its interposer.
+  uint32_t interposed;
+} hookbatch_t;
+
+#define HB_DECLARE_ORIGINAL(name) static typeof(&name) name##_original = nullptr
+
+#define HB_GET_ORIGINAL_FUNC(name) (name##_original)
+
+#define HB_ASSERT_HOOK_SIG_MATCHES(name) \
+  static_assert( \
+    __builtin_types_compatible_p(typeof(&name), typeof(&name##_hook)), \
+    "signature of " #name "_hook doesn't match " #name \
+  )
+
+#define HB_HOOK(func) \
+  { \
+    .name = #func, \
+    .hook = (void*)func##_hook, \
+    .original = (void**)&func##_original, \
+  }
+
+#define HB_HOOK_LIST_ENTRY(func) HB_HOOK(func),
+
+// The hooked functions are looked up among the library's own symbols; those it
+// doesn't define are skipped. Returns whether any hook got installed; only
+// funchook can fail with some of the functions patched anyway (see above).
+bool hookbatch_install(
+  hookbatch_t* batch,
+  elfsym_resolver_t const* resolver,
+  hookbatch_entry_t const* entries,
+  size_t n_entries
+);
+// Returns false if some of the functions couldn't be restored. They stay
+// patched, and their originals stay set for the hooks to call, but the batch
+// is forgotten either way.
+bool hookbatch_uninstall(hookbatch_t* batch);
+
+// Only has an effect in builds with the interposers; has to be called before
+// any batch gets installed.
+void hookbatch_set_interpose(bool enabled);
+
+// Number of distinct text pages written to by patches so far, across every
+// batch. Those pages stay private to the process even after uninstalling.
+size_t hookbatch_dirtied_text_pages();
+
+#endif
@@ -0,0 +1,86 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "interpose.h"
+
+// Only the ABI of GTK's types matters here. GTK 2 and 3 have the same names
+// and signatures for these; they can't both be loaded in a process anyway.
+#define INTERPOSED_FUNCTIONS(X) \
+  X(void, gtk_clipboard_set_text, (void* clipboard, char const* text, int len), (clipboard, text, len)) \
+  X(void, gtk_clipboard_set_image, (void* clipboard, void* pixbuf), (clipboard, pixbuf)) \
+  X(void, gtk_clipboard_set_can_store, (void* clipboard, void const* targets, int n_targets), (clipboard, targets, n_targets)) \
+  X(void, gtk_clipboard_store, (void* clipboard), (clipboard)) \
+  X(void, gdk_clipboard_set_text, (void* clipboard, char const* text), (clipboard, text)) \
+  X(void, gdk_clipboard_set_texture, (void* clipboard, void* texture), (clipboard, texture)) \
+  X(void, gdk_clipboard_store_async, (void* clipboard, int io_priority, void* cancellable, void (*callback)(), void* user_data), (clipboard, io_priority, cancellable, callback, user_data)) \
+  X(int, gdk_clipboard_store_finish, (void* clipboard, void* result, void** error), (clipboard, result, error))
+
+typedef struct {
+  char const* name;
+  void* _Atomic hook;
+  // GTK's definition, i.e. the next one in the lookup scope.
+  void* _Atomic next;
+} interposer_t;
+
+#define INTERPOSER_INDEX(ret, func, params, args) INTERPOSER_##func,
+enum {
+  INTERPOSED_FUNCTIONS(INTERPOSER_INDEX)
+  N_INTERPOSERS,
+};
+
+#define INTERPOSER_ENTRY(ret, func, params, args) [INTERPOSER_##func] = { .name = #func },
+static interposer_t interposers[N_INTERPOSERS] = {
+  INTERPOSED_FUNCTIONS(INTERPOSER_ENTRY)
+};
+
+static void* interposer_target(interposer_t* interposer) {
+  auto hook = atomic_load_explicit(&interposer->hook, memory_order_acquire);
+  if (hook != nullptr) {
+    return hook;
+  }
+
+  // Null if GTK isn't loaded (e.g. for a dlsym(RTLD_DEFAULT) probe that found
+  // ours); it might be by the next call.
+  auto next = atomic_load_explicit(&interposer->next, memory_order_relaxed);
+  if (next == nullptr) {
+    next = dlsym(RTLD_NEXT, interposer->name);
+    atomic_store_explicit(&interposer->next, next, memory_order_relaxed);
+  }
+  return next;
+}
+
+// Without GTK, there's nothing to do, and nothing to report success for.
+#define INTERPOSER_CALL_void(target, call) \
+  if (target != nullptr) { \
+    call; \
+  }
+#define INTERPOSER_CALL_int(target, call) return target != nullptr ? call : 0;
+
+#define INTERPOSER_DEFINITION(ret, func, params, args) \
+  __attribute__((visibility("default"))) ret func params { \
+    auto target = (ret (*) params)interposer_target(&interposers[INTERPOSER_##func]); \
+    INTERPOSER_CALL_##ret(target, target args) \
+  }
+
+INTERPOSED_FUNCTIONS(INTERPOSER_DEFINITION)
+
+static interposer_t* find_interposer(char const* name) {
+  for (size_t i = 0; i < N_INTERPOSERS; i++) {
+    if (strcmp(interposers[i].name, name) == 0) {
+      return &interposers[i];
+    }
+  }
+  return nullptr;
+}
+
+bool interpose_supports(char const* name) {
+  return find_interposer(name) != nullptr;
+}
+
+void interpose_set_hook(char const* name, void* hook) {
+  auto interposer = find_interposer(name);
+  assert(interposer != nullptr);
+  atomic_store_explicit(&interposer->hook, hook, memory_order_release);
+}
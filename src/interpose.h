@@ -0,0 +1,18 @@
+#ifndef GTKCLIPBLOCK_INTERPOSE_H
+#define GTKCLIPBLOCK_INTERPOSE_H
+
+// Exported definitions of some of GTK's public clipboard functions. When the
+// library is preloaded, they take precedence over GTK's own, so calls from
+// the program reach the hooks without GTK's code being patched (which would
+// give every process private copies of the patched text pages).
+//
+// They call the hook registered for the function if there is one, and GTK's
+// definition otherwise. GTK's calls to its own functions usually don't go
+// through them, so the functions GTK uses internally still get patched.
+//
+// Only built with -Dinterpose=enabled; the main library only.
+
+bool interpose_supports(char const* name);
+void interpose_set_hook(char const* name, void* hook);
+
+#endif
@@ -0,0 +1,215 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <string.h>
+#include <link.h>
+#include "linkmap.h"
+
+typedef struct {
+  linkmap_tracker_t* tracker;
+  size_t index;
+  size_t skip;
+  size_t base_objects;
+  unsigned long long adds;
+  unsigned long long subs;
+  unsigned int present;
+  bool has_counters;
+  bool unchanged;
+  bool rescan;
+} refresh_ctx_t;
+
+static char const* object_soname(struct dl_phdr_info const* info) {
+  ElfW(Dyn) const* dyn = nullptr;
+  for (size_t i = 0; i < info->dlpi_phnum; i++) {
+    if (info->dlpi_phdr[i].p_type == PT_DYNAMIC) {
+      dyn = (ElfW(Dyn) const*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+      break;
+    }
+  }
+
+  if (dyn == nullptr) {
+    return nullptr;
+  }
+
+  ElfW(Addr) strtab = 0;
+  ElfW(Xword) soname = 0;
+  bool has_soname = false;
+  for (; dyn->d_tag != DT_NULL; dyn++) {
+    if (dyn->d_tag == DT_STRTAB) {
+      strtab = dyn->d_un.d_ptr;
+    } else if (dyn->d_tag == DT_SONAME) {
+      soname = dyn->d_un.d_val;
+      has_soname = true;
+    }
+  }
+
+  if (strtab == 0 || !has_soname) {
+    return nullptr;
+  }
+
+  // glibc relocates the dynamic section in place on most architectures, but
+  // not all of them do.
+  if (strtab < info->dlpi_addr) {
+    strtab += info->dlpi_addr;
+  }
+
+  return (char const*)strtab + soname;
+}
+
+static unsigned int match_object(
+  linkmap_tracker_t const* tracker,
+  struct dl_phdr_info const* info
+) {
+  if (info->dlpi_name == nullptr || info->dlpi_name[0] == '\0') {
+    return 0;
+  }
+
+  char const* filename = strrchr(info->dlpi_name, '/');
+  filename = filename != nullptr ? filename + 1 : info->dlpi_name;
+
+  for (size_t i = 0; i < tracker->n_sonames; i++) {
+    if (strcmp(filename, tracker->sonames[i]) == 0) {
+      return 1u << i;
+    }
+  }
+
+  // The object might have been opened through a path that doesn't end with
+  // its soname (e.g. the unversioned dev symlink).
+  auto soname = object_soname(info);
+  if (soname == nullptr) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < tracker->n_sonames; i++) {
+    if (strcmp(soname, tracker->sonames[i]) == 0) {
+      return 1u << i;
+    }
+  }
+
+  return 0;
+}
+
+static int refresh_callback(struct dl_phdr_info* info, size_t size, void* data) {
+  auto ctx = (refresh_ctx_t*)data;
+  auto tracker = ctx->tracker;
+
+  if (ctx->index == 0) {
+    bool has_counters =
+      size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs);
+
+    if (
+      !ctx->rescan
+      && has_counters
+      && tracker->primed
+      && info->dlpi_adds == tracker->adds
+      && info->dlpi_subs == tracker->subs
+    ) {
+      ctx->unchanged = true;
+      return 1;
+    }
+
+    if (!ctx->rescan) {
+      // Objects only get appended to the link map, so unless something got
+      // unmapped we can skip the entries we've already seen.
+      ctx->rescan = !has_counters || !tracker->primed || info->dlpi_subs != tracker->subs;
+    }
+
+    // Like the result, the counters only get published once the scan is
+    // done, so that lock-free readers never see a partial update.
+    ctx->has_counters = has_counters;
+    if (has_counters) {
+      ctx->adds = info->dlpi_adds;
+      ctx->subs = info->dlpi_subs;
+    }
+
+    // We're under the loader's lock here, so the base namespace's list can't
+    // change while we walk it.
+    for (auto map = _r_debug.r_map; map != nullptr; map = map->l_next) {
+      ctx->base_objects++;
+    }
+
+    if (ctx->rescan) {
+      ctx->present = 0;
+      ctx->skip = 0;
+    } else {
+      ctx->present = tracker->present;
+      ctx->skip = tracker->n_objects;
+    }
+  }
+
+  if (ctx->index++ < ctx->skip) {
+    return 0;
+  }
+
+  ctx->present |= match_object(tracker, info);
+  return 0;
+}
+
+static int probe_callback(struct dl_phdr_info* info, size_t size, void* data) {
+  auto tracker = (linkmap_tracker_t const*)data;
+  bool has_counters =
+    size >= offsetof(struct dl_phdr_info, dlpi_subs) + sizeof(info->dlpi_subs);
+
+  // 1 if nothing changed since the last scan, 2 otherwise; the first entry
+  // is all we need either way.
+  return has_counters
+    && info->dlpi_adds == tracker->adds
+    && info->dlpi_subs == tracker->subs
+    ? 1
+    : 2;
+}
+
+unsigned int linkmap_tracker_watch(linkmap_tracker_t* tracker, char const* soname) {
+  assert(tracker->n_sonames < LINKMAP_MAX_WATCHES);
+  tracker->sonames[tracker->n_sonames] = soname;
+  tracker->primed = false;
+  return 1u << tracker->n_sonames++;
+}
+
+bool linkmap_tracker_refresh(linkmap_tracker_t* tracker) {
+  if (tracker->primed && dl_iterate_phdr(probe_callback, tracker) == 1) {
+    return false;
+  }
+
+  assert(pthread_mutex_lock(&tracker->mutex) == 0);
+
+  // Another thread might have gotten to the changes first.
+  refresh_ctx_t ctx = {
+    .tracker = tracker,
+  };
+  dl_iterate_phdr(refresh_callback, &ctx);
+
+  if (ctx.unchanged) {
+    assert(pthread_mutex_unlock(&tracker->mutex) == 0);
+    return false;
+  }
+
+  // dl_iterate_phdr() lists the base namespace first, then any others
+  // (dlmopen, LD_AUDIT), so an object loaded into the base namespace isn't
+  // appended to the tail of what we iterate once there's more than one.
+  // Only skip ahead when every entry is in the base namespace and the number
+  // of new ones adds up.
+  if (
+    !ctx.rescan
+    && (
+      ctx.index != ctx.base_objects
+      || ctx.index - tracker->n_objects != ctx.adds - tracker->adds
+    )
+  ) {
+    ctx = (refresh_ctx_t){
+      .tracker = tracker,
+      .rescan = true,
+    };
+    dl_iterate_phdr(refresh_callback, &ctx);
+  }
+
+  tracker->n_objects = ctx.index;
+  tracker->present = ctx.present;
+  if (ctx.has_counters) {
+    tracker->adds = ctx.adds;
+    tracker->subs = ctx.subs;
+  }
+  tracker->primed = true;
+
+  assert(pthread_mutex_unlock(&tracker->mutex) == 0);
+  return true;
+}
@@ -0,0 +1,45 @@
+#ifndef GTKCLIPBLOCK_LINKMAP_H
+#define GTKCLIPBLOCK_LINKMAP_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define LINKMAP_MAX_WATCHES 8
+
+// Tracks the presence of a small set of shared objects in the link map.
+//
+// The loader bumps its add/remove counters (dlpi_adds/dlpi_subs) every time
+// an object is mapped or unmapped, so a refresh with unchanged counters costs
+// a single comparison. When objects were only added, we only look at the new
+// entries at the tail of the link map; a full rescan happens after an object
+// got unmapped, or whenever objects live in more than one namespace.
+//
+// Refreshing is thread-safe: checking the counters doesn't take the
+// tracker's mutex (only dl_iterate_phdr()'s own lock in the loader), scanning
+// is serialized through it. Watches have to be set
+// up before the tracker is shared between threads.
+typedef struct {
+  pthread_mutex_t mutex;
+  char const* sonames[LINKMAP_MAX_WATCHES];
+  size_t n_sonames;
+  _Atomic unsigned long long adds;
+  _Atomic unsigned long long subs;
+  size_t n_objects;
+  _Atomic unsigned int present;
+  _Atomic bool primed;
+} linkmap_tracker_t;
+
+#define LINKMAP_TRACKER_INIT { .mutex = PTHREAD_MUTEX_INITIALIZER }
+
+unsigned int linkmap_tracker_watch(linkmap_tracker_t* tracker, char const* soname);
+bool linkmap_tracker_refresh(linkmap_tracker_t* tracker);
+
+static inline bool linkmap_tracker_is_present(
+  linkmap_tracker_t const* tracker,
+  unsigned int watch
+) {
+  return (tracker->present & watch) != 0;
+}
+
+#endif
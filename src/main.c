@@ -1,10 +1,25 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <assert.h>
 #include <dlfcn.h>
+#include <limits.h>
+#include <link.h>
 #include <pthread.h>
-#include <funchook-helper.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include "linkmap.h"
+#include "elfsym.h"
+#include "hookbatch.h"
+#include "stats.h"
+#include "primary.h"
+#include "probes.h"
+#include "startuptrace.h"
+#include "settings.h"
+#include "policy.h"
+#include "config.h"
+#include "gtkclipblock.h"
 
 #if defined(HOOK_GTK2)
 #include "gtk2.h"
@@ -18,88 +33,93 @@
 #include "gtk4.h"
 #endif
 
+typedef enum {
+  LIBRARY_UNLOADED,
+  LIBRARY_INSTALLING,
+  LIBRARY_HOOKED,
+  LIBRARY_UNINSTALLING,
+  // Nothing got hooked; the library is left alone from then on.
+  LIBRARY_FAILED,
+} library_state_t;
+
+// Only the thread that moves a library into INSTALLING or UNINSTALLING gets
+// to touch its hooks and its handle, until it moves it out of that state
+// again. Every other thread waits for the transition to complete.
 typedef struct {
   char const* const name;
-  void* dl_handle;
+  bool (*const install_hooks)(void* dl_handle, struct link_map const* map);
+  void (*const uninstall_hooks)();
+  _Atomic library_state_t state;
+  // Our own reference to the library, so that we get to know when it's about
+  // to be unloaded. Libraries from the initial link map are never unloaded
+  // and don't have one.
+  void* _Atomic dl_handle;
+  // Set once the library can't get unloaded anymore, either because it's
+  // part of the initial link map or because it's marked as NODELETE.
+  _Atomic bool pinned;
+  unsigned int watch;
   bool disabled;
 } library_t;
 
-static library_t library_gtk2 = {
-  .name = "libgtk-x11-2.0.so.0",
+static library_t libraries[] = {
+  {
+    .name = "libgtk-x11-2.0.so.0",
+#if defined(HOOK_GTK2)
+    .install_hooks = hook_gtk2_install_hooks,
+    .uninstall_hooks = hook_gtk2_uninstall_hooks,
+#endif
+  },
+  {
+    .name = "libgtk-3.so.0",
+#if defined(HOOK_GTK3)
+    .install_hooks = hook_gtk3_install_hooks,
+    .uninstall_hooks = hook_gtk3_uninstall_hooks,
+#endif
+  },
+  {
+    .name = "libgtk-4.so.1",
+#if defined(HOOK_GTK4)
+    .install_hooks = hook_gtk4_install_hooks,
+    .uninstall_hooks = hook_gtk4_uninstall_hooks,
+#endif
+  },
 };
 
-static library_t library_gtk3 = {
-  .name = "libgtk-3.so.0",
-};
+#define N_LIBRARIES (sizeof(libraries) / sizeof(*libraries))
+
+static linkmap_tracker_t linkmap = LINKMAP_TRACKER_INIT;
 
-static library_t library_gtk4 = {
-  .name = "libgtk-4.so.1",
+static settings_t settings = {};
+
+// Libraries that GTK usually gets loaded alongside. With
+// GTKCLIPBLOCK_HOOK_DLFCN=auto, processes that don't have any of these in
+// their initial link map are assumed to never load GTK.
+static char const* const gtk_host_sonames[] = {
+  "libglib-2.0.so.0",
+  "libgmodule-2.0.so.0",
 };
 
-static bool hook_dlfcn_disabled = false;
-
-static pthread_mutex_t dlfcn_mutex = {};
-static pthread_mutexattr_t dlfcn_mutex_attr = {};
-
-static fhh_hook_state_t dlopen_hook_state = {};
-static fhh_hook_state_t dlclose_hook_state = {};
-
-static void load_settings() {
-  char* env;
-
-  library_gtk2.disabled = true;
-  library_gtk3.disabled = true;
-  library_gtk4.disabled = true;
-  hook_dlfcn_disabled = false;
-
-  env = getenv("GTKCLIPBLOCK_HOOK");
-  if (env != nullptr) {
-    if (strcmp(env, "") == 0 || strcmp(env, "0") == 0) {
-      // this is the default
-    } else if (strcmp(env, "1") == 0) {
-      library_gtk2.disabled = false;
-      library_gtk3.disabled = false;
-      library_gtk4.disabled = false;
-    } else {
-      library_gtk2.disabled = true;
-      library_gtk3.disabled = true;
-      library_gtk4.disabled = true;
-
-      env = strdup(env);
-      static char const* const delim = ",";
-      char* tok_rest = nullptr;
-      char* tok = strtok_r(env, delim, &tok_rest);
-      while (tok != nullptr) {
-        if (strcmp(tok, "gtk2") == 0) {
-          library_gtk2.disabled = false;
-        } else if (strcmp(tok, "gtk3") == 0) {
-          library_gtk3.disabled = false;
-        } else if (strcmp(tok, "gtk4") == 0) {
-          library_gtk4.disabled = false;
-        }
-
-        tok = strtok_r(nullptr, delim, &tok_rest);
-      }
-      free(env);
-    }
-    env = nullptr;
-  }
+static unsigned int gtk_host_watch = 0;
 
-  if (library_gtk2.disabled && library_gtk3.disabled && library_gtk4.disabled) {
-    hook_dlfcn_disabled = true;
-  }
+// Set while the current thread is transitioning a library, so that it
+// doesn't end up waiting on itself.
+static thread_local bool in_transition = false;
 
-  env = getenv("GTKCLIPBLOCK_HOOK_DLFCN");
-  if (env != nullptr) {
-    if (strcmp(env, "0") == 0) {
-      hook_dlfcn_disabled = true;
-    }
-    env = nullptr;
-  }
-}
+// Number of threads currently inside the dlopen/dlclose hooks. Removing the
+// hooks biases it negative for good, which turns late entrants away.
+#define LOADER_HOOKS_REMOVED (INT_MIN / 2)
+static _Atomic int loader_hooks_users = 0;
+static _Atomic bool loader_hooks_active = false;
+// Set if removing the hooks failed, in which case they stay for good.
+static _Atomic bool loader_hooks_stuck = false;
+
+HB_DECLARE_ORIGINAL(dlopen);
+HB_DECLARE_ORIGINAL(dlclose);
+
+static hookbatch_t loader_hooks = {};
 
 static void* original_dlopen(char const* file, int mode) {
-  auto dlopen_func = FHH_GET_ORIGINAL_FUNC(dlopen);
+  auto dlopen_func = HB_GET_ORIGINAL_FUNC(dlopen);
 
   if (dlopen_func == nullptr) {
     dlopen_func = dlopen;
@@ -109,7 +129,7 @@ static void* original_dlopen(char const* file, int mode) {
 }
 
 static int original_dlclose(void* handle) {
-  auto dlclose_func = FHH_GET_ORIGINAL_FUNC(dlclose);
+  auto dlclose_func = HB_GET_ORIGINAL_FUNC(dlclose);
 
   if (dlclose_func == nullptr) {
     dlclose_func = dlclose;
@@ -119,152 +139,380 @@ static int original_dlclose(void* handle) {
 }
 
 static bool is_library_loaded(library_t const* library) {
-  // We rely on RTLD_NOLOAD to tell us if the shared object is mapped to memory.
-  // This seems to work for:
-  //   a) binaries linked at compile-time
-  //   b) binaries making use of the runtime linker (dlopen/dlclose)
-  auto handle = original_dlopen(library->name, RTLD_LAZY | RTLD_NOLOAD);
+  return linkmap_tracker_is_present(&linkmap, library->watch);
+}
+
+static struct link_map const* handle_link_map(void* dl_handle) {
+  struct link_map* map = nullptr;
+  if (dlinfo(dl_handle, RTLD_DI_LINKMAP, &map) != 0) {
+    return nullptr;
+  }
+  return map;
+}
+
+static bool has_nodelete_flag(void* dl_handle) {
+  auto map = handle_link_map(dl_handle);
+  if (map == nullptr || map->l_ld == nullptr) {
+    return false;
+  }
 
-  if (handle != nullptr) {
-    original_dlclose(handle);
-    return true;
+  for (auto dyn = map->l_ld; dyn->d_tag != DT_NULL; dyn++) {
+    if (dyn->d_tag == DT_FLAGS_1) {
+      return (dyn->d_un.d_val & DF_1_NODELETE) != 0;
+    }
   }
 
   return false;
 }
 
-static void* dlopen_hook(char const* file, int mode) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(dlopen);
-  assert(pthread_mutex_lock(&dlfcn_mutex) == 0);
+static bool enter_loader_hooks() {
+  while (atomic_fetch_add(&loader_hooks_users, 1) < 0) {
+    // The hooks are being removed; once that's done, the callers can go
+    // straight to the real functions. If it fails, the bias goes away again
+    // and they're let in.
+    atomic_fetch_sub(&loader_hooks_users, 1);
+    while (atomic_load(&loader_hooks_users) < 0) {
+      if (!atomic_load(&loader_hooks_active)) {
+        return false;
+      }
+      sched_yield();
+    }
+  }
 
-  bool was_gtk2_loaded = is_library_loaded(&library_gtk2);
-  bool was_gtk3_loaded = is_library_loaded(&library_gtk3);
-  bool was_gtk4_loaded = is_library_loaded(&library_gtk4);
-  auto ret = original_dlopen(file, mode);
+  return true;
+}
 
-  if (ret == nullptr) {
-    goto ret;
+static void leave_loader_hooks() {
+  atomic_fetch_sub(&loader_hooks_users, 1);
+}
+
+static bool can_remove_loader_hooks() {
+  // Different GTK major versions can't be used in the same process, so once
+  // one of them is hooked and can't go away, there's nothing left to watch.
+  for (size_t i = 0; i < N_LIBRARIES; i++) {
+    if (
+      !libraries[i].disabled
+      && atomic_load(&libraries[i].state) == LIBRARY_HOOKED
+      && atomic_load(&libraries[i].pinned)
+    ) {
+      return true;
+    }
   }
 
-  // Check if GTK was loaded by our dlopen() call
+  return false;
+}
 
-  bool gtk2_loaded = !was_gtk2_loaded && is_library_loaded(&library_gtk2);
-  bool gtk3_loaded = !was_gtk3_loaded && is_library_loaded(&library_gtk3);
-  bool gtk4_loaded = !was_gtk4_loaded && is_library_loaded(&library_gtk4);
+static void maybe_remove_loader_hooks() {
+  if (atomic_load(&loader_hooks_stuck) || !can_remove_loader_hooks()) {
+    return;
+  }
 
-  if (!library_gtk2.disabled && gtk2_loaded) {
-    if (library_gtk2.dl_handle == nullptr) {
-#if defined(HOOK_GTK2)
-      library_gtk2.dl_handle = original_dlopen(file, RTLD_LAZY | RTLD_NOLOAD);
-      assert(library_gtk2.dl_handle != nullptr);
-      hook_gtk2_install_hooks(library_gtk2.dl_handle);
-#endif
-    }
+  // This can only happen while no other thread is inside the hooks; if there
+  // is one, a later call will get to it.
+  auto users = 1;
+  if (!atomic_compare_exchange_strong(&loader_hooks_users, &users, LOADER_HOOKS_REMOVED + 1)) {
+    return;
   }
 
-  if (!library_gtk3.disabled && gtk3_loaded) {
-    if (library_gtk3.dl_handle == nullptr) {
-#if defined(HOOK_GTK3)
-      library_gtk3.dl_handle = original_dlopen(file, RTLD_LAZY | RTLD_NOLOAD);
-      assert(library_gtk3.dl_handle != nullptr);
-      hook_gtk3_install_hooks(library_gtk3.dl_handle);
-#endif
-    }
+  // Whatever's still patched keeps calling the hooks, which have to keep
+  // letting callers through.
+  if (!hookbatch_uninstall(&loader_hooks)) {
+    atomic_store(&loader_hooks_stuck, true);
+    atomic_fetch_sub(&loader_hooks_users, LOADER_HOOKS_REMOVED);
+    return;
   }
 
-  if (!library_gtk4.disabled && gtk4_loaded) {
-    if (library_gtk4.dl_handle == nullptr) {
-#if defined(HOOK_GTK4)
-      library_gtk4.dl_handle = original_dlopen(file, RTLD_LAZY | RTLD_NOLOAD);
-      assert(library_gtk4.dl_handle != nullptr);
-      hook_gtk4_install_hooks(library_gtk4.dl_handle);
-#endif
+  atomic_store(&loader_hooks_active, false);
+  PROBE(loader_hooks, 0);
+}
+
+static void ensure_hooked(library_t* library) {
+  while (true) {
+    auto state = atomic_load(&library->state);
+
+    if (state == LIBRARY_HOOKED || state == LIBRARY_FAILED) {
+      return;
     }
+
+    if (
+      state == LIBRARY_UNLOADED
+      && atomic_compare_exchange_strong(&library->state, &state, LIBRARY_INSTALLING)
+    ) {
+      break;
+    }
+
+    // Another thread is busy installing or uninstalling the hooks, and the
+    // caller can't be let loose on GTK before it's done.
+    sched_yield();
   }
 
-ret:
-  assert(pthread_mutex_unlock(&dlfcn_mutex) == 0);
-  return ret;
+  in_transition = true;
+
+  // The library might have been unloaded again in the meantime.
+  auto mode = RTLD_LAZY | RTLD_NOLOAD | (settings.pin ? RTLD_NODELETE : 0);
+  auto dl_handle = original_dlopen(library->name, mode);
+  if (dl_handle == nullptr) {
+    atomic_store(&library->state, LIBRARY_UNLOADED);
+    in_transition = false;
+    return;
+  }
+
+  auto probe_start = PROBE_START(install);
+  auto installed = library->install_hooks(dl_handle, handle_link_map(dl_handle));
+  if (PROBE_ENABLED(install)) {
+    PROBE(install, library->name, probe_now_ns() - probe_start);
+  }
+
+  // Some of it might still have been patched (see hookbatch.h), so our
+  // reference stays for good: the library can't go away under it.
+  if (!installed) {
+    atomic_store(&library->state, LIBRARY_FAILED);
+    in_transition = false;
+    return;
+  }
+
+  // There's no point in tracking our reference to a library that never gets
+  // unloaded.
+  if (settings.pin || has_nodelete_flag(dl_handle)) {
+    atomic_store(&library->pinned, true);
+  } else {
+    atomic_store(&library->dl_handle, dl_handle);
+  }
+  atomic_store(&library->state, LIBRARY_HOOKED);
+  in_transition = false;
 }
 
-static int dlclose_hook(void* handle) {
-  FHH_ASSERT_HOOK_SIG_MATCHES(dlclose);
-  assert(pthread_mutex_lock(&dlfcn_mutex) == 0);
+static void* dlopen_hook(char const* file, int mode) {
+  HB_ASSERT_HOOK_SIG_MATCHES(dlopen);
 
-  bool was_gtk2_loaded = library_gtk2.dl_handle != nullptr && handle == library_gtk2.dl_handle;
-  bool was_gtk3_loaded = library_gtk3.dl_handle != nullptr && handle == library_gtk3.dl_handle;
-  bool was_gtk4_loaded = library_gtk4.dl_handle != nullptr && handle == library_gtk4.dl_handle;
+  if (!enter_loader_hooks()) {
+    return dlopen(file, mode);
+  }
 
-  auto ret = original_dlclose(handle);
+  auto probe_start = PROBE_START(dlopen);
 
-  // Check if GTK was unloaded by our dlclose() call.
+  // The real dlopen() runs without holding anything, so unrelated loads
+  // (and the constructors they run) don't get serialized.
+  auto ret = original_dlopen(file, mode);
 
-  if (was_gtk2_loaded) {
-    assert(original_dlclose(library_gtk2.dl_handle) == 0);
-    library_gtk2.dl_handle = original_dlopen(library_gtk2.name, RTLD_LAZY | RTLD_NOLOAD);
-    if (library_gtk2.dl_handle == nullptr) {
-#if defined(HOOK_GTK2)
-      hook_gtk2_uninstall_hooks();
-#endif
+  if (ret != nullptr && !in_transition) {
+    // Most dlopen() calls don't map anything new (or at least nothing we
+    // care about), in which case the loader's generation counters haven't
+    // moved and this doesn't take the tracker's mutex (reading the counters
+    // still goes through dl_iterate_phdr(), which takes the loader's lock).
+    linkmap_tracker_refresh(&linkmap);
+
+    // Even if this call didn't load GTK, another thread's might have, and
+    // it could still be installing the hooks.
+    for (size_t i = 0; i < N_LIBRARIES; i++) {
+      if (!libraries[i].disabled && is_library_loaded(&libraries[i])) {
+        ensure_hooked(&libraries[i]);
+      }
     }
+
+    maybe_remove_loader_hooks();
   }
 
-  if (was_gtk3_loaded) {
-    assert(original_dlclose(library_gtk3.dl_handle) == 0);
-    library_gtk3.dl_handle = original_dlopen(library_gtk3.name, RTLD_LAZY | RTLD_NOLOAD);
-    if (library_gtk3.dl_handle == nullptr) {
-#if defined(HOOK_GTK3)
-      hook_gtk3_uninstall_hooks();
-#endif
+  leave_loader_hooks();
+  if (PROBE_ENABLED(dlopen)) {
+    PROBE(dlopen, file, mode, ret, probe_now_ns() - probe_start);
+  }
+  return ret;
+}
+
+static int close_library_handle(void* handle) {
+  library_t* library = nullptr;
+  for (size_t i = 0; i < N_LIBRARIES && handle != nullptr; i++) {
+    if (atomic_load(&libraries[i].dl_handle) == handle) {
+      library = &libraries[i];
+      break;
     }
   }
 
-  if (was_gtk4_loaded) {
-    assert(original_dlclose(library_gtk4.dl_handle) == 0);
-    library_gtk4.dl_handle = original_dlopen(library_gtk4.name, RTLD_LAZY | RTLD_NOLOAD);
-    if (library_gtk4.dl_handle == nullptr) {
-#if defined(HOOK_GTK4)
-      hook_gtk4_uninstall_hooks();
-#endif
+  if (library == nullptr || in_transition) {
+    return original_dlclose(handle);
+  }
+
+  while (true) {
+    auto state = LIBRARY_HOOKED;
+    if (atomic_compare_exchange_strong(&library->state, &state, LIBRARY_UNINSTALLING)) {
+      break;
     }
+
+    // Someone else beat us to it (and possibly dropped our reference
+    // already), so this is just a regular dlclose().
+    if (state == LIBRARY_UNLOADED) {
+      return original_dlclose(handle);
+    }
+
+    sched_yield();
+  }
+
+  in_transition = true;
+
+  // Our reference might be the only one left; drop it along with the
+  // caller's to find out whether the library actually goes away.
+  auto ret = original_dlclose(handle);
+  auto dl_handle = atomic_exchange(&library->dl_handle, nullptr);
+  if (dl_handle != nullptr) {
+    assert(original_dlclose(dl_handle) == 0);
   }
 
-  assert(pthread_mutex_unlock(&dlfcn_mutex) == 0);
+  linkmap_tracker_refresh(&linkmap);
+
+  // If the library is still mapped (i.e. it's referenced by another handle),
+  // we have to keep a reference to it to be notified of its unloading.
+  if (is_library_loaded(library)) {
+    dl_handle = original_dlopen(library->name, RTLD_LAZY | RTLD_NOLOAD);
+    if (dl_handle != nullptr) {
+      atomic_store(&library->dl_handle, dl_handle);
+      atomic_store(&library->state, LIBRARY_HOOKED);
+      in_transition = false;
+      return ret;
+    }
+  }
+
+  auto probe_start = PROBE_START(uninstall);
+  library->uninstall_hooks();
+  if (PROBE_ENABLED(uninstall)) {
+    PROBE(uninstall, library->name, probe_now_ns() - probe_start);
+  }
+  atomic_store(&library->state, LIBRARY_UNLOADED);
+  in_transition = false;
   return ret;
 }
 
-__attribute__((constructor))
-static void init() {
-  load_settings();
+static int dlclose_hook(void* handle) {
+  HB_ASSERT_HOOK_SIG_MATCHES(dlclose);
 
-  if (!library_gtk2.disabled && is_library_loaded(&library_gtk2)) {
-#if defined(HOOK_GTK2)
-    hook_gtk2_install_hooks(RTLD_DEFAULT);
-    library_gtk2.disabled = true;
-#endif
+  if (!enter_loader_hooks()) {
+    return dlclose(handle);
   }
 
-  if (!library_gtk3.disabled && is_library_loaded(&library_gtk3)) {
-#if defined(HOOK_GTK3)
-    hook_gtk3_install_hooks(RTLD_DEFAULT);
-    library_gtk3.disabled = true;
-#endif
+  auto probe_start = PROBE_START(dlclose);
+  auto ret = close_library_handle(handle);
+  leave_loader_hooks();
+  if (PROBE_ENABLED(dlclose)) {
+    PROBE(dlclose, handle, ret, probe_now_ns() - probe_start);
   }
+  return ret;
+}
 
-  if (!library_gtk4.disabled && is_library_loaded(&library_gtk4)) {
-#if defined(HOOK_GTK4)
-    hook_gtk4_install_hooks(RTLD_DEFAULT);
-    library_gtk4.disabled = true;
-#endif
+static hookbatch_entry_t const loader_hook_entries[] = {
+  HB_HOOK(dlopen),
+  HB_HOOK(dlclose),
+};
+
+bool gtkclipblock_loader_hooks_active() {
+  return atomic_load(&loader_hooks_active);
+}
+
+size_t gtkclipblock_dirtied_text_pages() {
+  return hookbatch_dirtied_text_pages();
+}
+
+// Returns how far it got, for the startup trace.
+static char const* initialize(int argc, char** argv) {
+  config_cache_t config;
+  config_load(&config);
+  settings = config.settings;
+  startup_trace_mark(STARTUP_TRACE_CONFIG);
+
+  // Under ld.so.preload, this runs in every single process. Most of them
+  // don't have anything enabled, so get out of the way as early as possible.
+  if (settings.gtk2_disabled && settings.gtk3_disabled && settings.gtk4_disabled) {
+    config_cache_close(&config);
+    return "disabled";
   }
 
-  if (!hook_dlfcn_disabled) {
-    pthread_mutexattr_init(&dlfcn_mutex_attr);
-    pthread_mutexattr_settype(&dlfcn_mutex_attr, PTHREAD_MUTEX_RECURSIVE_NP);
-    pthread_mutex_init(&dlfcn_mutex, &dlfcn_mutex_attr);
+  // Processes excluded by the policy shouldn't pay for anything beyond this.
+  auto argv0 = argc > 0 ? argv[0] : nullptr;
+  auto action = policy_evaluate_self(&config.policy, argv0);
+  config_cache_close(&config);
+  startup_trace_mark(STARTUP_TRACE_POLICY);
+  if (action == POLICY_ACTION_DENY) {
+    return "denied";
+  }
+
+  hookbatch_set_interpose(settings.interpose);
+  stats_set_enabled(settings.stats);
+  primary_set_mode(settings.primary, settings.primary_param);
+  startup_trace_mark(STARTUP_TRACE_CONFIG);
+
+  bool const disabled[N_LIBRARIES] = {
+    settings.gtk2_disabled,
+    settings.gtk3_disabled,
+    settings.gtk4_disabled,
+  };
+
+  for (size_t i = 0; i < N_LIBRARIES; i++) {
+    // Toolkits that weren't compiled in have no hooks to install.
+    libraries[i].disabled = disabled[i] || libraries[i].install_hooks == nullptr;
+    libraries[i].watch = linkmap_tracker_watch(&linkmap, libraries[i].name);
+  }
 
-    bool dlopen_success = FHH_INSTALL(RTLD_DEFAULT, dlopen);
-    bool dlclose_success = FHH_INSTALL(RTLD_DEFAULT, dlclose);
-    assert(dlopen_success == dlclose_success);
+  if (settings.hook_dlfcn_auto) {
+    for (size_t i = 0; i < sizeof(gtk_host_sonames) / sizeof(*gtk_host_sonames); i++) {
+      gtk_host_watch |= linkmap_tracker_watch(&linkmap, gtk_host_sonames[i]);
+    }
   }
+
+  // This walks the initial link map (i.e. the DT_NEEDED closure of the
+  // executable and the preloaded libraries) without going through the loader.
+  linkmap_tracker_refresh(&linkmap);
+
+  // The dlopen/dlclose hooks aren't installed yet, so nothing can race with
+  // this; no need to go through the state transitions.
+  for (size_t i = 0; i < N_LIBRARIES; i++) {
+    if (!libraries[i].disabled && is_library_loaded(&libraries[i])) {
+      // GTK's own symbols get looked up in its link map, which is easiest
+      // to get to through a handle.
+      auto dl_handle = original_dlopen(libraries[i].name, RTLD_LAZY | RTLD_NOLOAD);
+      startup_trace_mark(STARTUP_TRACE_LINKMAP);
+      auto probe_start = PROBE_START(install);
+      auto installed = libraries[i].install_hooks(
+        RTLD_DEFAULT,
+        dl_handle != nullptr ? handle_link_map(dl_handle) : nullptr
+      );
+      if (PROBE_ENABLED(install)) {
+        PROBE(install, libraries[i].name, probe_now_ns() - probe_start);
+      }
+      if (dl_handle != nullptr) {
+        original_dlclose(dl_handle);
+      }
+
+      libraries[i].state = installed ? LIBRARY_HOOKED : LIBRARY_FAILED;
+      libraries[i].pinned = true;
+    }
+  }
+
+  startup_trace_mark(STARTUP_TRACE_LINKMAP);
+
+  if (settings.hook_dlfcn_auto && !linkmap_tracker_is_present(&linkmap, gtk_host_watch)) {
+    return "no-glib";
+  }
+
+  if (!settings.hook_dlfcn_disabled && !can_remove_loader_hooks()) {
+    startup_trace_redirect(STARTUP_TRACE_DLFCN);
+    elfsym_resolver_t resolver;
+    elfsym_resolver_init(&resolver, RTLD_DEFAULT, nullptr);
+    loader_hooks_active = hookbatch_install(
+      &loader_hooks,
+      &resolver,
+      loader_hook_entries,
+      sizeof(loader_hook_entries) / sizeof(*loader_hook_entries)
+    );
+    PROBE(loader_hooks, loader_hooks_active ? 1 : 0);
+    startup_trace_mark(STARTUP_TRACE_DLFCN);
+    startup_trace_redirect(STARTUP_TRACE_NONE);
+  }
+
+  return "done";
+}
+
+__attribute__((constructor))
+static void init(int argc, char** argv, char**) {
+  startup_trace_begin();
+  auto outcome = initialize(argc, argv);
+  startup_trace_end(outcome);
 }
@@ -0,0 +1,179 @@
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include "policy.h"
+
+uint64_t policy_hash(char const* str) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  for (; *str != '\0'; str++) {
+    hash ^= (unsigned char)*str;
+    hash *= 0x100000001b3ull;
+  }
+  return hash;
+}
+
+static bool glob_matches(char const* pattern, char const* str) {
+  // Iterative matcher supporting '*', '?' and '\' escapes; backtracks to the
+  // last '*' only, so it can't blow up on pathological patterns.
+  char const* star = nullptr;
+  char const* star_str = nullptr;
+
+  while (*str != '\0') {
+    if (*pattern == '*') {
+      star = ++pattern;
+      star_str = str;
+      continue;
+    }
+
+    char c = *pattern;
+    bool escaped = c == '\\' && pattern[1] != '\0';
+    if (escaped) {
+      c = pattern[1];
+    }
+
+    if ((!escaped && c == '?') || (c != '\0' && c == *str)) {
+      pattern += escaped ? 2 : 1;
+      str++;
+      continue;
+    }
+
+    if (star == nullptr) {
+      return false;
+    }
+
+    pattern = star;
+    str = ++star_str;
+  }
+
+  while (*pattern == '*') {
+    pattern++;
+  }
+
+  return *pattern == '\0';
+}
+
+static char const* subject_field(policy_subject_t const* subject, uint8_t field) {
+  switch (field) {
+    case POLICY_FIELD_EXE:
+      return subject->exe;
+    case POLICY_FIELD_ARGV0:
+      return subject->argv0;
+    case POLICY_FIELD_COMM:
+      return subject->comm;
+    default:
+      return nullptr;
+  }
+}
+
+static void match_literals(
+  policy_table_t const* table,
+  uint8_t field,
+  char const* value,
+  bool* allowed,
+  bool* denied
+) {
+  auto hash = policy_hash(value);
+
+  // lower bound
+  uint32_t lo = 0;
+  uint32_t hi = table->n_literals;
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (table->literals[mid].hash < hash) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (; lo < table->n_literals && table->literals[lo].hash == hash; lo++) {
+    auto rule = &table->literals[lo];
+    if (rule->field != field || strcmp(table->strings + rule->pattern, value) != 0) {
+      continue;
+    }
+
+    if (rule->action == POLICY_ACTION_DENY) {
+      *denied = true;
+    } else {
+      *allowed = true;
+    }
+  }
+}
+
+policy_action_t policy_evaluate(
+  policy_table_t const* table,
+  policy_subject_t const* subject
+) {
+  // Deny rules take precedence over allow rules; the default action only
+  // applies if nothing matched.
+  bool allowed = false;
+  bool denied = false;
+
+  for (uint8_t field = POLICY_FIELD_EXE; field <= POLICY_FIELD_COMM; field++) {
+    if ((table->fields & (1u << field)) == 0) {
+      continue;
+    }
+
+    auto value = subject_field(subject, field);
+    if (value == nullptr) {
+      continue;
+    }
+
+    match_literals(table, field, value, &allowed, &denied);
+  }
+
+  for (uint32_t i = 0; i < table->n_globs && !denied; i++) {
+    auto rule = &table->globs[i];
+    auto value = subject_field(subject, rule->field);
+    if (value == nullptr || !glob_matches(table->strings + rule->pattern, value)) {
+      continue;
+    }
+
+    if (rule->action == POLICY_ACTION_DENY) {
+      denied = true;
+    } else {
+      allowed = true;
+    }
+  }
+
+  if (denied) {
+    return POLICY_ACTION_DENY;
+  }
+
+  if (allowed) {
+    return POLICY_ACTION_ALLOW;
+  }
+
+  return (policy_action_t)table->default_action;
+}
+
+policy_action_t policy_evaluate_self(policy_table_t const* table, char const* argv0) {
+  if (table->n_literals == 0 && table->n_globs == 0) {
+    return (policy_action_t)table->default_action;
+  }
+
+  // Only query what the rules actually need; each of these is a syscall.
+  char exe[PATH_MAX];
+  char comm[17];
+  policy_subject_t subject = {
+    .argv0 = argv0,
+  };
+
+  if ((table->fields & (1u << POLICY_FIELD_EXE)) != 0) {
+    auto len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (len > 0) {
+      exe[len] = '\0';
+      subject.exe = exe;
+    }
+  }
+
+  if ((table->fields & (1u << POLICY_FIELD_COMM)) != 0) {
+    if (prctl(PR_GET_NAME, comm, 0, 0, 0) == 0) {
+      comm[sizeof(comm) - 1] = '\0';
+      subject.comm = comm;
+    }
+  }
+
+  return policy_evaluate(table, &subject);
+}
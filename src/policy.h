@@ -0,0 +1,58 @@
+#ifndef GTKCLIPBLOCK_POLICY_H
+#define GTKCLIPBLOCK_POLICY_H
+
+#include <stdint.h>
+
+// Per-executable allow/deny rules.
+//
+// Rules are compiled ahead of time into a table: literal patterns are sorted
+// by their FNV-1a hash so that a lookup is a single hash and a binary search,
+// glob patterns are kept in a separate (short) list. Patterns are stored as
+// offsets into a string pool, so the table can be used in place without any
+// relocation or allocation.
+
+typedef enum {
+  POLICY_FIELD_EXE,
+  POLICY_FIELD_ARGV0,
+  POLICY_FIELD_COMM,
+} policy_field_t;
+
+typedef enum {
+  POLICY_ACTION_ALLOW,
+  POLICY_ACTION_DENY,
+} policy_action_t;
+
+typedef struct {
+  uint64_t hash;
+  uint32_t pattern;
+  uint8_t field;
+  uint8_t action;
+} policy_rule_t;
+
+typedef struct {
+  policy_rule_t const* literals;
+  uint32_t n_literals;
+  policy_rule_t const* globs;
+  uint32_t n_globs;
+  char const* strings;
+  // bitmask of the fields referenced by the rules
+  uint8_t fields;
+  uint8_t default_action;
+} policy_table_t;
+
+typedef struct {
+  char const* exe;
+  char const* argv0;
+  char const* comm;
+} policy_subject_t;
+
+extern policy_table_t const policy_builtin_table;
+
+uint64_t policy_hash(char const* str);
+policy_action_t policy_evaluate(
+  policy_table_t const* table,
+  policy_subject_t const* subject
+);
+policy_action_t policy_evaluate_self(policy_table_t const* table, char const* argv0);
+
+#endif
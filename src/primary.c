@@ -0,0 +1,218 @@
+#include <stdlib.h>
+#include <time.h>
+#include "primary.h"
+
+// GLib's, without pulling its headers into the core library.
+typedef int (*source_func_t)(void* data);
+typedef unsigned int (*timeout_add_func_t)(unsigned int interval, source_func_t func, void* data);
+typedef int (*source_remove_func_t)(unsigned int tag);
+
+static primary_mode_t mode = PRIMARY_BLOCK;
+static uint32_t debounce_ms = 0;
+static size_t limit = 0;
+
+static timeout_add_func_t g_timeout_add_func = nullptr;
+static source_remove_func_t g_source_remove_func = nullptr;
+
+static primary_claim_t* pending = nullptr;
+static uint64_t pending_deadline = 0;
+static unsigned int timeout_tag = 0;
+static bool committing = false;
+
+// One per display, which is as many as the toolkits' display caches hold.
+#define KEPT_MAX 4
+
+static primary_claim_t* kept[KEPT_MAX] = {};
+
+static uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void primary_set_mode(primary_mode_t new_mode, uint32_t param) {
+  switch (new_mode) {
+    case PRIMARY_DEBOUNCE:
+      mode = new_mode;
+      debounce_ms = param;
+      break;
+    case PRIMARY_LIMIT:
+      mode = new_mode;
+      limit = param;
+      break;
+    case PRIMARY_LOCAL:
+      mode = new_mode;
+      break;
+    default:
+      mode = PRIMARY_BLOCK;
+      break;
+  }
+}
+
+primary_mode_t primary_mode() {
+  return mode;
+}
+
+bool primary_defers() {
+  return mode == PRIMARY_DEBOUNCE || mode == PRIMARY_LOCAL;
+}
+
+bool primary_fits(size_t size) {
+  return size <= limit;
+}
+
+size_t primary_limit() {
+  return limit;
+}
+
+void primary_attach(elfsym_resolver_t const* resolver) {
+  if (mode != PRIMARY_DEBOUNCE) {
+    return;
+  }
+
+  g_timeout_add_func = (timeout_add_func_t)elfsym_resolve_dep(resolver, "g_timeout_add");
+  g_source_remove_func = (source_remove_func_t)elfsym_resolve_dep(resolver, "g_source_remove");
+}
+
+static int on_timeout(void*) {
+  timeout_tag = 0;
+  if (pending == nullptr) {
+    return false;
+  }
+
+  // Claims that came in since the timeout was set pushed the deadline back;
+  // rather than resetting the timeout on every claim, it gets set again for
+  // whatever's left.
+  auto now = now_ns();
+  if (now < pending_deadline) {
+    auto remaining_ms = (pending_deadline - now + 999999) / 1000000;
+    timeout_tag = g_timeout_add_func(remaining_ms, on_timeout, nullptr);
+    return false;
+  }
+
+  primary_flush();
+  return false;
+}
+
+// With a null clipboard, finds a free slot.
+static primary_claim_t** kept_slot(void const* clipboard) {
+  for (size_t i = 0; i < KEPT_MAX; i++) {
+    auto kept_clipboard = kept[i] != nullptr ? kept[i]->clipboard : nullptr;
+    if (kept_clipboard == clipboard) {
+      return &kept[i];
+    }
+  }
+  return nullptr;
+}
+
+static void keep(primary_claim_t* claim) {
+  // The claim never gets to GTK.
+  stats_count(claim->function, STATS_BLOCKED);
+
+  auto slot = kept_slot(claim->clipboard);
+  if (slot == nullptr) {
+    slot = kept_slot(nullptr);
+  }
+  if (slot == nullptr) {
+    claim->drop(claim, nullptr);
+    return;
+  }
+
+  // Dropping a claim calls back into the application, which might look at
+  // the selection again.
+  auto previous = *slot;
+  *slot = claim;
+  if (previous != nullptr) {
+    previous->drop(previous, claim);
+  }
+}
+
+static void debounce(primary_claim_t* claim) {
+  if (pending != nullptr) {
+    if (pending->clipboard == claim->clipboard) {
+      auto previous = pending;
+      pending = nullptr;
+      stats_count(previous->function, STATS_BLOCKED);
+      previous->drop(previous, claim);
+    } else {
+      // Another display's selection; that one has settled.
+      primary_flush();
+    }
+  }
+
+  pending = claim;
+  pending_deadline = now_ns() + (uint64_t)debounce_ms * 1000000;
+
+  if (timeout_tag == 0) {
+    if (g_timeout_add_func == nullptr) {
+      primary_flush();
+      return;
+    }
+    timeout_tag = g_timeout_add_func(debounce_ms, on_timeout, nullptr);
+  }
+}
+
+void primary_defer(primary_claim_t* claim) {
+  if (mode == PRIMARY_LOCAL) {
+    keep(claim);
+  } else {
+    debounce(claim);
+  }
+}
+
+primary_claim_t* primary_held(void const* clipboard) {
+  if (pending != nullptr && pending->clipboard == clipboard) {
+    return pending;
+  }
+
+  auto slot = kept_slot(clipboard);
+  return slot != nullptr ? *slot : nullptr;
+}
+
+void primary_release(void const* clipboard) {
+  primary_claim_t* claim = nullptr;
+  auto slot = kept_slot(clipboard);
+  if (pending != nullptr && pending->clipboard == clipboard) {
+    claim = pending;
+    pending = nullptr;
+  } else if (slot != nullptr) {
+    claim = *slot;
+    *slot = nullptr;
+  }
+
+  if (claim != nullptr) {
+    claim->drop(claim, nullptr);
+  }
+}
+
+void primary_flush() {
+  if (pending == nullptr) {
+    return;
+  }
+
+  auto claim = pending;
+  pending = nullptr;
+
+  committing = true;
+  claim->commit(claim);
+  committing = false;
+}
+
+bool primary_is_committing() {
+  return committing;
+}
+
+void primary_detach() {
+  if (timeout_tag != 0 && g_source_remove_func != nullptr) {
+    g_source_remove_func(timeout_tag);
+  }
+  timeout_tag = 0;
+
+  // Whatever the claims hold belongs to GTK.
+  free(pending);
+  pending = nullptr;
+  for (size_t i = 0; i < KEPT_MAX; i++) {
+    free(kept[i]);
+    kept[i] = nullptr;
+  }
+}
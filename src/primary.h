@@ -0,0 +1,97 @@
+#ifndef GTKCLIPBLOCK_PRIMARY_H
+#define GTKCLIPBLOCK_PRIMARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "elfsym.h"
+#include "settings.h"
+#include "stats.h"
+
+// Handling of the primary selection beyond blocking it, shared by the
+// toolkits (see settings.h for the modes).
+//
+// With PRIMARY_DEBOUNCE, the hooks don't pass ownership claims (e.g.
+// gtk_clipboard_set_with_data()) through to GTK right away: they're kept as
+// pending, each new claim replacing the last, and only the last one gets
+// committed once no other claim came for the debounce interval. Dragging a
+// selection then claims PRIMARY once instead of on every motion event, and
+// reading the primary selection from the same process commits the pending
+// claim first.
+//
+// With PRIMARY_LIMIT, the primary selection works as long as its contents
+// aren't larger than the limit. What the hooks can size up front (text,
+// images) gets blocked right away when it's too large; contents served by a
+// callback get refused when someone asks for them, before any of it reaches
+// the display server. Reads get checked once the data is in.
+//
+// With PRIMARY_LOCAL, claims never reach GTK either: the last one of each
+// display is kept in the process, and the hooks serve the process' own reads
+// of the primary selection from it. Other applications never see it, and the
+// process never sees theirs.
+//
+// The pending claim is committed from a GLib timeout on the default main
+// context. Like GTK itself, everything here is only meant to be used from the
+// thread running it.
+
+typedef struct primary_claim primary_claim_t;
+
+struct primary_claim {
+  // Makes the claim through the hook again, which lets it pass while
+  // primary_is_committing() is true. Then frees the claim. Kept claims never
+  // get committed.
+  void (*commit)(primary_claim_t* claim);
+  // Frees the claim without making it, releasing what it holds as GTK would
+  // when replacing the selection's contents. `next` is the claim replacing
+  // it, if any.
+  void (*drop)(primary_claim_t* claim, primary_claim_t const* next);
+  // Counted as blocked if the claim gets dropped, or kept.
+  stats_function_t function;
+  void* clipboard;
+};
+
+// The size of text as the set_text functions take it: `len` bytes, or up to
+// the terminator if it's negative.
+static inline size_t primary_text_size(char const* text, int len) {
+  return text == nullptr ? 0 : len >= 0 ? (size_t)len : strlen(text);
+}
+
+// Has to be called before any hook can run.
+void primary_set_mode(primary_mode_t mode, uint32_t param);
+
+primary_mode_t primary_mode();
+
+// Whether `size` bytes are within PRIMARY_LIMIT's limit.
+bool primary_fits(size_t size);
+
+size_t primary_limit();
+
+// Resolves the GLib functions behind the timer; the toolkits call this
+// before installing their hooks.
+void primary_attach(elfsym_resolver_t const* resolver);
+
+// Whether the hooks hold claims back (PRIMARY_DEBOUNCE, PRIMARY_LOCAL) rather
+// than pass or block them.
+bool primary_defers();
+
+// Debounces or keeps the claim, depending on the mode. Takes ownership of it
+// (allocated with malloc()).
+void primary_defer(primary_claim_t* claim);
+
+// The claim pending or kept for the clipboard, if any, i.e. what GTK would
+// have as its contents.
+primary_claim_t* primary_held(void const* clipboard);
+
+// Drops the claim pending or kept for the clipboard, as GTK would clear it.
+void primary_release(void const* clipboard);
+
+// Commits the pending claim now, if there's one.
+void primary_flush();
+
+bool primary_is_committing();
+
+// Forgets the pending and kept claims without calling back into GTK, which is
+// about to go away.
+void primary_detach();
+
+#endif
@@ -0,0 +1,18 @@
+#include "probes.h"
+
+#if defined(GTKCLIPBLOCK_USDT)
+
+// Tracers find these through the probes' notes, and increment them while
+// attached (through /proc/<pid>/mem, or the kernel's uprobe reference
+// counters).
+#define PROBE_DEFINE(name) \
+  unsigned short volatile PROBE_SEMAPHORE(name) __attribute__((section(".probes"))) = 0
+
+PROBE_DEFINE(hook);
+PROBE_DEFINE(dlopen);
+PROBE_DEFINE(dlclose);
+PROBE_DEFINE(install);
+PROBE_DEFINE(uninstall);
+PROBE_DEFINE(loader_hooks);
+
+#endif
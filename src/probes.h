@@ -0,0 +1,83 @@
+#ifndef GTKCLIPBLOCK_PROBES_H
+#define GTKCLIPBLOCK_PROBES_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// USDT probes (provider "gtkclipblock") in builds with -Dusdt=enabled; see
+// tools/bpftrace/ for examples. Every probe has a semaphore that tracers
+// increment while attached, and probe sites check it first: with nothing
+// attached, a probe costs a load and a predictable branch, and its arguments
+// don't get computed.
+//
+//   hook(char const* function, void* clipboard, int blocked, size_t size, uint64_t elapsed_ns)
+//     A hook decided to block the call or pass it through to GTK. `size` is
+//     the text's length for the set_text functions, the number of targets for
+//     the ones taking a target list, and 0 otherwise. `elapsed_ns` is the time
+//     the hook took to decide, not counting GTK's own.
+//   dlopen(char const* file, int mode, void* handle, uint64_t elapsed_ns)
+//   dlclose(void* handle, int result, uint64_t elapsed_ns)
+//     The dlopen()/dlclose() hooks returned, hooking or unhooking GTK included.
+//   install(char const* soname, uint64_t elapsed_ns)
+//   uninstall(char const* soname, uint64_t elapsed_ns)
+//     A GTK library got hooked, or unhooked before being unloaded.
+//   loader_hooks(int active)
+//     The dlopen()/dlclose() hooks got installed or removed.
+
+#if defined(GTKCLIPBLOCK_USDT)
+
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define PROBE_SEMAPHORE(name) gtkclipblock_##name##_semaphore
+
+// The semaphores are defined in probes.c.
+#define PROBE_DECLARE(name) \
+  extern unsigned short volatile PROBE_SEMAPHORE(name) __attribute__((visibility("hidden")))
+
+PROBE_DECLARE(hook);
+PROBE_DECLARE(dlopen);
+PROBE_DECLARE(dlclose);
+PROBE_DECLARE(install);
+PROBE_DECLARE(uninstall);
+PROBE_DECLARE(loader_hooks);
+
+#define PROBE_ENABLED(name) __builtin_expect(PROBE_SEMAPHORE(name) != 0, 0)
+#define PROBE(name, ...) STAP_PROBEV(gtkclipblock, name, __VA_ARGS__)
+
+#else
+
+// Still takes the arguments, so that whatever's only computed for a probe
+// doesn't end up unused.
+static inline void probe_discard(int, ...) {}
+
+#define PROBE_ENABLED(name) false
+#define PROBE(name, ...) probe_discard(0, __VA_ARGS__)
+
+#endif
+
+static inline uint64_t probe_now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// When the probe is disabled, there's nothing to measure from.
+#define PROBE_START(name) (PROBE_ENABLED(name) ? probe_now_ns() : 0)
+
+#define PROBE_HOOK(func, decision, clipboard, size, start) \
+  do { \
+    if (PROBE_ENABLED(hook)) { \
+      PROBE( \
+        hook, \
+        (char const*)#func, \
+        (void*)(clipboard), \
+        (int)((decision) == STATS_BLOCKED), \
+        (size_t)(size), \
+        probe_now_ns() - (start) \
+      ); \
+    } \
+  } while (false)
+
+#endif
@@ -0,0 +1,308 @@
+#include <string.h>
+#include "prologue.h"
+
+#define MAX_INSTRUCTION_SIZE 15
+
+// What follows an opcode. Opcodes missing from the tables (0) aren't
+// supported.
+enum {
+  OP_NONE = 1 << 0,
+  OP_MODRM = 1 << 1,
+  OP_IMM8 = 1 << 2,
+  // imm16 with an operand-size prefix, imm32 otherwise
+  OP_IMMZ = 1 << 3,
+  // imm64 with REX.W, same as OP_IMMZ otherwise (mov $imm, %reg)
+  OP_IMMV = 1 << 4,
+  OP_REL8 = 1 << 5,
+  OP_REL32 = 1 << 6,
+  // Execution doesn't continue with the next instruction.
+  OP_STOP = 1 << 7,
+  // test has an immediate, the rest of the group doesn't (0xf6/0xf7).
+  OP_GROUP3 = 1 << 8,
+  // inc/dec/push, or an indirect call/jmp (0xff).
+  OP_GROUP5 = 1 << 9,
+};
+
+#define ALU_OPCODES(base) \
+  [(base) ... (base) + 3] = OP_MODRM, \
+  [(base) + 4] = OP_IMM8, \
+  [(base) + 5] = OP_IMMZ
+
+static uint16_t const one_byte_opcodes[256] = {
+  ALU_OPCODES(0x00), // add
+  ALU_OPCODES(0x08), // or
+  ALU_OPCODES(0x10), // adc
+  ALU_OPCODES(0x18), // sbb
+  ALU_OPCODES(0x20), // and
+  ALU_OPCODES(0x28), // sub
+  ALU_OPCODES(0x30), // xor
+  ALU_OPCODES(0x38), // cmp
+  [0x50 ... 0x5f] = OP_NONE, // push/pop
+  [0x63] = OP_MODRM, // movsxd
+  [0x68] = OP_IMMZ, // push
+  [0x69] = OP_MODRM | OP_IMMZ, // imul
+  [0x6a] = OP_IMM8, // push
+  [0x6b] = OP_MODRM | OP_IMM8, // imul
+  [0x70 ... 0x7f] = OP_REL8, // jcc
+  [0x80] = OP_MODRM | OP_IMM8,
+  [0x81] = OP_MODRM | OP_IMMZ,
+  [0x83] = OP_MODRM | OP_IMM8,
+  [0x84 ... 0x8b] = OP_MODRM, // test, xchg, mov
+  [0x8d] = OP_MODRM, // lea
+  [0x8f] = OP_MODRM, // pop
+  [0x90 ... 0x99] = OP_NONE, // nop, xchg, cwde, cdq
+  [0xa8] = OP_IMM8, // test
+  [0xa9] = OP_IMMZ, // test
+  [0xb0 ... 0xb7] = OP_IMM8, // mov
+  [0xb8 ... 0xbf] = OP_IMMV, // mov
+  [0xc0 ... 0xc1] = OP_MODRM | OP_IMM8, // shifts
+  [0xc3] = OP_STOP, // ret
+  [0xc6] = OP_MODRM | OP_IMM8, // mov
+  [0xc7] = OP_MODRM | OP_IMMZ, // mov
+  [0xc9] = OP_NONE, // leave
+  [0xcc] = OP_STOP, // int3
+  [0xd0 ... 0xd3] = OP_MODRM, // shifts
+  [0xe0 ... 0xe3] = OP_REL8, // loop, jrcxz
+  [0xe8] = OP_REL32, // call
+  [0xe9] = OP_REL32 | OP_STOP, // jmp
+  [0xeb] = OP_REL8 | OP_STOP, // jmp
+  [0xf6 ... 0xf7] = OP_MODRM | OP_GROUP3,
+  [0xfe] = OP_MODRM, // inc/dec
+  [0xff] = OP_MODRM | OP_GROUP5,
+};
+
+// After 0x0f; the three-byte maps (0x0f 0x38/0x3a) aren't supported.
+static uint16_t const two_byte_opcodes[256] = {
+  [0x0b] = OP_STOP, // ud2
+  [0x10 ... 0x1f] = OP_MODRM, // SSE moves, prefetch, nop, endbr64
+  [0x28 ... 0x2f] = OP_MODRM, // SSE moves, conversions, comparisons
+  [0x40 ... 0x4f] = OP_MODRM, // cmovcc
+  [0x50 ... 0x6f] = OP_MODRM, // SSE
+  [0x70 ... 0x73] = OP_MODRM | OP_IMM8, // pshufd, SSE shifts
+  [0x74 ... 0x76] = OP_MODRM, // pcmpeq
+  [0x7e ... 0x7f] = OP_MODRM, // movd/movq, movdqa/movdqu
+  [0x80 ... 0x8f] = OP_REL32, // jcc
+  [0x90 ... 0x9f] = OP_MODRM, // setcc
+  [0xa3] = OP_MODRM, // bt
+  [0xa4] = OP_MODRM | OP_IMM8, // shld
+  [0xa5] = OP_MODRM, // shld
+  [0xab] = OP_MODRM, // bts
+  [0xac] = OP_MODRM | OP_IMM8, // shrd
+  [0xad] = OP_MODRM, // shrd
+  [0xaf] = OP_MODRM, // imul
+  [0xb0 ... 0xb1] = OP_MODRM, // cmpxchg
+  [0xb6 ... 0xb7] = OP_MODRM, // movzx
+  [0xba] = OP_MODRM | OP_IMM8, // bt group
+  [0xbb ... 0xbf] = OP_MODRM, // btc, bsf, bsr, movsx
+  [0xc0 ... 0xc1] = OP_MODRM, // xadd
+  [0xc2] = OP_MODRM | OP_IMM8, // cmpps
+  [0xc6] = OP_MODRM | OP_IMM8, // shufps
+  [0xc8 ... 0xcf] = OP_NONE, // bswap
+  [0xd0 ... 0xfe] = OP_MODRM, // SSE
+};
+
+typedef struct {
+  size_t size;
+  bool rip_relative;
+  // Where the %rip-relative displacement is, if any.
+  size_t disp_offset;
+  // Any control transfer, including indirect ones.
+  bool transfers;
+  bool has_target;
+  // Relative to the end of the instruction.
+  int32_t target;
+} instruction_t;
+
+static bool is_legacy_prefix(uint8_t byte) {
+  switch (byte) {
+    case 0x26: // segment overrides, and branch hints/notrack for cs/ds
+    case 0x2e:
+    case 0x36:
+    case 0x3e:
+    case 0x64:
+    case 0x65:
+    case 0x66: // operand size
+    case 0xf0: // lock
+    case 0xf2: // repne, and SSE
+    case 0xf3: // rep, and SSE/endbr64
+      return true;
+    default:
+      return false;
+  }
+}
+
+static bool decode(uint8_t const* code, size_t size, instruction_t* insn) {
+  *insn = (instruction_t){};
+  if (size > MAX_INSTRUCTION_SIZE) {
+    size = MAX_INSTRUCTION_SIZE;
+  }
+
+  size_t pos = 0;
+  bool operand_size_16 = false;
+  while (pos < size && is_legacy_prefix(code[pos])) {
+    operand_size_16 |= code[pos] == 0x66;
+    pos++;
+  }
+
+  bool rex_w = false;
+  if (pos < size && (code[pos] & 0xf0) == 0x40) {
+    rex_w = (code[pos] & 0x08) != 0;
+    pos++;
+  }
+
+  if (pos >= size) {
+    return false;
+  }
+
+  uint16_t flags;
+  auto opcode = code[pos++];
+  if (opcode == 0x0f) {
+    if (pos >= size) {
+      return false;
+    }
+    flags = two_byte_opcodes[code[pos++]];
+  } else {
+    flags = one_byte_opcodes[opcode];
+  }
+
+  if (flags == 0) {
+    return false;
+  }
+
+  if ((flags & OP_MODRM) != 0) {
+    if (pos >= size) {
+      return false;
+    }
+
+    auto modrm = code[pos++];
+    auto mod = modrm >> 6;
+    auto reg = (modrm >> 3) & 7;
+    auto rm = modrm & 7;
+
+    if (mod != 3 && rm == 4) {
+      if (pos >= size) {
+        return false;
+      }
+      auto sib = code[pos++];
+      if (mod == 0 && (sib & 7) == 5) {
+        pos += 4;
+      }
+    } else if (mod == 0 && rm == 5) {
+      insn->rip_relative = true;
+      insn->disp_offset = pos;
+      pos += 4;
+    }
+
+    if (mod == 1) {
+      pos += 1;
+    } else if (mod == 2) {
+      pos += 4;
+    }
+
+    if ((flags & OP_GROUP3) != 0 && reg < 2) {
+      flags |= opcode == 0xf6 ? OP_IMM8 : OP_IMMZ;
+    }
+
+    if ((flags & OP_GROUP5) != 0) {
+      if (reg == 7) {
+        return false;
+      }
+      // Indirect calls and jumps, near or far.
+      insn->transfers = reg >= 2 && reg <= 5;
+      if (reg == 4 || reg == 5) {
+        flags |= OP_STOP;
+      }
+    }
+  }
+
+  size_t immediate_size = 0;
+  if ((flags & OP_IMM8) != 0) {
+    immediate_size += 1;
+  }
+  if ((flags & OP_IMMZ) != 0) {
+    immediate_size += operand_size_16 ? 2 : 4;
+  }
+  if ((flags & OP_IMMV) != 0) {
+    immediate_size += rex_w ? 8 : operand_size_16 ? 2 : 4;
+  }
+
+  if ((flags & (OP_REL8 | OP_REL32)) != 0) {
+    auto rel_size = (flags & OP_REL8) != 0 ? 1 : 4;
+    if (pos + rel_size > size) {
+      return false;
+    }
+
+    if (rel_size == 1) {
+      insn->target = (int8_t)code[pos];
+    } else {
+      memcpy(&insn->target, code + pos, sizeof(insn->target));
+    }
+    insn->transfers = true;
+    insn->has_target = true;
+    immediate_size += rel_size;
+  }
+
+  pos += immediate_size;
+  if (pos > size) {
+    return false;
+  }
+
+  insn->size = pos;
+  insn->transfers |= (flags & OP_STOP) != 0;
+  return true;
+}
+
+size_t prologue_measure(
+  uint8_t const* code,
+  size_t size,
+  size_t min_size,
+  size_t max_size,
+  trampoline_relocation_t* relocations,
+  size_t* n_relocations
+) {
+  size_t prologue_size = 0;
+  size_t offset = 0;
+  *n_relocations = 0;
+
+  while (offset < size) {
+    instruction_t insn;
+    if (!decode(code + offset, size - offset, &insn)) {
+      // Past the prologue, the check below only covers as much of the
+      // function as the decoder can follow.
+      return prologue_size;
+    }
+
+    auto end = offset + insn.size;
+
+    if (prologue_size == 0) {
+      if (insn.transfers || end > max_size) {
+        return 0;
+      }
+
+      if (insn.rip_relative) {
+        if (*n_relocations == TRAMPOLINE_MAX_RELOCATIONS) {
+          return 0;
+        }
+        relocations[(*n_relocations)++] = (trampoline_relocation_t){
+          .offset = offset + insn.disp_offset,
+          .end = end,
+        };
+      }
+
+      if (end >= min_size) {
+        prologue_size = end;
+      }
+    } else if (insn.has_target) {
+      // Anything jumping back into the prologue (e.g. a loop starting at the
+      // top of the function) would land in the middle of the patch.
+      auto target = (int64_t)end + insn.target;
+      if (target > 0 && target < (int64_t)prologue_size) {
+        return 0;
+      }
+    }
+
+    offset = end;
+  }
+
+  return prologue_size;
+}
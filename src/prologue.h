@@ -0,0 +1,28 @@
+#ifndef GTKCLIPBLOCK_PROLOGUE_H
+#define GTKCLIPBLOCK_PROLOGUE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "trampoline.h"
+
+// A small x86-64 instruction-length decoder, standing in for distorm in
+// builds with -Ddecoder=builtin. It only knows the instructions
+// compilers put at the start of functions (pushes, moves, arithmetic, SSE
+// spills, endbr64, ...); anything else in the prologue makes it give up.
+
+// Returns how many bytes at the start of the function (`code`, `size` bytes
+// long) can be moved to a trampoline: whole instructions, at least `min_size`
+// and at most `max_size` bytes, none of them branching. Their %rip-relative
+// operands are stored in `relocations` (up to TRAMPOLINE_MAX_RELOCATIONS).
+// Returns 0 if there's no such prologue, or if the rest of the function
+// branches into the middle of it (as far as it can be decoded).
+size_t prologue_measure(
+  uint8_t const* code,
+  size_t size,
+  size_t min_size,
+  size_t max_size,
+  trampoline_relocation_t* relocations,
+  size_t* n_relocations
+);
+
+#endif
@@ -0,0 +1,287 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "prologuecache.h"
+
+typedef struct {
+  struct link_map const* map;
+  prologue_cache_object_t* object;
+  bool found;
+} find_object_ctx_t;
+
+static int find_object_callback(struct dl_phdr_info* info, size_t, void* data) {
+  auto ctx = (find_object_ctx_t*)data;
+
+  // Objects can share a load address across namespaces, but not their
+  // dynamic section.
+  if (info->dlpi_addr != ctx->map->l_addr) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < info->dlpi_phnum; i++) {
+    if (
+      info->dlpi_phdr[i].p_type == PT_DYNAMIC
+      && (void*)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr) == ctx->map->l_ld
+    ) {
+      ctx->object->base = info->dlpi_addr;
+      ctx->object->phdrs = info->dlpi_phdr;
+      ctx->object->n_phdrs = info->dlpi_phnum;
+      ctx->found = true;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static size_t align_up(size_t value, size_t align) {
+  return (value + align - 1) & ~(align - 1);
+}
+
+static bool read_build_id(prologue_cache_object_t* object) {
+  for (size_t i = 0; i < object->n_phdrs; i++) {
+    auto phdr = &object->phdrs[i];
+    if (phdr->p_type != PT_NOTE) {
+      continue;
+    }
+
+    size_t align = phdr->p_align == 8 ? 8 : 4;
+    auto notes = (char const*)(object->base + phdr->p_vaddr);
+    size_t offset = 0;
+
+    while (offset + sizeof(ElfW(Nhdr)) <= phdr->p_memsz) {
+      auto note = (ElfW(Nhdr) const*)(notes + offset);
+      auto name_offset = offset + sizeof(*note);
+      auto desc_offset = name_offset + align_up(note->n_namesz, align);
+      auto next = desc_offset + align_up(note->n_descsz, align);
+      if (next > phdr->p_memsz) {
+        break;
+      }
+
+      if (
+        note->n_type == NT_GNU_BUILD_ID
+        && note->n_namesz == sizeof("GNU")
+        && memcmp(notes + name_offset, "GNU", sizeof("GNU")) == 0
+        && note->n_descsz > 0
+        && note->n_descsz <= PROLOGUE_CACHE_KEY_MAX
+      ) {
+        object->key.kind = PROLOGUE_CACHE_KEY_BUILD_ID;
+        object->key.size = note->n_descsz;
+        memcpy(object->key.bytes, notes + desc_offset, note->n_descsz);
+        return true;
+      }
+
+      offset = next;
+    }
+  }
+
+  return false;
+}
+
+static bool read_file_id(prologue_cache_object_t* object, char const* path) {
+  struct stat st;
+  if (path == nullptr || path[0] != '/' || stat(path, &st) != 0) {
+    return false;
+  }
+
+  // Hashing the contents would cost more than the lookups this saves.
+  uint64_t const identity[] = {
+    st.st_dev,
+    st.st_ino,
+    st.st_size,
+    st.st_mtim.tv_sec,
+    st.st_mtim.tv_nsec,
+  };
+  auto hash = config_checksum(identity, sizeof(identity));
+
+  object->key.kind = PROLOGUE_CACHE_KEY_FILE;
+  object->key.size = sizeof(hash);
+  memcpy(object->key.bytes, &hash, sizeof(hash));
+  return true;
+}
+
+bool prologue_cache_object_init(
+  prologue_cache_object_t* object,
+  struct link_map const* map
+) {
+  *object = (prologue_cache_object_t){};
+
+  find_object_ctx_t ctx = {
+    .map = map,
+    .object = object,
+  };
+  dl_iterate_phdr(find_object_callback, &ctx);
+  if (!ctx.found) {
+    return false;
+  }
+
+  return read_build_id(object) || read_file_id(object, map->l_name);
+}
+
+static bool cache_is_valid(void const* data, size_t size) {
+  auto header = (prologue_cache_header_t const*)data;
+
+  if (
+    size < sizeof(prologue_cache_header_t)
+    || header->magic != PROLOGUE_CACHE_MAGIC
+    || header->version != PROLOGUE_CACHE_VERSION
+    || header->size != size
+  ) {
+    return false;
+  }
+
+  size_t checksummed = offsetof(prologue_cache_header_t, checksum) + sizeof(header->checksum);
+  if (config_checksum((char const*)data + checksummed, size - checksummed) != header->checksum) {
+    return false;
+  }
+
+  if (
+    header->libraries_offset % _Alignof(prologue_cache_library_t) != 0
+    || header->libraries_offset > size
+    || header->n_libraries > (size - header->libraries_offset) / sizeof(prologue_cache_library_t)
+    || header->entries_offset % _Alignof(prologue_cache_entry_t) != 0
+    || header->entries_offset > size
+    || header->n_entries > (size - header->entries_offset) / sizeof(prologue_cache_entry_t)
+  ) {
+    return false;
+  }
+
+  auto libraries = (prologue_cache_library_t const*)((char const*)data + header->libraries_offset);
+  for (uint32_t i = 0; i < header->n_libraries; i++) {
+    if (
+      libraries[i].key.size > PROLOGUE_CACHE_KEY_MAX
+      || libraries[i].first_entry > header->n_entries
+      || libraries[i].n_entries > header->n_entries - libraries[i].first_entry
+    ) {
+      return false;
+    }
+  }
+
+  auto entries = (prologue_cache_entry_t const*)((char const*)data + header->entries_offset);
+  for (uint32_t i = 0; i < header->n_entries; i++) {
+    if (
+      memchr(entries[i].name, '\0', sizeof(entries[i].name)) == nullptr
+      || entries[i].prologue_size > PROLOGUE_CACHE_PROLOGUE_MAX
+    ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool prologue_cache_open(prologue_cache_t* cache) {
+  *cache = (prologue_cache_t){};
+
+  int fd = open(GTKCLIPBLOCK_PROLOGUE_CACHE_PATH, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  // Whoever can write to this gets to choose what we patch into GTK.
+  struct stat st;
+  bool trusted = fstat(fd, &st) == 0
+    && S_ISREG(st.st_mode)
+    && (st.st_mode & (S_IWGRP | S_IWOTH)) == 0
+    && st.st_uid == 0
+    && st.st_size >= (off_t)sizeof(prologue_cache_header_t);
+
+  void* mapping = MAP_FAILED;
+  if (trusted) {
+    mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  if (!cache_is_valid(mapping, st.st_size)) {
+    munmap(mapping, st.st_size);
+    return false;
+  }
+
+  cache->mapping = mapping;
+  cache->size = st.st_size;
+  return true;
+}
+
+void prologue_cache_close(prologue_cache_t* cache) {
+  if (cache->mapping != nullptr) {
+    munmap(cache->mapping, cache->size);
+  }
+  *cache = (prologue_cache_t){};
+}
+
+prologue_cache_library_t const* prologue_cache_find_library(
+  prologue_cache_t const* cache,
+  prologue_cache_object_t const* object
+) {
+  auto header = (prologue_cache_header_t const*)cache->mapping;
+  auto libraries = (prologue_cache_library_t const*)(
+    (char const*)cache->mapping + header->libraries_offset
+  );
+
+  for (uint32_t i = 0; i < header->n_libraries; i++) {
+    if (
+      libraries[i].key.kind == object->key.kind
+      && libraries[i].key.size == object->key.size
+      && memcmp(libraries[i].key.bytes, object->key.bytes, object->key.size) == 0
+    ) {
+      return &libraries[i];
+    }
+  }
+
+  return nullptr;
+}
+
+prologue_cache_entry_t const* prologue_cache_find_entry(
+  prologue_cache_t const* cache,
+  prologue_cache_library_t const* library,
+  char const* name
+) {
+  auto header = (prologue_cache_header_t const*)cache->mapping;
+  auto entries = (prologue_cache_entry_t const*)(
+    (char const*)cache->mapping + header->entries_offset
+  );
+
+  for (uint32_t i = 0; i < library->n_entries; i++) {
+    auto entry = &entries[library->first_entry + i];
+    if (strcmp(entry->name, name) == 0) {
+      return entry;
+    }
+  }
+
+  return nullptr;
+}
+
+void* prologue_cache_validate(
+  prologue_cache_object_t const* object,
+  prologue_cache_entry_t const* entry
+) {
+  if (entry->offset == 0 || entry->prologue_size == 0) {
+    return nullptr;
+  }
+
+  // The cache could be stale in ways the key doesn't capture (e.g. a
+  // rebuilt library with a reused build-id), so the prologue has to be in
+  // the object's code and look the way it did when the cache was built.
+  for (size_t i = 0; i < object->n_phdrs; i++) {
+    auto phdr = &object->phdrs[i];
+    if (
+      phdr->p_type == PT_LOAD
+      && (phdr->p_flags & PF_X) != 0
+      && entry->offset >= phdr->p_vaddr
+      && entry->offset + entry->prologue_size <= phdr->p_vaddr + phdr->p_memsz
+    ) {
+      auto address = (void*)(object->base + entry->offset);
+      return memcmp(address, entry->prologue, entry->prologue_size) == 0 ? address : nullptr;
+    }
+  }
+
+  return nullptr;
+}
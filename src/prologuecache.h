@@ -0,0 +1,104 @@
+#ifndef GTKCLIPBLOCK_PROLOGUECACHE_H
+#define GTKCLIPBLOCK_PROLOGUECACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <link.h>
+
+// Prologue cache, produced by gtkclipblock-prologues for the GTK libraries
+// installed on the system and mapped read-only by the library. For every
+// hooked function, it records where it is relative to the library's load
+// address and how many bytes of its prologue can be moved to a trampoline
+// as-is, so that it can be patched without looking it up or disassembling it.
+//
+// Libraries are keyed by their build-id, or if they don't have one, by a hash
+// of their file's identity (device, inode, size and mtime).
+//
+// Layout: prologue_cache_header_t, followed by the libraries
+// (prologue_cache_library_t) and then all of their entries
+// (prologue_cache_entry_t). The checksum covers everything past the checksum
+// field (see config_checksum).
+
+#define PROLOGUE_CACHE_MAGIC 0x504b4347u
+#define PROLOGUE_CACHE_VERSION 1
+#define PROLOGUE_CACHE_KEY_MAX 32
+#define PROLOGUE_CACHE_NAME_MAX 64
+#define PROLOGUE_CACHE_PROLOGUE_MAX 24
+
+typedef enum {
+  PROLOGUE_CACHE_KEY_BUILD_ID = 1,
+  PROLOGUE_CACHE_KEY_FILE = 2,
+} prologue_cache_key_kind_t;
+
+typedef struct {
+  uint8_t kind;
+  uint8_t size;
+  uint8_t bytes[PROLOGUE_CACHE_KEY_MAX];
+} prologue_cache_key_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;
+  uint64_t checksum;
+  uint32_t n_libraries;
+  uint32_t libraries_offset;
+  uint32_t n_entries;
+  uint32_t entries_offset;
+} prologue_cache_header_t;
+
+typedef struct {
+  prologue_cache_key_t key;
+  uint8_t reserved[6];
+  uint32_t first_entry;
+  uint32_t n_entries;
+} prologue_cache_library_t;
+
+typedef struct {
+  char name[PROLOGUE_CACHE_NAME_MAX];
+  // 0 if the library doesn't define the function.
+  uint64_t offset;
+  // 0 if the function can't be patched without relocating its prologue.
+  uint8_t prologue_size;
+  uint8_t reserved[7];
+  uint8_t prologue[PROLOGUE_CACHE_PROLOGUE_MAX];
+} prologue_cache_entry_t;
+
+typedef struct {
+  void* mapping;
+  size_t size;
+} prologue_cache_t;
+
+// A loaded object, as far as the cache is concerned.
+typedef struct {
+  ElfW(Addr) base;
+  ElfW(Phdr) const* phdrs;
+  size_t n_phdrs;
+  prologue_cache_key_t key;
+} prologue_cache_object_t;
+
+bool prologue_cache_open(prologue_cache_t* cache);
+void prologue_cache_close(prologue_cache_t* cache);
+
+bool prologue_cache_object_init(
+  prologue_cache_object_t* object,
+  struct link_map const* map
+);
+
+prologue_cache_library_t const* prologue_cache_find_library(
+  prologue_cache_t const* cache,
+  prologue_cache_object_t const* object
+);
+prologue_cache_entry_t const* prologue_cache_find_entry(
+  prologue_cache_t const* cache,
+  prologue_cache_library_t const* library,
+  char const* name
+);
+
+// Returns the function's address if its prologue still matches the entry.
+void* prologue_cache_validate(
+  prologue_cache_object_t const* object,
+  prologue_cache_entry_t const* entry
+);
+
+#endif
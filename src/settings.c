@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+#include "settings.h"
+
+static bool parse_number(char const* str, uint32_t* value) {
+  if (*str == '\0') {
+    return false;
+  }
+
+  uint64_t number = 0;
+  for (; *str != '\0'; str++) {
+    if (*str < '0' || *str > '9') {
+      return false;
+    }
+    number = number * 10 + (*str - '0');
+    if (number > UINT32_MAX) {
+      return false;
+    }
+  }
+
+  *value = number;
+  return true;
+}
+
+bool parse_primary_setting(char const* value, settings_t* settings) {
+  uint32_t param = 0;
+  if (strcmp(value, "block") == 0) {
+    settings->primary = PRIMARY_BLOCK;
+  } else if (strcmp(value, "local") == 0) {
+    settings->primary = PRIMARY_LOCAL;
+  } else if (strncmp(value, "debounce:", 9) == 0 && parse_number(value + 9, &param) && param > 0) {
+    settings->primary = PRIMARY_DEBOUNCE;
+  } else if (strncmp(value, "limit:", 6) == 0 && parse_number(value + 6, &param)) {
+    settings->primary = PRIMARY_LIMIT;
+  } else {
+    return false;
+  }
+
+  settings->primary_param = param;
+  return true;
+}
+
+static bool token_equals(char const* tok, size_t len, char const* str) {
+  return strlen(str) == len && strncmp(tok, str, len) == 0;
+}
+
+void load_settings(settings_t* settings) {
+  char* env;
+
+  settings->gtk2_disabled = true;
+  settings->gtk3_disabled = true;
+  settings->gtk4_disabled = true;
+  settings->hook_dlfcn_disabled = false;
+  settings->hook_dlfcn_auto = false;
+  settings->pin = false;
+  settings->interpose = false;
+  settings->stats = false;
+  settings->primary = PRIMARY_BLOCK;
+  settings->primary_param = 0;
+
+  env = getenv("GTKCLIPBLOCK_HOOK");
+  if (env != nullptr) {
+    if (strcmp(env, "") == 0 || strcmp(env, "0") == 0) {
+      // this is the default
+    } else if (strcmp(env, "1") == 0) {
+      settings->gtk2_disabled = false;
+      settings->gtk3_disabled = false;
+      settings->gtk4_disabled = false;
+    } else {
+      settings->gtk2_disabled = true;
+      settings->gtk3_disabled = true;
+      settings->gtk4_disabled = true;
+
+      // This runs in every process under ld.so.preload; tokenize in place
+      // rather than allocating a copy.
+      char const* tok = env;
+      while (*tok != '\0') {
+        size_t len = strcspn(tok, ",");
+        if (token_equals(tok, len, "gtk2")) {
+          settings->gtk2_disabled = false;
+        } else if (token_equals(tok, len, "gtk3")) {
+          settings->gtk3_disabled = false;
+        } else if (token_equals(tok, len, "gtk4")) {
+          settings->gtk4_disabled = false;
+        }
+
+        tok += len;
+        if (*tok == ',') {
+          tok++;
+        }
+      }
+    }
+    env = nullptr;
+  }
+
+  if (settings->gtk2_disabled && settings->gtk3_disabled && settings->gtk4_disabled) {
+    settings->hook_dlfcn_disabled = true;
+  }
+
+  env = getenv("GTKCLIPBLOCK_HOOK_DLFCN");
+  if (env != nullptr) {
+    if (strcmp(env, "0") == 0) {
+      settings->hook_dlfcn_disabled = true;
+    } else if (strcmp(env, "auto") == 0) {
+      settings->hook_dlfcn_auto = true;
+    }
+    env = nullptr;
+  }
+
+  env = getenv("GTKCLIPBLOCK_PIN");
+  if (env != nullptr) {
+    settings->pin = strcmp(env, "1") == 0;
+    env = nullptr;
+  }
+
+  env = getenv("GTKCLIPBLOCK_HOOK_MODE");
+  if (env != nullptr) {
+    settings->interpose = strcmp(env, "interpose") == 0;
+    env = nullptr;
+  }
+
+  env = getenv("GTKCLIPBLOCK_STATS");
+  if (env != nullptr) {
+    settings->stats = strcmp(env, "1") == 0;
+    env = nullptr;
+  }
+
+  env = getenv("GTKCLIPBLOCK_PRIMARY");
+  if (env != nullptr) {
+    parse_primary_setting(env, settings);
+    env = nullptr;
+  }
+}
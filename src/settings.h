@@ -0,0 +1,46 @@
+#ifndef GTKCLIPBLOCK_SETTINGS_H
+#define GTKCLIPBLOCK_SETTINGS_H
+
+#include <stdint.h>
+
+// What the hooks do with writes to the primary selection (see primary.h).
+typedef enum {
+  PRIMARY_BLOCK,
+  // Coalesce ownership claims, committing the last one once they stop
+  // coming for primary_param milliseconds.
+  PRIMARY_DEBOUNCE,
+  // Let through what's at most primary_param bytes, and nothing else.
+  PRIMARY_LIMIT,
+  // Keep claims within the process, where reads get served from.
+  PRIMARY_LOCAL,
+} primary_mode_t;
+
+typedef struct {
+  bool gtk2_disabled;
+  bool gtk3_disabled;
+  bool gtk4_disabled;
+  bool hook_dlfcn_disabled;
+  // Only hook dlopen/dlclose if the initial link map suggests GTK might get
+  // loaded later on.
+  bool hook_dlfcn_auto;
+  // Keep dlopen()ed GTK libraries mapped for the rest of the process'
+  // lifetime, which lets the dlopen/dlclose hooks remove themselves once GTK
+  // is hooked.
+  bool pin;
+  // Hook GTK's public functions by interposing them (when the library is
+  // built with them, see interpose.h) instead of patching them.
+  bool interpose;
+  // Count what the hooks do in a file under the user's
+  // GTKCLIPBLOCK_STATS_DIR-<uid> (see stats.h).
+  bool stats;
+  primary_mode_t primary;
+  uint32_t primary_param;
+} settings_t;
+
+void load_settings(settings_t* settings);
+
+// Parses GTKCLIPBLOCK_PRIMARY's value: `block`, `debounce:<ms>`,
+// `limit:<bytes>` or `local`. Leaves the settings alone if it's invalid.
+bool parse_primary_setting(char const* value, settings_t* settings);
+
+#endif
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/prctl.h>
+#include "startuptrace.h"
+
+#define REPORT_MAX 512
+
+static char const* const phase_names[STARTUP_TRACE_N_PHASES] = {
+  [STARTUP_TRACE_CONFIG] = "config",
+  [STARTUP_TRACE_POLICY] = "policy",
+  [STARTUP_TRACE_LINKMAP] = "linkmap",
+  [STARTUP_TRACE_RESOLVE] = "resolve",
+  [STARTUP_TRACE_DECODE] = "decode",
+  [STARTUP_TRACE_PATCH] = "patch",
+  [STARTUP_TRACE_DLFCN] = "dlfcn",
+};
+
+static struct {
+  // Hooks running on other threads read this; only the constructor's thread
+  // (`thread`) ever gets past it.
+  _Atomic bool active;
+  pid_t thread;
+  // Points into the environment, nullptr for stderr.
+  char const* path;
+  startup_trace_phase_t redirect;
+  uint64_t start;
+  uint64_t last;
+  uint64_t durations[STARTUP_TRACE_N_PHASES];
+} trace = {};
+
+static uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+void startup_trace_begin() {
+  auto env = getenv("GTKCLIPBLOCK_TRACE");
+  if (env == nullptr || strncmp(env, "startup", 7) != 0) {
+    return;
+  }
+
+  if (env[7] == ':' && env[8] != '\0' && getauxval(AT_SECURE) == 0) {
+    trace.path = env + 8;
+  } else if (env[7] != '\0' && env[7] != ':') {
+    return;
+  }
+
+  trace.thread = gettid();
+  trace.redirect = STARTUP_TRACE_NONE;
+  trace.start = now_ns();
+  trace.last = trace.start;
+  atomic_store_explicit(&trace.active, true, memory_order_relaxed);
+}
+
+static bool is_tracing() {
+  return atomic_load_explicit(&trace.active, memory_order_relaxed) && gettid() == trace.thread;
+}
+
+void startup_trace_mark(startup_trace_phase_t phase) {
+  if (!is_tracing()) {
+    return;
+  }
+
+  auto now = now_ns();
+  if (trace.redirect != STARTUP_TRACE_NONE) {
+    phase = trace.redirect;
+  }
+  trace.durations[phase] += now - trace.last;
+  trace.last = now;
+}
+
+void startup_trace_redirect(startup_trace_phase_t phase) {
+  if (is_tracing()) {
+    trace.redirect = phase;
+  }
+}
+
+typedef struct {
+  char data[REPORT_MAX];
+  size_t size;
+} buffer_t;
+
+static void append(buffer_t* buffer, char const* str) {
+  auto len = strlen(str);
+  if (len > sizeof(buffer->data) - 1 - buffer->size) {
+    len = sizeof(buffer->data) - 1 - buffer->size;
+  }
+  memcpy(buffer->data + buffer->size, str, len);
+  buffer->size += len;
+}
+
+static void append_number(buffer_t* buffer, uint64_t value) {
+  char digits[21];
+  size_t pos = sizeof(digits) - 1;
+  digits[pos] = '\0';
+  do {
+    digits[--pos] = '0' + value % 10;
+    value /= 10;
+  } while (value != 0);
+  append(buffer, digits + pos);
+}
+
+void startup_trace_end(char const* outcome) {
+  if (!is_tracing()) {
+    return;
+  }
+
+  atomic_store_explicit(&trace.active, false, memory_order_relaxed);
+  auto total = now_ns() - trace.start;
+
+  // e.g. "gtkclipblock: startup pid=1234 comm=gedit outcome=hooked
+  //   total=182345ns config=5210ns policy=0ns ...", all on one line.
+  char comm[17] = {};
+  prctl(PR_GET_NAME, comm);
+
+  buffer_t buffer = {};
+  append(&buffer, "gtkclipblock: startup pid=");
+  append_number(&buffer, (uint64_t)getpid());
+  append(&buffer, " comm=");
+  append(&buffer, comm);
+  append(&buffer, " outcome=");
+  append(&buffer, outcome);
+  append(&buffer, " total=");
+  append_number(&buffer, total);
+  append(&buffer, "ns");
+  for (size_t i = 0; i < STARTUP_TRACE_N_PHASES; i++) {
+    append(&buffer, " ");
+    append(&buffer, phase_names[i]);
+    append(&buffer, "=");
+    append_number(&buffer, trace.durations[i]);
+    append(&buffer, "ns");
+  }
+  buffer.data[buffer.size++] = '\n';
+
+  // A single O_APPEND write keeps lines from different processes apart.
+  int fd = STDERR_FILENO;
+  if (trace.path != nullptr) {
+    fd = open(trace.path, O_WRONLY | O_APPEND | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      return;
+    }
+  }
+
+  while (write(fd, buffer.data, buffer.size) < 0 && errno == EINTR) {
+  }
+
+  if (fd != STDERR_FILENO) {
+    close(fd);
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef GTKCLIPBLOCK_STARTUPTRACE_H
+#define GTKCLIPBLOCK_STARTUPTRACE_H
+
+// With GTKCLIPBLOCK_TRACE=startup, the constructor reports how long each
+// phase of its setup took, as one line on stderr. With
+// GTKCLIPBLOCK_TRACE=startup:<path>, the line gets appended to <path> instead
+// (except in setuid/setgid programs, which only ever get stderr).
+//
+// Time is attributed by marks: each mark counts the time since the previous
+// one towards its phase. Marks are no-ops unless the trace is running, so
+// code shared with the dlopen() hooks can call them unconditionally.
+//
+// Nothing here allocates or takes a lock, and the report only goes through
+// write(2); tracing is safe in any process the library gets loaded into.
+// Only the thread that began the trace gets traced; marks from the hooks on
+// other threads are ignored.
+
+typedef enum {
+  STARTUP_TRACE_NONE = -1,
+  // Loading the config cache, or parsing the environment.
+  STARTUP_TRACE_CONFIG,
+  STARTUP_TRACE_POLICY,
+  // Setting up the link map tracker and looking for GTK in it.
+  STARTUP_TRACE_LINKMAP,
+  // Looking up GTK's functions (and the helpers the hooks use).
+  STARTUP_TRACE_RESOLVE,
+  // Measuring prologues and preparing trampolines.
+  STARTUP_TRACE_DECODE,
+  STARTUP_TRACE_PATCH,
+  // Installing the dlopen()/dlclose() hooks, all phases included.
+  STARTUP_TRACE_DLFCN,
+  STARTUP_TRACE_N_PHASES,
+} startup_trace_phase_t;
+
+// Starts the trace if GTKCLIPBLOCK_TRACE asks for it.
+void startup_trace_begin();
+
+void startup_trace_mark(startup_trace_phase_t phase);
+
+// Until called again with STARTUP_TRACE_NONE, marks count towards `phase`
+// whatever they say.
+void startup_trace_redirect(startup_trace_phase_t phase);
+
+// Writes the report and stops the trace. `outcome` says how far the
+// constructor got.
+void startup_trace_end(char const* outcome);
+
+#endif
@@ -0,0 +1,238 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/auxv.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+typedef enum {
+  FILE_NONE,
+  FILE_CREATING,
+  FILE_READY,
+  FILE_FAILED,
+} file_state_t;
+
+typedef struct {
+  uint64_t _Atomic counts[STATS_N_FUNCTIONS][STATS_N_DECISIONS];
+} slot_t;
+
+#define SLOT_SIZE \
+  ((sizeof(slot_t) + STATS_SLOT_ALIGN - 1) / STATS_SLOT_ALIGN * STATS_SLOT_ALIGN)
+
+// Everything about the file lives in a page that gets wiped on fork: a child
+// process starts over with its own file rather than counting into its
+// parent's. This works the same from the LD_AUDIT namespace, where
+// pthread_atfork() handlers wouldn't run.
+typedef struct {
+  _Atomic file_state_t state;
+  pid_t pid;
+  stats_header_t* header;
+  char* slots;
+  char path[64];
+} process_t;
+
+static process_t* process = nullptr;
+
+// The slot is only valid as long as it was claimed by the current process.
+static thread_local slot_t* thread_slot = nullptr;
+static thread_local pid_t thread_slot_pid = 0;
+
+#define STATS_FUNCTION_NAME(toolkit, func) toolkit ":" #func,
+#define STATS_GTK2_NAME(func) STATS_FUNCTION_NAME("gtk2", func)
+#define STATS_GTK3_NAME(func) STATS_FUNCTION_NAME("gtk3", func)
+#define STATS_GTK4_NAME(func) STATS_FUNCTION_NAME("gtk4", func)
+
+static char const* const function_names[STATS_N_FUNCTIONS] = {
+  HOOK_GTK2_FUNCTIONS(STATS_GTK2_NAME)
+  HOOK_GTK3_FUNCTIONS(STATS_GTK3_NAME)
+  HOOK_GTK4_FUNCTIONS(STATS_GTK4_NAME)
+};
+
+void stats_set_enabled(bool enabled) {
+  // Whoever reads the file can tell what the program does with the
+  // clipboard; setuid programs don't get to leave that around.
+  if (!enabled || getauxval(AT_SECURE) != 0) {
+    return;
+  }
+
+  auto page_size = (size_t)sysconf(_SC_PAGESIZE);
+  static_assert(sizeof(process_t) <= 4096);
+  void* page = mmap(
+    nullptr,
+    page_size,
+    PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS,
+    -1,
+    0
+  );
+  if (page == MAP_FAILED) {
+    return;
+  }
+
+  if (madvise(page, page_size, MADV_WIPEONFORK) != 0) {
+    munmap(page, page_size);
+    return;
+  }
+
+  process = (process_t*)page;
+}
+
+static bool is_usable_directory(char const* path) {
+  struct stat st;
+  if (lstat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    return false;
+  }
+
+  // Someone else could have created it first, to read or replace the files.
+  return st.st_uid == geteuid() && (st.st_mode & (S_IRWXG | S_IRWXO)) == 0;
+}
+
+static int create_file(char const* path) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd >= 0 || errno != EEXIST) {
+      return fd;
+    }
+
+    // Left behind by an earlier process with the same pid (e.g. one that
+    // exec'd or crashed).
+    if (unlink(path) != 0) {
+      return -1;
+    }
+  }
+  return -1;
+}
+
+static bool map_file() {
+  char dir[sizeof(process->path)];
+  snprintf(dir, sizeof(dir), STATS_DIR_FORMAT, (unsigned int)geteuid());
+  if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+    return false;
+  }
+
+  if (!is_usable_directory(dir)) {
+    return false;
+  }
+
+  auto pid = getpid();
+  auto len = snprintf(process->path, sizeof(process->path), "%s/%d", dir, (int)pid);
+  if (len < 0 || (size_t)len >= sizeof(process->path)) {
+    return false;
+  }
+
+  int fd = create_file(process->path);
+  if (fd < 0) {
+    return false;
+  }
+
+  size_t names_offset = sizeof(stats_header_t);
+  size_t slots_offset = names_offset + STATS_N_FUNCTIONS * STATS_NAME_MAX;
+  slots_offset = (slots_offset + STATS_SLOT_ALIGN - 1) / STATS_SLOT_ALIGN * STATS_SLOT_ALIGN;
+  size_t size = slots_offset + STATS_N_SLOTS * SLOT_SIZE;
+
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, size) == 0) {
+    mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    unlink(process->path);
+    return false;
+  }
+
+  auto header = (stats_header_t*)mapping;
+  auto names = (char*)mapping + names_offset;
+  for (size_t i = 0; i < STATS_N_FUNCTIONS; i++) {
+    strncpy(names + i * STATS_NAME_MAX, function_names[i], STATS_NAME_MAX - 1);
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  *header = (stats_header_t){
+    .version = STATS_VERSION,
+    .size = size,
+    .pid = pid,
+    .n_functions = STATS_N_FUNCTIONS,
+    .names_offset = names_offset,
+    .n_slots = STATS_N_SLOTS,
+    .slots_offset = slots_offset,
+    .slot_size = SLOT_SIZE,
+    .start_time = (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec,
+  };
+  prctl(PR_GET_NAME, header->comm);
+  __atomic_store_n(&header->magic, STATS_MAGIC, __ATOMIC_RELEASE);
+
+  process->pid = pid;
+  process->header = header;
+  process->slots = (char*)mapping + slots_offset;
+  return true;
+}
+
+static slot_t* claim_slot() {
+  auto state = atomic_load_explicit(&process->state, memory_order_acquire);
+  if (state == FILE_NONE) {
+    // Only one thread creates the file; the others don't wait for it, and
+    // skip counting until it's there.
+    if (!atomic_compare_exchange_strong(&process->state, &state, FILE_CREATING)) {
+      return nullptr;
+    }
+    state = map_file() ? FILE_READY : FILE_FAILED;
+    atomic_store_explicit(&process->state, state, memory_order_release);
+  }
+
+  if (state != FILE_READY) {
+    return nullptr;
+  }
+
+  auto index = atomic_fetch_add_explicit(&process->header->n_threads, 1, memory_order_relaxed);
+  if (index >= STATS_N_SLOTS) {
+    index = STATS_N_SLOTS - 1;
+  }
+
+  thread_slot = (slot_t*)(process->slots + index * SLOT_SIZE);
+  thread_slot_pid = process->pid;
+  return thread_slot;
+}
+
+void stats_count(stats_function_t function, stats_decision_t decision) {
+  if (process == nullptr) {
+    return;
+  }
+
+  // After a fork, the process page reads as zeroes again.
+  auto slot = thread_slot;
+  if (slot == nullptr || thread_slot_pid != process->pid) {
+    slot = claim_slot();
+    if (slot == nullptr) {
+      return;
+    }
+  }
+
+  auto counter = &slot->counts[function][decision];
+  if (slot == (slot_t*)(process->slots + (STATS_N_SLOTS - 1) * SLOT_SIZE)) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+  } else {
+    auto count = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, count + 1, memory_order_relaxed);
+  }
+}
+
+__attribute__((destructor))
+static void remove_file() {
+  if (
+    process != nullptr
+    && atomic_load(&process->state) == FILE_READY
+    && process->pid == getpid()
+  ) {
+    unlink(process->path);
+  }
+}
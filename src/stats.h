@@ -0,0 +1,75 @@
+#ifndef GTKCLIPBLOCK_STATS_H
+#define GTKCLIPBLOCK_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "gtk2/gtk2.h"
+#include "gtk3/gtk3.h"
+#include "gtk4/gtk4.h"
+
+// Per-process counters of what the hooks did (blocked or passed through, per
+// hooked function), for gtkclipblock-stat. With GTKCLIPBLOCK_STATS=1, the
+// first hook call creates GTKCLIPBLOCK_STATS_DIR-<uid>/<pid>, shared-mapped
+// for the rest of the process' lifetime and removed when it exits. Each user
+// gets their own directory, which only they (and root) can get into.
+//
+// Every thread gets its own cache-line-aligned slot in that file, so that
+// counting is a plain load and store; readers add the slots up. Threads past
+// the last slot share it, and count with atomic increments instead.
+//
+// Layout: stats_header_t, followed by the functions' names (char
+// [STATS_NAME_MAX] each, e.g. "gtk3:gtk_clipboard_set_text") and the slots
+// (n_slots of slot_size bytes, each a uint64_t[n_functions][STATS_N_DECISIONS]).
+// The magic number gets written last.
+
+#define STATS_DIR_FORMAT GTKCLIPBLOCK_STATS_DIR "-%u"
+
+#define STATS_MAGIC 0x53424347u
+#define STATS_VERSION 1
+#define STATS_NAME_MAX 64
+#define STATS_N_SLOTS 64
+#define STATS_SLOT_ALIGN 64
+
+typedef enum {
+  STATS_PASSED,
+  STATS_BLOCKED,
+  STATS_N_DECISIONS,
+} stats_decision_t;
+
+#define STATS_GTK2_FUNCTION(func) STATS_GTK2_##func,
+#define STATS_GTK3_FUNCTION(func) STATS_GTK3_##func,
+#define STATS_GTK4_FUNCTION(func) STATS_GTK4_##func,
+
+typedef enum {
+  HOOK_GTK2_FUNCTIONS(STATS_GTK2_FUNCTION)
+  HOOK_GTK3_FUNCTIONS(STATS_GTK3_FUNCTION)
+  HOOK_GTK4_FUNCTIONS(STATS_GTK4_FUNCTION)
+  STATS_N_FUNCTIONS,
+} stats_function_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t size;
+  int32_t pid;
+  uint32_t n_functions;
+  uint32_t names_offset;
+  uint32_t n_slots;
+  uint32_t slots_offset;
+  uint32_t slot_size;
+  // CLOCK_MONOTONIC, in nanoseconds.
+  uint64_t start_time;
+  // How many threads have claimed a slot so far.
+  uint64_t _Atomic n_threads;
+  char comm[16];
+} stats_header_t;
+
+// Has to be called before any hook can run.
+void stats_set_enabled(bool enabled);
+
+void stats_count(stats_function_t function, stats_decision_t decision);
+
+#define STATS_FUNCTION(toolkit, func) STATS_##toolkit##_##func
+#define STATS_COUNT(toolkit, func, decision) stats_count(STATS_FUNCTION(toolkit, func), decision)
+
+#endif
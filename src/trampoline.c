@@ -0,0 +1,280 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "trampoline.h"
+
+#if defined(__x86_64__)
+
+// Each slot holds the copied prologue followed by a jump back into the
+// function, and at its end, the jump to the hook that the function's own
+// (rel32) jump lands on: the hooks usually live too far away from GTK to be
+// reached directly.
+#define SLOT_SIZE 64
+#define ABS_JUMP_SIZE 14
+
+static_assert(TRAMPOLINE_MAX_PROLOGUE_SIZE <= SLOT_SIZE - 2 * ABS_JUMP_SIZE, "prologues must fit in a slot");
+static_assert(TRAMPOLINE_MAX_PATCHES * SLOT_SIZE <= 4096, "trampolines must fit in a page");
+
+typedef struct {
+  uint8_t* target;
+  uint8_t patch[TRAMPOLINE_PATCH_SIZE];
+  uint8_t saved[TRAMPOLINE_PATCH_SIZE];
+} patch_t;
+
+struct trampoline_set {
+  uint8_t* page;
+  size_t page_size;
+  size_t n_patches;
+  size_t n_installed;
+  patch_t patches[TRAMPOLINE_MAX_PATCHES];
+};
+
+static bool in_reach(uint8_t const* jump, uint8_t const* destination) {
+  auto delta = (intptr_t)destination - (intptr_t)(jump + TRAMPOLINE_PATCH_SIZE);
+  return delta >= INT32_MIN && delta <= INT32_MAX;
+}
+
+static void write_abs_jump(uint8_t* at, void const* destination) {
+  // jmp *0(%rip), followed by the address
+  at[0] = 0xff;
+  at[1] = 0x25;
+  memset(at + 2, 0, 4);
+  memcpy(at + 6, &destination, sizeof(destination));
+}
+
+static uint8_t* map_near(uint8_t const* near, size_t size) {
+  // The address is only a hint; if it's taken, the kernel puts the mapping
+  // wherever it wants. Probe outward from the library until one lands within
+  // reach.
+  auto origin = (uintptr_t)near & ~(uintptr_t)(size - 1);
+  for (uintptr_t distance = 1 << 20; distance < (uintptr_t)1 << 31; distance <<= 1) {
+    uintptr_t const hints[] = { origin - distance, origin + distance };
+    for (size_t i = 0; i < sizeof(hints) / sizeof(*hints); i++) {
+      if (i == 0 && distance > origin) {
+        continue;
+      }
+
+      auto page = (uint8_t*)mmap(
+        (void*)hints[i],
+        size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0
+      );
+      if (page == MAP_FAILED) {
+        return nullptr;
+      }
+
+      if (in_reach(near, page) && in_reach(near, page + size)) {
+        return page;
+      }
+      munmap(page, size);
+    }
+  }
+
+  return nullptr;
+}
+
+static void write_code(uint8_t* at, uint8_t const* bytes) {
+  // Other threads might be running through the function. If the jump fits in
+  // an aligned quadword, they either see all of it or none of it.
+  auto word_start = (uintptr_t)at & ~(uintptr_t)7;
+  if ((uintptr_t)at + TRAMPOLINE_PATCH_SIZE <= word_start + 8) {
+    uint64_t word;
+    memcpy(&word, (void const*)word_start, sizeof(word));
+    memcpy((uint8_t*)&word + ((uintptr_t)at - word_start), bytes, TRAMPOLINE_PATCH_SIZE);
+    __atomic_store_n((uint64_t*)word_start, word, __ATOMIC_RELEASE);
+  } else {
+    memcpy(at, bytes, TRAMPOLINE_PATCH_SIZE);
+  }
+
+  __builtin___clear_cache((char*)at, (char*)at + TRAMPOLINE_PATCH_SIZE);
+}
+
+// Writes every function's patch (or its saved bytes back), making each page
+// they land on writable only once. Either all of them get written or, if a
+// page can't be made writable, none of them.
+static bool write_patches(trampoline_set_t* set, bool install) {
+  uintptr_t pages[2 * TRAMPOLINE_MAX_PATCHES];
+  size_t n_pages = 0;
+
+  for (size_t i = 0; i < set->n_patches; i++) {
+    auto at = (uintptr_t)set->patches[i].target;
+    auto first = at & ~(uintptr_t)(set->page_size - 1);
+    auto last = (at + TRAMPOLINE_PATCH_SIZE - 1) & ~(uintptr_t)(set->page_size - 1);
+    for (auto page = first; page <= last; page += set->page_size) {
+      size_t j = 0;
+      while (j < n_pages && pages[j] != page) {
+        j++;
+      }
+      if (j == n_pages) {
+        pages[n_pages++] = page;
+      }
+    }
+  }
+
+  size_t n_writable = 0;
+  while (
+    n_writable < n_pages
+    && mprotect((void*)pages[n_writable], set->page_size, PROT_READ | PROT_WRITE | PROT_EXEC) == 0
+  ) {
+    n_writable++;
+  }
+
+  auto written = n_writable == n_pages;
+  if (written) {
+    for (size_t i = 0; i < set->n_patches; i++) {
+      auto patch = &set->patches[i];
+      write_code(patch->target, install ? patch->patch : patch->saved);
+    }
+  }
+
+  // If this fails, the code is still consistent; the page just stays
+  // writable.
+  for (size_t i = 0; i < n_writable; i++) {
+    mprotect((void*)pages[i], set->page_size, PROT_READ | PROT_EXEC);
+  }
+
+  return written;
+}
+
+trampoline_set_t* trampoline_set_create(void const* near) {
+  auto set = (trampoline_set_t*)calloc(1, sizeof(trampoline_set_t));
+  if (set == nullptr) {
+    return nullptr;
+  }
+
+  set->page_size = sysconf(_SC_PAGESIZE);
+  set->page = map_near(near, set->page_size);
+  if (set->page == nullptr) {
+    free(set);
+    return nullptr;
+  }
+
+  return set;
+}
+
+void* trampoline_set_prepare(
+  trampoline_set_t* set,
+  void* target,
+  uint8_t const* prologue,
+  size_t prologue_size,
+  trampoline_relocation_t const* relocations,
+  size_t n_relocations,
+  void* hook
+) {
+  if (
+    set->n_installed > 0
+    || set->n_patches == TRAMPOLINE_MAX_PATCHES
+    || prologue_size < TRAMPOLINE_PATCH_SIZE
+    || prologue_size > TRAMPOLINE_MAX_PROLOGUE_SIZE
+  ) {
+    return nullptr;
+  }
+
+  auto slot = set->page + set->n_patches * SLOT_SIZE;
+  auto hook_jump = slot + SLOT_SIZE - ABS_JUMP_SIZE;
+  if (!in_reach(target, hook_jump)) {
+    return nullptr;
+  }
+
+  memcpy(slot, prologue, prologue_size);
+
+  // The slot doesn't count as used until the end, so bailing out from here
+  // leaves it to the next prepare.
+  for (size_t i = 0; i < n_relocations; i++) {
+    auto relocation = &relocations[i];
+    if (relocation->offset + sizeof(int32_t) > relocation->end || relocation->end > prologue_size) {
+      return nullptr;
+    }
+
+    int32_t disp;
+    memcpy(&disp, slot + relocation->offset, sizeof(disp));
+    auto destination = (intptr_t)target + relocation->end + disp;
+    auto moved = destination - (intptr_t)(slot + relocation->end);
+    if (moved < INT32_MIN || moved > INT32_MAX) {
+      return nullptr;
+    }
+
+    disp = moved;
+    memcpy(slot + relocation->offset, &disp, sizeof(disp));
+  }
+  write_abs_jump(slot + prologue_size, (uint8_t*)target + prologue_size);
+  write_abs_jump(hook_jump, hook);
+
+  auto patch = &set->patches[set->n_patches++];
+  patch->target = target;
+  memcpy(patch->saved, target, TRAMPOLINE_PATCH_SIZE);
+
+  // jmp rel32
+  int32_t rel = (intptr_t)hook_jump - (intptr_t)(patch->target + TRAMPOLINE_PATCH_SIZE);
+  patch->patch[0] = 0xe9;
+  memcpy(&patch->patch[1], &rel, sizeof(rel));
+
+  return slot;
+}
+
+bool trampoline_set_install(trampoline_set_t* set) {
+  // The trampolines are never written to again.
+  if (mprotect(set->page, set->page_size, PROT_READ | PROT_EXEC) != 0) {
+    return false;
+  }
+
+  if (!write_patches(set, true)) {
+    return false;
+  }
+
+  set->n_installed = set->n_patches;
+  return true;
+}
+
+bool trampoline_set_uninstall(trampoline_set_t* set) {
+  if (set->n_installed == 0) {
+    return true;
+  }
+
+  if (!write_patches(set, false)) {
+    return false;
+  }
+
+  set->n_installed = 0;
+  return true;
+}
+
+void trampoline_set_destroy(trampoline_set_t* set) {
+  munmap(set->page, set->page_size);
+  free(set);
+}
+
+#else
+
+trampoline_set_t* trampoline_set_create(void const* near) {
+  return nullptr;
+}
+
+void* trampoline_set_prepare(
+  trampoline_set_t* set,
+  void* target,
+  uint8_t const* prologue,
+  size_t prologue_size,
+  trampoline_relocation_t const* relocations,
+  size_t n_relocations,
+  void* hook
+) {
+  return nullptr;
+}
+
+bool trampoline_set_install(trampoline_set_t* set) {
+  return false;
+}
+
+bool trampoline_set_uninstall(trampoline_set_t* set) {
+  return false;
+}
+
+void trampoline_set_destroy(trampoline_set_t* set) {}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef GTKCLIPBLOCK_TRAMPOLINE_H
+#define GTKCLIPBLOCK_TRAMPOLINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A minimal alternative to funchook for functions whose prologue is already
+// known to be position-independent (see prologuecache.h and prologue.h): the
+// prologue is copied to a trampoline as-is (save for %rip-relative
+// displacements, if the caller points them out), and the function's first
+// bytes get replaced with a jump to the hook. x86-64 only; elsewhere,
+// trampoline_set_create() always fails.
+//
+// The API mirrors funchook's: prepare every hook, then install them all.
+
+#define TRAMPOLINE_PATCH_SIZE 5
+#define TRAMPOLINE_MAX_PATCHES 32
+#define TRAMPOLINE_MAX_PROLOGUE_SIZE 36
+#define TRAMPOLINE_MAX_RELOCATIONS 4
+
+typedef struct trampoline_set trampoline_set_t;
+
+// A %rip-relative disp32 in the prologue, which has to be adjusted once the
+// prologue gets moved.
+typedef struct {
+  // Where the displacement is in the prologue.
+  uint8_t offset;
+  // Where its instruction ends, i.e. what it's relative to.
+  uint8_t end;
+} trampoline_relocation_t;
+
+// `near` is any address in the library that gets patched; every target has
+// to be within reach of a rel32 jump from the trampolines.
+trampoline_set_t* trampoline_set_create(void const* near);
+
+// Returns the trampoline to call the original function through.
+void* trampoline_set_prepare(
+  trampoline_set_t* set,
+  void* target,
+  uint8_t const* prologue,
+  size_t prologue_size,
+  trampoline_relocation_t const* relocations,
+  size_t n_relocations,
+  void* hook
+);
+
+bool trampoline_set_install(trampoline_set_t* set);
+bool trampoline_set_uninstall(trampoline_set_t* set);
+void trampoline_set_destroy(trampoline_set_t* set);
+
+#endif
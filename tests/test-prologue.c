@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include "prologue.h"
+
+// Checks the builtin decoder against prologues whose lengths were taken from
+// objdump, along with the forms it has to turn down.
+
+#define CODE(...) \
+  .code = (uint8_t const[]){__VA_ARGS__}, \
+  .size = sizeof((uint8_t const[]){__VA_ARGS__})
+
+typedef struct {
+  char const* name;
+  uint8_t const* code;
+  size_t size;
+  size_t expected;
+  size_t n_relocations;
+  trampoline_relocation_t relocations[TRAMPOLINE_MAX_RELOCATIONS];
+} fixture_t;
+
+static fixture_t const fixtures[] = {
+  {
+    "push %rbp; mov %rsp,%rbp; push %r15",
+    CODE(0x55, 0x48, 0x89, 0xe5, 0x41, 0x57, 0xc3),
+    .expected = 6,
+  },
+  {
+    "endbr64; push %rbp",
+    CODE(0xf3, 0x0f, 0x1e, 0xfa, 0x55, 0xc3),
+    .expected = 5,
+  },
+  {
+    "sub $imm8,%rsp; push %rbx",
+    CODE(0x48, 0x83, 0xec, 0x18, 0x53, 0xc3),
+    .expected = 5,
+  },
+  {
+    "sub $imm32,%rsp",
+    CODE(0x48, 0x81, 0xec, 0x88, 0x00, 0x00, 0x00, 0xc3),
+    .expected = 7,
+  },
+  {
+    "movw $imm16,disp8(%rbp)",
+    CODE(0x66, 0xc7, 0x45, 0xfc, 0x01, 0x00, 0xc3),
+    .expected = 6,
+  },
+  {
+    "movabs $imm64,%rax",
+    CODE(0x48, 0xb8, 1, 2, 3, 4, 5, 6, 7, 8, 0xc3),
+    .expected = 10,
+  },
+  {
+    "test $imm32,%edi",
+    CODE(0xf7, 0xc7, 0x01, 0x00, 0x00, 0x00, 0xc3),
+    .expected = 6,
+  },
+  {
+    "neg %eax; push %rbp; mov %rsp,%rbp",
+    CODE(0xf7, 0xd8, 0x55, 0x48, 0x89, 0xe5, 0xc3),
+    .expected = 6,
+  },
+  {
+    "mov disp32,%eax (SIB, no base)",
+    CODE(0x8b, 0x04, 0x25, 0x10, 0x00, 0x00, 0x00, 0xc3),
+    .expected = 7,
+  },
+  {
+    "mov disp32(%rip),%rax",
+    CODE(0x48, 0x8b, 0x05, 0x10, 0x00, 0x00, 0x00, 0xc3),
+    .expected = 7,
+    .n_relocations = 1,
+    .relocations = {{.offset = 3, .end = 7}},
+  },
+  {
+    "push %rbp; lea disp32(%rip),%rdi",
+    CODE(0x55, 0x48, 0x8d, 0x3d, 0x10, 0x00, 0x00, 0x00, 0xc3),
+    .expected = 8,
+    .n_relocations = 1,
+    .relocations = {{.offset = 4, .end = 8}},
+  },
+  {
+    "push disp32(%rip)",
+    CODE(0xff, 0x35, 0x10, 0x00, 0x00, 0x00, 0xc3),
+    .expected = 6,
+    .n_relocations = 1,
+    .relocations = {{.offset = 2, .end = 6}},
+  },
+  {
+    "jne back to the start of the function",
+    CODE(0x55, 0x48, 0x89, 0xe5, 0x41, 0x57, 0x75, 0xf8, 0xc3),
+    .expected = 6,
+  },
+
+  // Rejected.
+  {
+    "jmp rel32",
+    CODE(0xe9, 0x10, 0x00, 0x00, 0x00, 0xc3),
+  },
+  {
+    "jmp rel8",
+    CODE(0xeb, 0x00, 0xc3),
+  },
+  {
+    "push %rbp; call rel32",
+    CODE(0x55, 0xe8, 0x10, 0x00, 0x00, 0x00, 0xc3),
+  },
+  {
+    "push %rbp; je rel8",
+    CODE(0x55, 0x74, 0x00, 0xc3),
+  },
+  {
+    "jmp *disp32(%rip)",
+    CODE(0xff, 0x25, 0x10, 0x00, 0x00, 0x00, 0xc3),
+  },
+  {
+    "ret",
+    CODE(0xc3),
+  },
+  {
+    "xor %eax,%eax; ret",
+    CODE(0x31, 0xc0, 0xc3),
+  },
+  {
+    "push %rbp; ud2",
+    CODE(0x55, 0x0f, 0x0b),
+  },
+  {
+    "push %rbp; x87",
+    CODE(0x55, 0xd9, 0xc9, 0xc3),
+  },
+  {
+    "truncated mov",
+    CODE(0x48, 0x8b),
+  },
+  {
+    "jne back into the prologue",
+    CODE(0x55, 0x48, 0x89, 0xe5, 0x41, 0x57, 0x75, 0xfa, 0xc3),
+  },
+};
+
+static bool check(fixture_t const* fixture) {
+  trampoline_relocation_t relocations[TRAMPOLINE_MAX_RELOCATIONS];
+  size_t n_relocations;
+  auto size = prologue_measure(
+    fixture->code,
+    fixture->size,
+    TRAMPOLINE_PATCH_SIZE,
+    TRAMPOLINE_MAX_PROLOGUE_SIZE,
+    relocations,
+    &n_relocations
+  );
+
+  if (size != fixture->expected) {
+    fprintf(stderr, "%s: measured %zu bytes, expected %zu\n", fixture->name, size, fixture->expected);
+    return false;
+  }
+
+  // What's left in `relocations` doesn't matter if the prologue is rejected.
+  if (size == 0) {
+    return true;
+  }
+
+  if (n_relocations != fixture->n_relocations) {
+    fprintf(
+      stderr,
+      "%s: found %zu relocations, expected %zu\n",
+      fixture->name,
+      n_relocations,
+      fixture->n_relocations
+    );
+    return false;
+  }
+
+  for (size_t i = 0; i < n_relocations; i++) {
+    auto found = relocations[i];
+    auto expected = fixture->relocations[i];
+    if (found.offset != expected.offset || found.end != expected.end) {
+      fprintf(
+        stderr,
+        "%s: relocation %zu is at %u (ending at %u), expected %u (ending at %u)\n",
+        fixture->name,
+        i,
+        found.offset,
+        found.end,
+        expected.offset,
+        expected.end
+      );
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int main() {
+  size_t failed = 0;
+  for (size_t i = 0; i < sizeof(fixtures) / sizeof(*fixtures); i++) {
+    if (!check(&fixtures[i])) {
+      failed++;
+    }
+  }
+
+  if (failed > 0) {
+    fprintf(stderr, "%zu of %zu prologues failed\n", failed, sizeof(fixtures) / sizeof(*fixtures));
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,60 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cachefile.h"
+
+static bool make_parent_dirs(char const* progname, char const* path) {
+  auto copy = strdup(path);
+  for (auto p = copy + 1; *p != '\0'; p++) {
+    if (*p != '/') {
+      continue;
+    }
+
+    *p = '\0';
+    if (mkdir(copy, 0755) != 0 && errno != EEXIST) {
+      fprintf(stderr, "%s: mkdir %s: %s\n", progname, copy, strerror(errno));
+      free(copy);
+      return false;
+    }
+    *p = '/';
+  }
+
+  free(copy);
+  return true;
+}
+
+bool cachefile_write(char const* progname, char const* path, void const* data, size_t size) {
+  if (!make_parent_dirs(progname, path)) {
+    return false;
+  }
+
+  char* tmp_path = nullptr;
+  if (asprintf(&tmp_path, "%s.%d.tmp", path, (int)getpid()) < 0) {
+    perror(progname);
+    return false;
+  }
+
+  // the library refuses caches writable by anyone but their owner
+  umask(022);
+  auto file = fopen(tmp_path, "wx");
+  bool ok = file != nullptr
+    && fwrite(data, 1, size, file) == size
+    && fflush(file) == 0
+    && fsync(fileno(file)) == 0;
+  if (file != nullptr) {
+    ok = fclose(file) == 0 && ok;
+  }
+  ok = ok && rename(tmp_path, path) == 0;
+
+  if (!ok) {
+    fprintf(stderr, "%s: writing %s: %s\n", progname, path, strerror(errno));
+    unlink(tmp_path);
+  }
+
+  free(tmp_path);
+  return ok;
+}
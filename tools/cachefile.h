@@ -0,0 +1,10 @@
+#ifndef GTKCLIPBLOCK_CACHEFILE_H
+#define GTKCLIPBLOCK_CACHEFILE_H
+
+#include <stddef.h>
+
+// Replaces `path` atomically, creating its parent directories as needed.
+// Errors are reported on stderr.
+bool cachefile_write(char const* progname, char const* path, void const* data, size_t size);
+
+#endif
@@ -0,0 +1,443 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "cachefile.h"
+
+// Compiles gtkclipblock.conf into the binary cache the library maps at
+// startup (see config.h).
+//
+// Config syntax: one `key = value` per line, `#` starts a comment line (only
+// at the start of a line; anything else is part of the value).
+//
+//   # same values as GTKCLIPBLOCK_HOOK
+//   hook = gtk2,gtk3,gtk4
+//   # same values as GTKCLIPBLOCK_HOOK_DLFCN
+//   hook-dlfcn = auto
+//   # same values as GTKCLIPBLOCK_PIN
+//   pin = 1
+//   # same values as GTKCLIPBLOCK_HOOK_MODE
+//   hook-mode = interpose
+//   # same values as GTKCLIPBLOCK_STATS
+//   stats = 1
+//   # same values as GTKCLIPBLOCK_PRIMARY
+//   primary = debounce:150
+//   # allow (default) or deny
+//   policy-default = deny
+//   # allow and deny may be repeated
+//   allow = comm:firefox
+//   deny = exe:/usr/bin/*
+
+typedef struct {
+  char* pattern;
+  uint8_t field;
+  uint8_t action;
+} rule_t;
+
+typedef struct {
+  settings_t settings;
+  uint8_t default_action;
+  rule_t* rules;
+  size_t n_rules;
+} config_t;
+
+static char const* progname = "gtkclipblock-compile";
+
+static char* trim(char* str) {
+  while (*str == ' ' || *str == '\t') {
+    str++;
+  }
+
+  auto end = str + strlen(str);
+  while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r')) {
+    end--;
+  }
+  *end = '\0';
+
+  return str;
+}
+
+static bool parse_hook(char* value, settings_t* settings) {
+  settings->gtk2_disabled = true;
+  settings->gtk3_disabled = true;
+  settings->gtk4_disabled = true;
+
+  if (strcmp(value, "") == 0 || strcmp(value, "0") == 0) {
+    return true;
+  }
+
+  if (strcmp(value, "1") == 0) {
+    settings->gtk2_disabled = false;
+    settings->gtk3_disabled = false;
+    settings->gtk4_disabled = false;
+    return true;
+  }
+
+  char* tok_rest = nullptr;
+  for (auto tok = strtok_r(value, ",", &tok_rest); tok != nullptr; tok = strtok_r(nullptr, ",", &tok_rest)) {
+    tok = trim(tok);
+    if (strcmp(tok, "gtk2") == 0) {
+      settings->gtk2_disabled = false;
+    } else if (strcmp(tok, "gtk3") == 0) {
+      settings->gtk3_disabled = false;
+    } else if (strcmp(tok, "gtk4") == 0) {
+      settings->gtk4_disabled = false;
+    } else {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool parse_rule(char const* value, uint8_t action, config_t* config) {
+  static char const* const fields[] = {
+    [POLICY_FIELD_EXE] = "exe",
+    [POLICY_FIELD_ARGV0] = "argv0",
+    [POLICY_FIELD_COMM] = "comm",
+  };
+
+  auto sep = strchr(value, ':');
+  if (sep == nullptr || sep[1] == '\0') {
+    return false;
+  }
+
+  for (uint8_t field = 0; field < sizeof(fields) / sizeof(*fields); field++) {
+    if (strlen(fields[field]) != (size_t)(sep - value) || strncmp(value, fields[field], sep - value) != 0) {
+      continue;
+    }
+
+    config->rules = realloc(config->rules, (config->n_rules + 1) * sizeof(*config->rules));
+    if (config->rules == nullptr) {
+      perror(progname);
+      exit(1);
+    }
+    config->rules[config->n_rules++] = (rule_t){
+      .pattern = strdup(sep + 1),
+      .field = field,
+      .action = action,
+    };
+    return true;
+  }
+
+  return false;
+}
+
+static bool parse_file(char const* path, config_t* config) {
+  auto file = fopen(path, "r");
+  if (file == nullptr) {
+    // a missing file is recorded as such in the cache
+    return errno == ENOENT;
+  }
+
+  char* line = nullptr;
+  size_t line_size = 0;
+  size_t lineno = 0;
+  bool ok = true;
+
+  while (getline(&line, &line_size, file) >= 0) {
+    lineno++;
+    auto str = trim(line);
+    if (str[0] == '\0' || str[0] == '#') {
+      continue;
+    }
+
+    auto eq = strchr(str, '=');
+    if (eq == nullptr) {
+      fprintf(stderr, "%s:%zu: expected `key = value`\n", path, lineno);
+      ok = false;
+      continue;
+    }
+
+    *eq = '\0';
+    auto key = trim(str);
+    auto value = trim(eq + 1);
+    bool valid;
+
+    if (strcmp(key, "hook") == 0) {
+      valid = parse_hook(value, &config->settings);
+    } else if (strcmp(key, "hook-dlfcn") == 0) {
+      valid = true;
+      config->settings.hook_dlfcn_disabled = strcmp(value, "0") == 0;
+      config->settings.hook_dlfcn_auto = strcmp(value, "auto") == 0;
+      if (!config->settings.hook_dlfcn_disabled && !config->settings.hook_dlfcn_auto) {
+        valid = strcmp(value, "1") == 0;
+      }
+    } else if (strcmp(key, "pin") == 0) {
+      valid = strcmp(value, "0") == 0 || strcmp(value, "1") == 0;
+      config->settings.pin = strcmp(value, "1") == 0;
+    } else if (strcmp(key, "stats") == 0) {
+      valid = strcmp(value, "0") == 0 || strcmp(value, "1") == 0;
+      config->settings.stats = strcmp(value, "1") == 0;
+    } else if (strcmp(key, "primary") == 0) {
+      valid = parse_primary_setting(value, &config->settings);
+    } else if (strcmp(key, "hook-mode") == 0) {
+      valid = strcmp(value, "inline") == 0 || strcmp(value, "interpose") == 0;
+      config->settings.interpose = strcmp(value, "interpose") == 0;
+    } else if (strcmp(key, "policy-default") == 0) {
+      valid = strcmp(value, "allow") == 0 || strcmp(value, "deny") == 0;
+      config->default_action = strcmp(value, "deny") == 0
+        ? POLICY_ACTION_DENY
+        : POLICY_ACTION_ALLOW;
+    } else if (strcmp(key, "allow") == 0) {
+      valid = parse_rule(value, POLICY_ACTION_ALLOW, config);
+    } else if (strcmp(key, "deny") == 0) {
+      valid = parse_rule(value, POLICY_ACTION_DENY, config);
+    } else {
+      fprintf(stderr, "%s:%zu: unknown key `%s`\n", path, lineno, key);
+      ok = false;
+      continue;
+    }
+
+    if (!valid) {
+      fprintf(stderr, "%s:%zu: invalid value for `%s`: %s\n", path, lineno, key, value);
+      ok = false;
+    }
+  }
+
+  free(line);
+  fclose(file);
+  return ok;
+}
+
+static bool record_source(char const* path, config_source_t* source) {
+  if (strlen(path) >= sizeof(source->path)) {
+    fprintf(stderr, "%s: path too long: %s\n", progname, path);
+    return false;
+  }
+
+  *source = (config_source_t){
+    .used = true,
+  };
+  strcpy(source->path, path);
+
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return errno == ENOENT;
+  }
+
+  source->present = true;
+  source->dev = st.st_dev;
+  source->ino = st.st_ino;
+  source->size = st.st_size;
+  source->mtime_sec = st.st_mtim.tv_sec;
+  source->mtime_nsec = st.st_mtim.tv_nsec;
+  return true;
+}
+
+static bool is_glob(char const* pattern) {
+  return strpbrk(pattern, "*?\\") != nullptr;
+}
+
+static int compare_rules(void const* a, void const* b) {
+  auto lhs = (policy_rule_t const*)a;
+  auto rhs = (policy_rule_t const*)b;
+  return lhs->hash < rhs->hash ? -1 : lhs->hash > rhs->hash;
+}
+
+static size_t align_up(size_t value, size_t align) {
+  return (value + align - 1) / align * align;
+}
+
+static void* build_cache(config_t const* config, config_source_t const* sources, size_t* out_size) {
+  size_t strings_size = 1;
+  size_t n_literals = 0;
+  for (size_t i = 0; i < config->n_rules; i++) {
+    strings_size += strlen(config->rules[i].pattern) + 1;
+    n_literals += !is_glob(config->rules[i].pattern);
+  }
+  size_t n_globs = config->n_rules - n_literals;
+
+  size_t literals_offset = align_up(sizeof(config_header_t), _Alignof(policy_rule_t));
+  size_t globs_offset = literals_offset + n_literals * sizeof(policy_rule_t);
+  size_t strings_offset = globs_offset + n_globs * sizeof(policy_rule_t);
+  size_t size = strings_offset + strings_size;
+
+  auto data = (char*)calloc(1, size);
+  if (data == nullptr) {
+    perror(progname);
+    exit(1);
+  }
+
+  auto header = (config_header_t*)data;
+  auto literals = (policy_rule_t*)(data + literals_offset);
+  auto globs = (policy_rule_t*)(data + globs_offset);
+  auto strings = data + strings_offset;
+
+  // offset 0 is the empty string
+  size_t strings_len = 1;
+  uint8_t fields = 0;
+  size_t i_literal = 0;
+  size_t i_glob = 0;
+  for (size_t i = 0; i < config->n_rules; i++) {
+    auto rule = &config->rules[i];
+    auto len = strlen(rule->pattern);
+    memcpy(strings + strings_len, rule->pattern, len + 1);
+
+    policy_rule_t entry = {
+      .hash = policy_hash(rule->pattern),
+      .pattern = strings_len,
+      .field = rule->field,
+      .action = rule->action,
+    };
+    if (is_glob(rule->pattern)) {
+      globs[i_glob++] = entry;
+    } else {
+      literals[i_literal++] = entry;
+    }
+
+    fields |= 1u << rule->field;
+    strings_len += len + 1;
+  }
+  qsort(literals, n_literals, sizeof(*literals), compare_rules);
+
+  *header = (config_header_t){
+    .magic = CONFIG_MAGIC,
+    .version = CONFIG_VERSION,
+    .size = size,
+    .gtk2_disabled = config->settings.gtk2_disabled,
+    .gtk3_disabled = config->settings.gtk3_disabled,
+    .gtk4_disabled = config->settings.gtk4_disabled,
+    .hook_dlfcn_disabled = config->settings.hook_dlfcn_disabled,
+    .hook_dlfcn_auto = config->settings.hook_dlfcn_auto,
+    .pin = config->settings.pin,
+    .interpose = config->settings.interpose,
+    .stats = config->settings.stats,
+    .primary = config->settings.primary,
+    .primary_param = config->settings.primary_param,
+    .policy_fields = fields,
+    .policy_default_action = config->default_action,
+    .n_literals = n_literals,
+    .literals_offset = literals_offset,
+    .n_globs = n_globs,
+    .globs_offset = globs_offset,
+    .strings_offset = strings_offset,
+    .strings_size = strings_size,
+  };
+  memcpy(header->sources, sources, sizeof(header->sources));
+
+  size_t checksummed = offsetof(config_header_t, checksum) + sizeof(header->checksum);
+  header->checksum = config_checksum(data + checksummed, size - checksummed);
+
+  *out_size = size;
+  return data;
+}
+
+static char* xdg_path(char const* env, char const* fallback, char const* name) {
+  char* path = nullptr;
+  auto dir = getenv(env);
+  if (dir != nullptr && dir[0] == '/') {
+    if (asprintf(&path, "%s/%s", dir, name) < 0) {
+      return nullptr;
+    }
+    return path;
+  }
+
+  auto home = getenv("HOME");
+  if (home == nullptr || home[0] != '/') {
+    return nullptr;
+  }
+
+  if (asprintf(&path, "%s/%s/%s", home, fallback, name) < 0) {
+    return nullptr;
+  }
+  return path;
+}
+
+static void usage(FILE* stream) {
+  fprintf(
+    stream,
+    "usage: %s [--user] [-o OUTPUT] [CONFIG...]\n"
+    "\n"
+    "Compiles gtkclipblock's configuration into the binary cache loaded at startup.\n"
+    "\n"
+    "  --user     compile %s and the user's gtkclipblock.conf into the user's cache\n"
+    "  -o PATH    write the cache to PATH (default: %s)\n",
+    progname,
+    GTKCLIPBLOCK_SYSCONF_PATH,
+    GTKCLIPBLOCK_SYSTEM_CACHE_PATH
+  );
+}
+
+int main(int argc, char** argv) {
+  char const* output = nullptr;
+  char const* inputs[CONFIG_MAX_SOURCES] = {};
+  size_t n_inputs = 0;
+  bool user = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--user") == 0) {
+      user = true;
+    } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      usage(stdout);
+      return 0;
+    } else if (argv[i][0] == '-') {
+      usage(stderr);
+      return 2;
+    } else if (n_inputs < CONFIG_MAX_SOURCES) {
+      inputs[n_inputs++] = argv[i];
+    } else {
+      fprintf(stderr, "%s: at most %d config files are supported\n", progname, CONFIG_MAX_SOURCES);
+      return 2;
+    }
+  }
+
+  if (n_inputs == 0) {
+    inputs[n_inputs++] = GTKCLIPBLOCK_SYSCONF_PATH;
+    if (user) {
+      inputs[n_inputs] = xdg_path("XDG_CONFIG_HOME", ".config", "gtkclipblock.conf");
+      if (inputs[n_inputs] == nullptr) {
+        fprintf(stderr, "%s: couldn't determine the user's config directory\n", progname);
+        return 1;
+      }
+      n_inputs++;
+    }
+  }
+
+  if (output == nullptr) {
+    output = user
+      ? xdg_path("XDG_CACHE_HOME", ".cache", GTKCLIPBLOCK_CACHE_NAME)
+      : GTKCLIPBLOCK_SYSTEM_CACHE_PATH;
+    if (output == nullptr) {
+      fprintf(stderr, "%s: couldn't determine the user's cache directory\n", progname);
+      return 1;
+    }
+  }
+
+  config_t config = {
+    .settings = {
+      .gtk2_disabled = true,
+      .gtk3_disabled = true,
+      .gtk4_disabled = true,
+    },
+    .default_action = POLICY_ACTION_ALLOW,
+  };
+  config_source_t sources[CONFIG_MAX_SOURCES] = {};
+
+  // Later files override the settings of earlier ones, rules accumulate.
+  for (size_t i = 0; i < n_inputs; i++) {
+    char* path = realpath(inputs[i], nullptr);
+    auto source_path = path != nullptr ? path : inputs[i];
+
+    if (!record_source(source_path, &sources[i]) || !parse_file(source_path, &config)) {
+      fprintf(stderr, "%s: failed to read %s\n", progname, source_path);
+      return 1;
+    }
+    free(path);
+  }
+
+  size_t size;
+  auto data = build_cache(&config, sources, &size);
+  if (!cachefile_write(progname, output, data, size)) {
+    return 1;
+  }
+
+  free(data);
+  return 0;
+}
@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <distorm.h>
+#include <mnemonics.h>
+#include "config.h"
+#include "elfsym.h"
+#include "prologuecache.h"
+#include "trampoline.h"
+#include "cachefile.h"
+#include "gtk2.h"
+#include "gtk3.h"
+#include "gtk4.h"
+
+// Builds the prologue cache (see prologuecache.h) for the GTK libraries
+// installed on the system. It has to be rerun whenever GTK gets upgraded;
+// until then, the library ignores the entries that don't match anymore and
+// hooks those functions the usual way.
+//
+// The code is read from the library files rather than from memory, in case
+// this process got hooked itself.
+
+#define MAX_FUNCTION_SIZE (64 * 1024)
+#define MAX_INSTRUCTIONS 256
+
+#define FUNCTION_NAME(func) #func,
+
+static char const* const gtk2_functions[] = { HOOK_GTK2_FUNCTIONS(FUNCTION_NAME) };
+static char const* const gtk3_functions[] = { HOOK_GTK3_FUNCTIONS(FUNCTION_NAME) };
+static char const* const gtk4_functions[] = { HOOK_GTK4_FUNCTIONS(FUNCTION_NAME) };
+
+static struct {
+  char const* soname;
+  char const* const* functions;
+  size_t n_functions;
+} const toolkits[] = {
+  {
+    .soname = "libgtk-x11-2.0.so.0",
+    .functions = gtk2_functions,
+    .n_functions = sizeof(gtk2_functions) / sizeof(*gtk2_functions),
+  },
+  {
+    .soname = "libgtk-3.so.0",
+    .functions = gtk3_functions,
+    .n_functions = sizeof(gtk3_functions) / sizeof(*gtk3_functions),
+  },
+  {
+    .soname = "libgtk-4.so.1",
+    .functions = gtk4_functions,
+    .n_functions = sizeof(gtk4_functions) / sizeof(*gtk4_functions),
+  },
+};
+
+#define N_TOOLKITS (sizeof(toolkits) / sizeof(*toolkits))
+
+static char const* progname = "gtkclipblock-prologues";
+
+static bool is_position_independent(_DInst const* insn) {
+  if (insn->flags == FLAG_NOT_DECODABLE || (insn->flags & FLAG_RIP_RELATIVE) != 0) {
+    return false;
+  }
+
+  // Branches, calls and returns all end the prologue we can move; only
+  // conditional moves are fine.
+  auto fc = META_GET_FC(insn->meta);
+  return fc == FC_NONE || fc == FC_CMOV;
+}
+
+static bool branches_into(_DInst const* insn, uint64_t start, uint64_t end) {
+  for (size_t i = 0; i < OPERANDS_NO && insn->ops[i].type != O_NONE; i++) {
+    if (insn->ops[i].type == O_PC) {
+      auto target = INSTRUCTION_GET_TARGET(insn);
+      return target > start && target < end;
+    }
+  }
+  return false;
+}
+
+// Returns how many bytes of the function's prologue can be copied to a
+// trampoline as-is (whole instructions, enough for the jump that replaces
+// them), or 0 if it can't be patched that way.
+static size_t measure_prologue(uint8_t const* code, size_t size) {
+  _CodeInfo ci = {
+    .codeOffset = 0,
+    .code = code,
+    .codeLen = size,
+    .dt = Decode64Bits,
+    .features = DF_NONE,
+  };
+
+  size_t prologue_size = 0;
+  bool prologue_done = false;
+  _DInst insns[MAX_INSTRUCTIONS];
+
+  while (ci.codeLen > 0) {
+    unsigned int count = 0;
+    auto result = distorm_decompose(&ci, insns, MAX_INSTRUCTIONS, &count);
+    if (result == DECRES_INPUTERR || count == 0) {
+      return 0;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+      if (!prologue_done) {
+        if (!is_position_independent(&insns[i])) {
+          return 0;
+        }
+
+        prologue_size += insns[i].size;
+        prologue_done = prologue_size >= TRAMPOLINE_PATCH_SIZE;
+        if (prologue_size > PROLOGUE_CACHE_PROLOGUE_MAX) {
+          return 0;
+        }
+        continue;
+      }
+
+      // Anything jumping back into the prologue (e.g. a loop starting at the
+      // top of the function) would land in the middle of our jump.
+      if (branches_into(&insns[i], 0, prologue_size)) {
+        return 0;
+      }
+    }
+
+    if (result == DECRES_SUCCESS) {
+      break;
+    }
+
+    auto last = &insns[count - 1];
+    auto consumed = last->addr + last->size - ci.codeOffset;
+    ci.code += consumed;
+    ci.codeLen -= consumed;
+    ci.codeOffset += consumed;
+  }
+
+  return prologue_done ? prologue_size : 0;
+}
+
+static bool read_function(
+  int fd,
+  prologue_cache_object_t const* object,
+  uint64_t offset,
+  uint8_t* buf,
+  size_t size
+) {
+  for (size_t i = 0; i < object->n_phdrs; i++) {
+    auto phdr = &object->phdrs[i];
+    if (
+      phdr->p_type == PT_LOAD
+      && (phdr->p_flags & PF_X) != 0
+      && offset >= phdr->p_vaddr
+      && offset + size <= phdr->p_vaddr + phdr->p_filesz
+    ) {
+      auto file_offset = phdr->p_offset + (offset - phdr->p_vaddr);
+      return pread(fd, buf, size, file_offset) == (ssize_t)size;
+    }
+  }
+  return false;
+}
+
+static bool add_library(
+  size_t toolkit,
+  prologue_cache_library_t* library,
+  prologue_cache_entry_t* entries,
+  uint32_t first_entry
+) {
+  auto handle = dlopen(toolkits[toolkit].soname, RTLD_LAZY | RTLD_LOCAL);
+  if (handle == nullptr) {
+    return false;
+  }
+
+  struct link_map* map = nullptr;
+  elfsym_table_t table;
+  prologue_cache_object_t object;
+  if (
+    dlinfo(handle, RTLD_DI_LINKMAP, &map) != 0
+    || !elfsym_table_init(&table, map)
+    || !prologue_cache_object_init(&object, map)
+  ) {
+    fprintf(stderr, "%s: %s: unsupported library\n", progname, toolkits[toolkit].soname);
+    return false;
+  }
+
+  int fd = open(map->l_name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s: %s\n", progname, map->l_name, strerror(errno));
+    return false;
+  }
+
+  *library = (prologue_cache_library_t){
+    .key = object.key,
+    .first_entry = first_entry,
+    .n_entries = toolkits[toolkit].n_functions,
+  };
+
+  size_t n_patchable = 0;
+  auto code = (uint8_t*)malloc(MAX_FUNCTION_SIZE);
+  if (code == nullptr) {
+    perror(progname);
+    exit(1);
+  }
+  for (size_t i = 0; i < toolkits[toolkit].n_functions; i++) {
+    auto name = toolkits[toolkit].functions[i];
+    auto entry = &entries[i];
+    *entry = (prologue_cache_entry_t){};
+    strcpy(entry->name, name);
+
+    auto sym = elfsym_table_find(&table, name);
+    if (sym == nullptr) {
+      continue;
+    }
+
+    entry->offset = sym->st_value;
+
+    size_t size = sym->st_size < MAX_FUNCTION_SIZE ? sym->st_size : 0;
+    if (size == 0 || !read_function(fd, &object, sym->st_value, code, size)) {
+      continue;
+    }
+
+    entry->prologue_size = measure_prologue(code, size);
+    memcpy(entry->prologue, code, entry->prologue_size);
+    n_patchable += entry->prologue_size != 0;
+  }
+  free(code);
+  close(fd);
+
+  printf(
+    "%s: %zu/%zu functions can be patched directly\n",
+    map->l_name,
+    n_patchable,
+    toolkits[toolkit].n_functions
+  );
+  return true;
+}
+
+static void usage(FILE* stream) {
+  fprintf(
+    stream,
+    "usage: %s [-o OUTPUT]\n"
+    "\n"
+    "Records the prologues of the GTK functions gtkclipblock hooks, so that they can\n"
+    "be patched without disassembling them at startup.\n"
+    "\n"
+    "  -o PATH    write the cache to PATH (default: %s)\n",
+    progname,
+    GTKCLIPBLOCK_PROLOGUE_CACHE_PATH
+  );
+}
+
+int main(int argc, char** argv) {
+  char const* output = GTKCLIPBLOCK_PROLOGUE_CACHE_PATH;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      output = argv[++i];
+    } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      usage(stdout);
+      return 0;
+    } else {
+      usage(stderr);
+      return 2;
+    }
+  }
+
+  size_t n_entries = 0;
+  for (size_t i = 0; i < N_TOOLKITS; i++) {
+    n_entries += toolkits[i].n_functions;
+  }
+
+  size_t libraries_offset = sizeof(prologue_cache_header_t);
+  size_t entries_offset = libraries_offset + N_TOOLKITS * sizeof(prologue_cache_library_t);
+  static_assert(sizeof(prologue_cache_header_t) % _Alignof(prologue_cache_library_t) == 0);
+  static_assert(sizeof(prologue_cache_library_t) % _Alignof(prologue_cache_entry_t) == 0);
+
+  auto data = (char*)calloc(1, entries_offset + n_entries * sizeof(prologue_cache_entry_t));
+  if (data == nullptr) {
+    perror(progname);
+    return 1;
+  }
+
+  auto libraries = (prologue_cache_library_t*)(data + libraries_offset);
+  auto entries = (prologue_cache_entry_t*)(data + entries_offset);
+
+  // Toolkits that aren't installed are left out.
+  uint32_t n_libraries = 0;
+  uint32_t n_used = 0;
+  for (size_t i = 0; i < N_TOOLKITS; i++) {
+    if (add_library(i, &libraries[n_libraries], &entries[n_used], n_used)) {
+      n_used += libraries[n_libraries++].n_entries;
+    }
+  }
+
+  // The entries are packed right after the libraries that made it in.
+  entries_offset = libraries_offset + n_libraries * sizeof(prologue_cache_library_t);
+  memmove(data + entries_offset, entries, n_used * sizeof(prologue_cache_entry_t));
+  size_t size = entries_offset + n_used * sizeof(prologue_cache_entry_t);
+
+  auto header = (prologue_cache_header_t*)data;
+  *header = (prologue_cache_header_t){
+    .magic = PROLOGUE_CACHE_MAGIC,
+    .version = PROLOGUE_CACHE_VERSION,
+    .size = size,
+    .n_libraries = n_libraries,
+    .libraries_offset = libraries_offset,
+    .n_entries = n_used,
+    .entries_offset = entries_offset,
+  };
+
+  size_t checksummed = offsetof(prologue_cache_header_t, checksum) + sizeof(header->checksum);
+  header->checksum = config_checksum(data + checksummed, size - checksummed);
+
+  if (!cachefile_write(progname, output, data, size)) {
+    return 1;
+  }
+
+  free(data);
+  return 0;
+}
@@ -0,0 +1,367 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+
+// Reports the counters of the processes running with GTKCLIPBLOCK_STATS=1
+// (see src/stats.h), summed over their threads' slots.
+//
+// Without an interval, prints the totals since each process started. With
+// one, prints what changed during each interval, like vmstat.
+
+#define MAX_PROCESSES 1024
+
+typedef struct {
+  int32_t pid;
+  char comm[17];
+  uint64_t start_time;
+  uint64_t n_threads;
+  uint32_t n_functions;
+  char (*names)[STATS_NAME_MAX];
+  uint64_t (*counts)[STATS_N_DECISIONS];
+} sample_t;
+
+typedef struct {
+  sample_t* samples;
+  size_t n_samples;
+} snapshot_t;
+
+static char const* progname = "gtkclipblock-stat";
+
+static bool is_number(char const* name) {
+  if (*name == '\0') {
+    return false;
+  }
+  for (; *name != '\0'; name++) {
+    if (*name < '0' || *name > '9') {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool is_valid(stats_header_t const* header, size_t size) {
+  if (
+    __atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != STATS_MAGIC
+    || header->version != STATS_VERSION
+    || header->size != size
+  ) {
+    return false;
+  }
+
+  uint64_t names_end = header->names_offset + (uint64_t)header->n_functions * STATS_NAME_MAX;
+  uint64_t slots_end = header->slots_offset + (uint64_t)header->n_slots * header->slot_size;
+  return names_end <= size
+    && slots_end <= size
+    && header->slot_size >= (uint64_t)header->n_functions * STATS_N_DECISIONS * sizeof(uint64_t)
+    && header->slots_offset % _Alignof(uint64_t) == 0
+    && header->slot_size % _Alignof(uint64_t) == 0;
+}
+
+static bool read_file(int dir_fd, char const* name, sample_t* sample) {
+  int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  void* mapping = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= sizeof(stats_header_t)) {
+    mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+
+  if (mapping == MAP_FAILED) {
+    return false;
+  }
+
+  auto header = (stats_header_t const*)mapping;
+  bool valid = is_valid(header, st.st_size);
+  if (valid) {
+    *sample = (sample_t){
+      .pid = header->pid,
+      .start_time = header->start_time,
+      .n_threads = atomic_load_explicit(&header->n_threads, memory_order_relaxed),
+      .n_functions = header->n_functions,
+      .names = malloc(header->n_functions * sizeof(*sample->names)),
+      .counts = calloc(header->n_functions, sizeof(*sample->counts)),
+    };
+    memcpy(sample->comm, header->comm, sizeof(header->comm));
+
+    if (sample->names == nullptr || sample->counts == nullptr) {
+      perror(progname);
+      exit(1);
+    }
+
+    memcpy(sample->names, (char const*)mapping + header->names_offset, header->n_functions * sizeof(*sample->names));
+    for (uint32_t i = 0; i < header->n_functions; i++) {
+      sample->names[i][STATS_NAME_MAX - 1] = '\0';
+    }
+
+    auto n_slots = sample->n_threads < header->n_slots ? sample->n_threads : header->n_slots;
+    for (uint64_t slot = 0; slot < n_slots; slot++) {
+      auto counts = (uint64_t const*)((char const*)mapping + header->slots_offset + slot * header->slot_size);
+      for (uint32_t i = 0; i < header->n_functions; i++) {
+        for (int decision = 0; decision < STATS_N_DECISIONS; decision++) {
+          sample->counts[i][decision] += __atomic_load_n(&counts[i * STATS_N_DECISIONS + decision], __ATOMIC_RELAXED);
+        }
+      }
+    }
+  }
+
+  munmap(mapping, st.st_size);
+  return valid;
+}
+
+static void free_snapshot(snapshot_t* snapshot) {
+  for (size_t i = 0; i < snapshot->n_samples; i++) {
+    free(snapshot->samples[i].names);
+    free(snapshot->samples[i].counts);
+  }
+  free(snapshot->samples);
+  *snapshot = (snapshot_t){};
+}
+
+static int compare_samples(void const* a, void const* b) {
+  auto pid_a = ((sample_t const*)a)->pid;
+  auto pid_b = ((sample_t const*)b)->pid;
+  return (pid_a > pid_b) - (pid_a < pid_b);
+}
+
+static void scan_directory(DIR* dir, snapshot_t* snapshot) {
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr && snapshot->n_samples < MAX_PROCESSES) {
+    if (!is_number(entry->d_name)) {
+      continue;
+    }
+
+    // Processes that didn't get to remove their file (killed, crashed).
+    pid_t pid = atoi(entry->d_name);
+    if (kill(pid, 0) != 0 && errno == ESRCH) {
+      unlinkat(dirfd(dir), entry->d_name, 0);
+      continue;
+    }
+
+    auto sample = &snapshot->samples[snapshot->n_samples];
+    if (read_file(dirfd(dir), entry->d_name, sample) && sample->pid == pid) {
+      snapshot->n_samples++;
+    }
+  }
+}
+
+// Goes through every user's directory (GTKCLIPBLOCK_STATS_DIR-<uid>); only
+// root gets into anyone else's.
+static snapshot_t take_snapshot() {
+  snapshot_t snapshot = {
+    .samples = calloc(MAX_PROCESSES, sizeof(sample_t)),
+  };
+  if (snapshot.samples == nullptr) {
+    perror(progname);
+    exit(1);
+  }
+
+  // e.g. /dev/shm and gtkclipblock; the path is always absolute.
+  auto prefix = strrchr(GTKCLIPBLOCK_STATS_DIR, '/') + 1;
+  auto prefix_len = strlen(prefix);
+  char parent[PATH_MAX];
+  snprintf(parent, sizeof(parent), "%.*s", (int)(prefix - GTKCLIPBLOCK_STATS_DIR), GTKCLIPBLOCK_STATS_DIR);
+
+  auto parent_dir = opendir(parent);
+  if (parent_dir == nullptr) {
+    return snapshot;
+  }
+
+  struct dirent* entry;
+  while ((entry = readdir(parent_dir)) != nullptr) {
+    if (
+      strncmp(entry->d_name, prefix, prefix_len) != 0
+      || entry->d_name[prefix_len] != '-'
+      || !is_number(entry->d_name + prefix_len + 1)
+    ) {
+      continue;
+    }
+
+    // Nothing has been counted yet, or it's another user's.
+    int fd = openat(dirfd(parent_dir), entry->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    auto dir = fd >= 0 ? fdopendir(fd) : nullptr;
+    if (dir == nullptr) {
+      if (fd >= 0) {
+        close(fd);
+      }
+      continue;
+    }
+
+    scan_directory(dir, &snapshot);
+    closedir(dir);
+  }
+  closedir(parent_dir);
+
+  qsort(snapshot.samples, snapshot.n_samples, sizeof(sample_t), compare_samples);
+  return snapshot;
+}
+
+static sample_t const* find_sample(snapshot_t const* snapshot, sample_t const* sample) {
+  for (size_t i = 0; i < snapshot->n_samples; i++) {
+    auto other = &snapshot->samples[i];
+    // A pid could have been reused by a new process in the meantime.
+    if (
+      other->pid == sample->pid
+      && other->start_time == sample->start_time
+      && other->n_functions == sample->n_functions
+    ) {
+      return other;
+    }
+  }
+  return nullptr;
+}
+
+static uint64_t now_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void print_snapshot(snapshot_t const* snapshot, snapshot_t const* previous, double interval, bool verbose) {
+  printf("%8s %-16s %7s %12s %12s %10s %10s\n", "PID", "COMM", "THREADS", "BLOCKED", "PASSED", "BLOCKED/s", "PASSED/s");
+
+  auto now = now_ns();
+  for (size_t i = 0; i < snapshot->n_samples; i++) {
+    auto sample = &snapshot->samples[i];
+    auto base = previous != nullptr ? find_sample(previous, sample) : nullptr;
+
+    // Rates over the interval, or since the process started if that was
+    // more recent.
+    double seconds = (double)(now - sample->start_time) / 1e9;
+    if (base != nullptr || (previous != nullptr && seconds > interval)) {
+      seconds = interval;
+    }
+    if (seconds <= 0) {
+      seconds = 1;
+    }
+
+    uint64_t totals[STATS_N_DECISIONS] = {};
+    for (uint32_t f = 0; f < sample->n_functions; f++) {
+      for (int decision = 0; decision < STATS_N_DECISIONS; decision++) {
+        totals[decision] += sample->counts[f][decision] - (base != nullptr ? base->counts[f][decision] : 0);
+      }
+    }
+
+    printf(
+      "%8d %-16s %7llu %12llu %12llu %10.1f %10.1f\n",
+      (int)sample->pid,
+      sample->comm,
+      (unsigned long long)sample->n_threads,
+      (unsigned long long)totals[STATS_BLOCKED],
+      (unsigned long long)totals[STATS_PASSED],
+      totals[STATS_BLOCKED] / seconds,
+      totals[STATS_PASSED] / seconds
+    );
+
+    if (!verbose) {
+      continue;
+    }
+
+    for (uint32_t f = 0; f < sample->n_functions; f++) {
+      uint64_t counts[STATS_N_DECISIONS];
+      for (int decision = 0; decision < STATS_N_DECISIONS; decision++) {
+        counts[decision] = sample->counts[f][decision] - (base != nullptr ? base->counts[f][decision] : 0);
+      }
+      if (counts[STATS_BLOCKED] == 0 && counts[STATS_PASSED] == 0) {
+        continue;
+      }
+      printf(
+        "%8s   %-38s %12llu %12llu\n",
+        "",
+        sample->names[f],
+        (unsigned long long)counts[STATS_BLOCKED],
+        (unsigned long long)counts[STATS_PASSED]
+      );
+    }
+  }
+}
+
+static void usage(FILE* stream) {
+  fprintf(
+    stream,
+    "usage: %s [-v] [INTERVAL [COUNT]]\n"
+    "\n"
+    "Shows how many clipboard calls gtkclipblock blocked and passed through, per\n"
+    "process running with GTKCLIPBLOCK_STATS=1.\n"
+    "\n"
+    "  -v          break the counts down by hooked function\n"
+    "  INTERVAL    report what changed every INTERVAL seconds\n"
+    "  COUNT       stop after COUNT reports (default: run until interrupted)\n",
+    progname
+  );
+}
+
+static bool parse_number(char const* str, double* value) {
+  char* end;
+  errno = 0;
+  *value = strtod(str, &end);
+  return errno == 0 && end != str && *end == '\0' && *value > 0;
+}
+
+int main(int argc, char** argv) {
+  bool verbose = false;
+  double interval = 0;
+  double count = 0;
+  int n_numbers = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-v") == 0) {
+      verbose = true;
+    } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
+      usage(stdout);
+      return 0;
+    } else if (argv[i][0] == '-' || n_numbers == 2) {
+      usage(stderr);
+      return 2;
+    } else if (!parse_number(argv[i], n_numbers == 0 ? &interval : &count)) {
+      fprintf(stderr, "%s: invalid number: %s\n", progname, argv[i]);
+      return 2;
+    } else {
+      n_numbers++;
+    }
+  }
+
+  auto snapshot = take_snapshot();
+  if (interval == 0) {
+    print_snapshot(&snapshot, nullptr, 0, verbose);
+    free_snapshot(&snapshot);
+    return 0;
+  }
+
+  for (unsigned long long report = 0; count == 0 || report < count; report++) {
+    struct timespec delay = {
+      .tv_sec = (time_t)interval,
+      .tv_nsec = (long)((interval - (time_t)interval) * 1e9),
+    };
+    while (nanosleep(&delay, &delay) != 0 && errno == EINTR) {
+    }
+
+    auto next = take_snapshot();
+    if (report > 0) {
+      printf("\n");
+    }
+    print_snapshot(&next, &snapshot, interval, verbose);
+    fflush(stdout);
+
+    free_snapshot(&snapshot);
+    snapshot = next;
+  }
+
+  free_snapshot(&snapshot);
+  return 0;
+}